@@ -89,6 +89,7 @@ int main(int argc, char **argv)
 
   FCIODebug(debug);
   FCIOData *data = (FCIOData*)calloc( 1, sizeof(FCIOData) );
+  FCIOAllocBuffers(data);
 
   double since = elapsed_time(0);
   if (verbosity)
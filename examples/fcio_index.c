@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcio.h>
+
+int usage(const char* name)
+{
+  fprintf(stderr, "\n%s: <input> [<index>]", name);
+  fprintf(stderr, "\n\n"
+    "Writes the sidecar record index of the fcio file <input> to <index>\n"
+    "(default: <input>.fcidx). The file is mapped and only the leading\n"
+    "frames of each record are decoded. <input> may also be any fcio\n"
+    "peer (e.g. file://, tcp://), the index is then named after the part\n"
+    "following '://' unless <index> is given.\n"
+    );
+  return 1;
+}
+
+int main(int argc, const char* argv[])
+{
+  if (argc < 2)
+    return usage(argv[0]);
+
+  const char* path = strstr(argv[1], "://");
+  path = path ? path + 3 : argv[1];
+
+  char peer[4096];
+  if (path == argv[1])
+    snprintf(peer, sizeof(peer), "mmap://%s", argv[1]);
+  else
+    snprintf(peer, sizeof(peer), "%s", argv[1]);
+
+  char index_name[4096];
+  if (argc > 2)
+    snprintf(index_name, sizeof(index_name), "%s", argv[2]);
+  else
+    snprintf(index_name, sizeof(index_name), "%s.fcidx", path);
+
+  FCIOStream in = FCIOConnect(peer, 'r', 0, 0);
+  if (!in) {
+    fprintf(stderr, "Can not open %s\n", argv[1]);
+    return 1;
+  }
+  if (FCIOSetIndexFile(in, index_name)) {
+    FCIODisconnect(in);
+    return 1;
+  }
+
+  FCIOIndexEntry entry;
+  int tag, nrecords = 0;
+  while ((tag = FCIOReadIndexEntry(in, &entry)) && tag > 0)
+    nrecords++;
+
+  int rc = FCIOSetIndexFile(in, NULL);
+  FCIODisconnect(in);
+  fprintf(stderr, "Indexed %d records of %s in %s\n", nrecords, argv[1], index_name);
+  return (tag < 0 || rc) ? 1 : 0;
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcio.h>
+
+int usage(const char* name)
+{
+  fprintf(stderr, "\n%s: <input>", name);
+  fprintf(stderr, "\n\n"
+    "Prints the number of records per tag and the first and last event of\n"
+    "the fcio file <input>. Files with an FCIOTrailer are summarized without\n"
+    "reading the records, others are indexed first.\n"
+    );
+  return 1;
+}
+
+int main(int argc, const char* argv[])
+{
+  if (argc < 2)
+    return usage(argv[0]);
+
+  const char* path = strstr(argv[1], "://");
+  char peer[4096];
+  snprintf(peer, sizeof(peer), "mmap://%s", path ? path + 3 : argv[1]);
+
+  FCIOStream in = FCIOConnect(peer, 'r', 0, 0);
+  FCIOSummary summary;
+  if (!in || FCIOGetSummary(in, &summary)) {
+    fprintf(stderr, "Can not summarize %s\n", argv[1]);
+    if (in)
+      FCIODisconnect(in);
+    return 1;
+  }
+  FCIODisconnect(in);
+
+  const char* names[16] = {"other", "config", "calib", "event", "status", "recevent", "sparseevent", "eventheader",
+                           "fspconfig", "fspevent", "fspstatus", "trailer"};
+  fprintf(stdout, "%s: %d records, %lld bytes\n", argv[1], summary.records, summary.data_size);
+  for (int tag = 0; tag < 16; tag++)
+    if (summary.tags[tag])
+      fprintf(stdout, "  %-12s %d\n", names[tag] ? names[tag] : "reserved", summary.tags[tag]);
+  if (summary.first_event >= 0 || summary.last_event >= 0)
+    fprintf(stdout, "  events %d (pps %d ticks %d) .. %d (pps %d ticks %d)\n",
+      summary.first_event, summary.first_pps, summary.first_ticks,
+      summary.last_event, summary.last_pps, summary.last_ticks);
+  return 0;
+}
@@ -55,13 +55,36 @@ extern "C" {
 
 //----------------------------------------------------------------*/
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#if defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define FCIO_HAVE_URING
+#endif
 #include "time_utils.h"
 #include "tmio.h"
 
-static int debug=2;
+static int debug=2;  // default for new streams and functions without a stream
+
+static inline int fcio_debug(void)
+{
+  return __atomic_load_n(&debug, __ATOMIC_RELAXED);
+}
 
 /*=== Function ===================================================*/
 
@@ -81,14 +104,14 @@ Returns the old debug level.
 If higher debugging is used you get a lot of output. Beware
 of turning it on during normal operation.
 
-The debug level is used for all further function calls
-and may be set before initialization of a context structure.
+The debug level is used by functions without a stream and as
+the initial level of streams connected afterwards, which keep
+their own level (see FCIOSetStreamDebug), so that streams used
+by different threads do not share state.
 
 //----------------------------------------------------------------*/
 {
-  int old=debug;
-  debug=level;
-  return old;
+  return __atomic_exchange_n(&debug, level, __ATOMIC_RELAXED);
 }
 
 
@@ -151,6 +174,7 @@ readers of the FCIO files/streams
                                                            // Reduces the channel limit to 12 * 8 * 6 adc channels + 12 * 6 trigger channels
                                                            // This means, the maximum needed buffer size is either 2400 * 8192 = 19660800 samples or 672 * 32768 = 22020096.
 #define FCIOMaxDWords FCIOTraceBufferLength     // For backwards compatibility
+#define FCIOTraceAlignment 64                   // alignment in bytes of the trace storage and of each trace with FCIOAllocAligned
 
 typedef struct {                 // Readout configuration (typically once at start of run)
 
@@ -216,11 +240,15 @@ typedef struct {                  // Raw event
   unsigned short trace_list[FCIOMaxChannels];  // list of updated trace indices while writing/reading in sparse mode (FCIOSparseEvent)
                                                // this index list contains the valid trace[] fields which are allowed to access.
                                                // adc channels / traces which are not listed here contain the traces from the previous FCIOSparseEvent while reading!
+                                               // Use FCIOTraceValid / FCIONextValidTrace to check or iterate traces holding samples of the current record.
 
   unsigned short *trace[FCIOMaxChannels];        // Accessors for trace samples
   unsigned short *theader[FCIOMaxChannels];      // Accessors for traces incl. header bytes
                                                  // (FPGA baseline, FPGA integrator)
-  unsigned short traces[FCIOTraceBufferLength];  // internal trace storage
+  unsigned short *traces;                        // internal trace storage, allocated by FCIOAllocBuffers
+
+  unsigned int generation;                       // incremented with every event record read into this structure
+  unsigned int trace_generation[FCIOMaxChannels]; // generation of the record which last filled trace[i] with samples
 
 } fcio_event;
 
@@ -267,9 +295,9 @@ typedef struct {                  // Reconstructed event
 
   int totalpulses;
   int channel_pulses[FCIOMaxChannels];
-  int flags[FCIOMaxPulses];
-  float times[FCIOMaxPulses];
-  float amplitudes[FCIOMaxPulses];
+  int *flags;                     // pulse storage of totalpulses entries each, allocated by FCIOAllocBuffers
+  float *times;
+  float *amplitudes;
 
 } fcio_recevent;
 
@@ -309,6 +337,18 @@ typedef struct {        // Readout status (~1 Hz, programmable)
 
   } data[256];
 
+  struct {              // Status data of data[0..cards-1] in structure-of-arrays layout,
+                        // filled while reading for fast aggregation across cards.
+                        // linkstates are only available in data[].
+
+    unsigned int reqid[256], status[256], eventno[256], pps[256], ticks[256], maxticks[256], numenv[256],
+                  numctilinks[256], numlinks[256];
+    unsigned int totalerrors[256], enverrors[256], ctierrors[256], linkerrors[256], othererrors[5][256];
+    int          environment[16][256];
+    unsigned int ctilinks[4][256];
+
+  } fields;
+
 } fcio_status;
 
 typedef struct {                   // FlashCam envelope structure
@@ -321,8 +361,26 @@ typedef struct {                   // FlashCam envelope structure
   fcio_status status;
   fcio_recevent recevent;
 
+  int alloc_flags;                 // FCIOAllocFlags used for event.traces and recevent pulse storage
+  unsigned short *view_traces;     // internal trace payload storage of FCIOGetRecordView
+  int decode_flags;                // FCIODecodeFlags used for FCIOEvent and FCIOSparseEvent records
+  int channel_masked;              // only traces set in channel_mask are read, see FCIOSetChannelMask
+  unsigned int channel_mask[(FCIOMaxChannels + 31) / 32];
+
 } FCIOData;
 
+typedef struct {                   // Trace payload of the last record read by FCIOGetRecordView
+
+  int tag;                         // tag of the record
+  int num_traces;                  // number of traces in the payload, 0 for records without traces
+  int trace_length;                // words per trace: 2 header words (see theader) followed by eventsamples samples
+  const unsigned short *trace_list; // trace_list[i] is the trace index of the i-th trace in the payload
+  int trace_stride;                // words between the starts of consecutive traces in traces, >= trace_length
+  const unsigned short *traces;    // payload, trace i starts at traces[i * trace_stride],
+                                   // valid until the next read from the FCIOData
+
+} FCIORecordView;
+
 /*
   List of records tags to identify known records.
   FCIOGetRecord and FCIOGet(Next)State read known tags
@@ -334,6 +392,12 @@ typedef struct {                   // FlashCam envelope structure
   FCIOOpen / FCIOCreateStateReader.
   libfsp provides the corresponding corresponding read functions.
 
+  FCIOTrailer and FCIOSync records only carry the bookkeeping of the
+  library and are skipped by FCIOReadMessage, so no reader returns
+  them. FCIOTrailer is the last record of files written with
+  FCIOSetTrailer, see FCIOGetSummary. FCIOSync records are written
+  with FCIOSetSyncInterval, see FCIOSetRecovery.
+
 */
 
 typedef enum {
@@ -346,987 +410,4610 @@ typedef enum {
   FCIOEventHeader = 7,
   FCIOFSPConfig = 8, // reserved for libfsp
   FCIOFSPEvent = 9, // reserved for libfsp
-  FCIOFSPStatus = 10 // reserved for libfsp
+  FCIOFSPStatus = 10, // reserved for libfsp
+  FCIOTrailer = 11,
+  FCIOSync = 12
 } FCIOTag;
 
+/*
+  Allocation flags for the trace and pulse storage of FCIOData,
+  see FCIOAllocBuffers.
+
+  FCIOAllocStatic sizes event.traces and the recevent pulse arrays
+  for the compile-time maxima (FCIOTraceBufferLength, FCIOMaxPulses).
+  FCIOAllocDynamic sizes event.traces from the current FCIOConfig
+  and grows the pulse arrays with recevent.totalpulses.
+  FCIOAllocAligned places each trace[i] at a FCIOTraceAlignment boundary,
+  directly preceded by its two theader[i] words, with the stride between
+  traces padded to a multiple of FCIOTraceAlignment bytes. Records are
+  still sent and read in the packed layout. The padding content is undefined.
+  Always use trace[] and theader[] to access traces in this layout.
+  FCIOAllocHugePages backs storage of at least one huge page (2 MB) with
+  explicit huge pages if the system provides them, otherwise with
+  transparent huge pages, and falls back to regular pages if neither is
+  available. Smaller storage always uses regular pages.
+
+*/
+
+typedef enum {
+  FCIOAllocStatic = 0,
+  FCIOAllocDynamic = 1,
+  FCIOAllocAligned = 2,
+  FCIOAllocHugePages = 4
+} FCIOAllocFlags;
+
+/*
+  Flags for FCIOReservePool.
+
+  FCIOPoolPrefault touches all pages of the reserved buffers.
+  FCIOPoolLock additionally locks them into memory with mlock.
+  FCIOPoolHugePages reserves buffers for storage with FCIOAllocHugePages.
+
+*/
+
+typedef enum {
+  FCIOPoolPrefault = 1,
+  FCIOPoolLock = 2,
+  FCIOPoolHugePages = 4
+} FCIOPoolFlags;
+
+/*
+  Targets of FCIOSeek and FCIOSeekState.
+
+  FCIOSeekRecord positions at the n-th record of the stream (from 0).
+  FCIOSeekEvent positions at the first event record with event number
+  (timestamp[0]) >= n.
+  FCIOSeekTime positions at the first event record with a PPS/ticks
+  timestamp not before the given time.
+
+*/
+
+typedef enum {
+  FCIOSeekRecord = 0,
+  FCIOSeekEvent = 1,
+  FCIOSeekTime = 2
+} FCIOSeekMode;
+
+/*
+  Decode flags of FCIOSetDecodeFlags and FCIOSetStateDecodeFlags.
+
+  FCIODecodeFull reads all data of a record.
+  FCIODecodeHeaders reads FCIOEvent and FCIOSparseEvent records like
+  FCIOEventHeader records: only the event metadata and the two header
+  words theader[i][0..1] of each trace are filled, the samples are
+  skipped and the traces are not reported by FCIOTraceValid.
+
+*/
+
+typedef enum {
+  FCIODecodeFull = 0,
+  FCIODecodeHeaders = 1
+} FCIODecodeFlags;
+
+/*
+  Policies of FCIOSetAsyncWriter when the queue is full.
+
+  FCIOAsyncBlock waits for the writer thread.
+  FCIOAsyncDrop drops the record and counts it in FCIOAsyncStats.
+
+*/
+
+typedef enum {
+  FCIOAsyncBlock = 0,
+  FCIOAsyncDrop = 1
+} FCIOAsyncPolicy;
+
 //----------------------------------------------------------------*/
 
 /*--- Structures  -----------------------------------------------*/
 
-typedef void* FCIOStream;
+typedef struct fcio_stream *FCIOStream;  // opaque, see fcio_stream
 
 /*--- Description ------------------------------------------------//
 
-An identifier for the FCIO connection.
+An opaque identifier for the FCIO connection.
 This item is returned by any connection to a file or tcp/ip
 stream and must be used in all further FCIO calls.
+Since 2.0.0 it refers to an fcio_stream, not to a tmio_stream;
+FCIOTmioHandle returns the tmio stream of tmio connections.
 
 //----------------------------------------------------------------*/
 
+/*
+  A single data item of a record as passed to FCIOWriteFrames.
+*/
+
+typedef struct {
+  const void *data;  // payload of the frame, only referenced while writing
+  int size;          // size of the payload in bytes
+} FCIOFrame;
+
+/*
+  One record in a sidecar index (.fcidx), see FCIOSetIndexFile.
+*/
+
+typedef struct {
+  long long offset;       // byte offset of the record tag in the stream
+  int tag;                // record tag
+  int config_generation;  // number of FCIOConfig records up to and including this record
+  int eventnumber;        // timestamp[0] of event records, -1 otherwise
+  int pps;                // timestamp[1] of event records, pps of the first card of FCIOStatus, -1 otherwise
+  int ticks;              // timestamp[2] of event records, ticks of the first card of FCIOStatus, -1 otherwise
+  int reserved;
+} FCIOIndexEntry;
+
+/*
+  Summary of a file as stored in its FCIOTrailer, see FCIOGetSummary.
+*/
+
+typedef struct {
+  long long data_size;  // byte offset of the trailer, the size of all records before it
+  int records;          // number of records before the trailer
+  int tags[16];         // number of records per tag, records with tags >= 16 are counted in tags[0]
+  int first_event;      // event number of the first event record, -1 if none
+  int last_event;       // event number of the last event record, -1 if none
+  int first_pps;        // PPS/ticks of the first and last event record, -1 if none
+  int first_ticks;
+  int last_pps;
+  int last_ticks;
+  int reserved;
+} FCIOSummary;
+
+/*
+  Payload of an FCIOSync record, see FCIOSetSyncInterval.
+*/
+
+typedef struct {
+  char magic[8];            // "FCIOSYNC"
+  long long offset;         // byte offset of the FCIOSync tag in the stream
+  long long config_offset;  // byte offset of the latest FCIOConfig, -1 if none
+  long long status_offset;  // byte offset of the latest FCIOStatus after it, -1 if none
+  int records;              // number of records before the marker, FCIOSync records are not counted
+  int config_generation;    // number of FCIOConfig records before the marker
+  int eventnumber;          // event number and PPS/ticks of the latest event record, -1 if none
+  int pps;
+  int ticks;
+  int reserved;
+} FCIOSyncMarker;
+
+/*
+  Counters of the writer thread of a stream, see FCIOGetAsyncStats.
+*/
+
+typedef struct {
+  int depth;            // records the queue holds
+  int queued;           // records waiting in the queue
+  int max_queued;       // maximum of queued seen after a record was queued
+  int error;            // a write of the thread failed, later records are discarded
+  long long written;    // records written by the thread
+  long long discarded;  // records not written as a write failed, see error
+  long long dropped;    // records dropped with FCIOAsyncDrop or as a queue slot could not grow
+  long long stalls;     // records the caller waited for a free slot with FCIOAsyncBlock
+  double stall_time;    // seconds the caller waited
+} FCIOAsyncStats;
+
 // forward decls
 FCIOStream FCIOConnect(const char *name, int direction, int timeout, int buffer);
 int FCIODisconnect(FCIOStream x);
 int FCIOWriteMessage(FCIOStream x, int tag);
 int FCIOWrite(FCIOStream x, int size, void *data);
+int FCIOWriteFrames(FCIOStream x, int nframes, const FCIOFrame *frames);
 int FCIOFlush(FCIOStream x);
 int FCIOReadMessage(FCIOStream x);
 int FCIORead(FCIOStream x, int size, void *data);
+static int fcio_read_views(FCIOStream stream, int nframes, int frame_size, const void **payload);
+static void fcio_index_hint(FCIOStream x, int eventnumber, int pps, int ticks);
+static int fcio_recover(FCIOStream x);
+static inline int fcio_stream_debug(const void *x);
+static void *fcio_stream_scratch(FCIOStream x, size_t size);
+int FCIOLoadIndex(FCIOStream x, const char *name);
+
+static inline void fcio_index_hint_timestamp(FCIOStream x, const int *timestamp, int size)
+{
+  fcio_index_hint(x, size > 0 ? timestamp[0] : -1, size > 2 ? timestamp[1] : -1, size > 2 ? timestamp[2] : -1);
+}
 
-/*=== Function ===================================================*/
-
-FCIOData *FCIOOpen(const char *name, int timeout, int buffer)
+/*--- Buffers ----------------------------------------------------//
+
+Trace and pulse storage is allocated with a small header in front
+of the returned pointer, which keeps the usable size in bytes and
+the FCIOAllocFlags it was allocated with.
+This allows re-sizing the storage on a config change and deriving
+the trace layout without additional bookkeeping in the public
+structures. All buffers start at a FCIOTraceAlignment boundary.
+
+Released buffers are kept in a library wide pool if it has been
+enabled with FCIOSetPoolLimit or FCIOReservePool and are handed out
+again to later allocations of at least half their capacity. Their
+pages stay faulted in (and locked, if requested), the content of a
+reused buffer is undefined.
+
+Buffers of at least FCIOHugePageSize bytes with FCIOAllocHugePages
+are rounded up to full huge pages and mapped with MAP_HUGETLB if the
+header fits into the rounding, or otherwise (and if no huge pages are
+reserved) start at a FCIOHugePageSize boundary behind a regular page
+for the header and are advised with MADV_HUGEPAGE. So a buffer of
+exactly one huge page does not take two. Smaller buffers, and buffers
+which can not be mapped, are allocated with calloc.
 
-/*--- Description ------------------------------------------------//
+//----------------------------------------------------------------*/
 
-Connects to a file, server or client for FCIO read data transfer.
+#define FCIOHugePageSize ((size_t)2 << 20)
 
-name is the connection endpoint of the underlying TMIO/BUFIO
-library. Please refer to the documentation of TMIO/BUFIO for
-more information.
+typedef struct {
+  void *mem;        // start of the allocated memory
+  void *next;       // next buffer in the pool
+  size_t size;      // usable size in bytes
+  size_t capacity;  // allocated size in bytes, size <= capacity
+  size_t mapped;    // length of the mapping starting at mem, 0 if allocated with calloc
+  int flags;        // FCIOAllocFlags
+  int locked;       // memory is locked with mlock
+} fcio_buffer_header;
+
+static struct {
+  pthread_mutex_t lock;  // guards all other members
+  size_t limit;          // maximum number of bytes kept in the pool, 0 disables pooling
+  size_t bytes;          // number of bytes currently kept in the pool
+  void *buffers;         // pooled buffers chained by header->next
+} fcio_pool = { PTHREAD_MUTEX_INITIALIZER, 0, 0, NULL };
+
+static inline fcio_buffer_header *fcio_buffer_get_header(const void *buffer)
+{
+  return (fcio_buffer_header *)((char *)buffer - sizeof(fcio_buffer_header));
+}
 
-name can be:
+static inline void fcio_pool_lock(void)
+{
+  pthread_mutex_lock(&fcio_pool.lock);
+}
 
-tcp://listen/port           to listen to port at all interfaces
-tcp://listen/port/nodename  to listen to port at nodename interface
-tcp://connect/port/nodename to connect to port and nodename
+static inline void fcio_pool_unlock(void)
+{
+  pthread_mutex_unlock(&fcio_pool.lock);
+}
 
-Any other name not starting with tcp: is treated as a file name.
+// maps a buffer of size bytes backed by huge pages with room for the header in front,
+// returns the buffer and the mapping in *mem and *mapped, or NULL
+static char *fcio_huge_map(size_t size, char **mem, size_t *mapped)
+{
+  const size_t length = (size + FCIOHugePageSize - 1) / FCIOHugePageSize * FCIOHugePageSize;
+  const size_t head = (sizeof(fcio_buffer_header) + FCIOTraceAlignment - 1) / FCIOTraceAlignment * FCIOTraceAlignment;
+#if defined(MAP_HUGETLB)
+  // the header has to fit into the rounding, an extra explicit huge page would be wasted on it
+  char *huge = length - size >= head ? (char *)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0) : MAP_FAILED;
+  if (huge != MAP_FAILED) {
+    if (fcio_debug() > 3)
+      fprintf(stderr, "FCIO/fcio_huge_map/DEBUG: mapped %zu KB of explicit huge pages\n", length / 1024);
+    *mem = huge;
+    *mapped = length;
+    return huge + head;
+  }
+#endif
+#if defined(MADV_HUGEPAGE)
+  // over-allocate to start the buffer at a huge page boundary behind one regular page for the
+  // header and unmap the excess
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  char *range = (char *)mmap(NULL, page + length + FCIOHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (range != MAP_FAILED) {
+    char *buffer = range + page + (FCIOHugePageSize - (size_t)(range + page) % FCIOHugePageSize) % FCIOHugePageSize;
+    size_t excess = FCIOHugePageSize - (size_t)(buffer - page - range);
+    if (buffer - page > range)
+      munmap(range, buffer - page - range);
+    if (excess)
+      munmap(buffer + length, excess);
+    if (madvise(buffer, length, MADV_HUGEPAGE)) {
+      if (fcio_debug() > 1)
+        fprintf(stderr, "FCIO/fcio_huge_map/WARNING: transparent huge pages are not available\n");
+    } else if (fcio_debug() > 3) {
+      fprintf(stderr, "FCIO/fcio_huge_map/DEBUG: mapped %zu KB of transparent huge pages\n", length / 1024);
+    }
+    *mem = buffer - page;
+    *mapped = page + length;
+    return buffer;
+  }
+#endif
+  return NULL;
+}
 
-timeout specifies the time to wait for a connection in milliseconds.
-Specify 0 to return immediately (within the typical delays imposed by the
-connection and OS) or -1 to block indefinitely.
+static void *fcio_buffer_new(size_t size, int flags)
+{
+  size_t mapped = 0;
+  char *mem = NULL, *buffer = NULL;
+  if ((flags & FCIOAllocHugePages) && size >= FCIOHugePageSize)
+    buffer = fcio_huge_map(size, &mem, &mapped);
+  if (!buffer) {
+    mem = (char *)calloc(1, sizeof(fcio_buffer_header) + FCIOTraceAlignment + size);
+    if (!mem)
+      return NULL;
+    size_t offset = sizeof(fcio_buffer_header) + FCIOTraceAlignment - 1;
+    buffer = mem + offset - (size_t)(mem + offset) % FCIOTraceAlignment;
+  }
 
-buffer may be used to initialize the size (in kB) of the protocol buffers. If 0
-is specified a default value will be used.
+  fcio_buffer_header *header = fcio_buffer_get_header(buffer);
+  header->mem = mem;
+  header->next = NULL;
+  header->size = size;
+  header->capacity = size;
+  header->mapped = mapped;
+  header->flags = flags;
+  header->locked = 0;
+  return buffer;
+}
 
-Returns a FCIOData structure or 0 on error.
+static void fcio_buffer_delete(void *buffer)
+{
+  fcio_buffer_header *header = fcio_buffer_get_header(buffer);
+  size_t length = header->mapped ? header->mapped : sizeof(fcio_buffer_header) + FCIOTraceAlignment + header->capacity;
+  if (header->locked)
+    munlock(header->mem, length);
+  if (header->mapped)
+    munmap(header->mem, header->mapped);
+  else
+    free(header->mem);
+}
 
-//----------------------------------------------------------------*/
+// removes and returns the smallest pooled buffer with a capacity in [size, 2 * size]
+// and the same page backing as requested by flags
+static void *fcio_pool_take(size_t size, int flags)
 {
-  FCIOData *x=(FCIOData*)calloc(1,sizeof(FCIOData));
-  if(!x)
-  {
-    if(debug) fprintf(stderr,"FCIOOpen/ERROR: can not init structure\n");
-    return 0;
+  fcio_pool_lock();
+  void **best = NULL;
+  for (void **link = &fcio_pool.buffers; *link; link = &fcio_buffer_get_header(*link)->next) {
+    size_t capacity = fcio_buffer_get_header(*link)->capacity;
+    int backing = fcio_buffer_get_header(*link)->flags ^ flags;
+    if (capacity >= size && capacity - size <= size && !(backing & FCIOAllocHugePages)
+      && (!best || capacity < fcio_buffer_get_header(*best)->capacity))
+      best = link;
   }
-  x->ptmio=(void*)FCIOConnect(name,'r',timeout,buffer);
-  if(x->ptmio==0)
-  {
-    if(debug) fprintf(stderr,"FCIOOpen/ERROR: can not connect to data source %s \n",(name)?name:"(NULL)");
-    free(x);
-    return 0;
+  void *buffer = NULL;
+  if (best) {
+    buffer = *best;
+    *best = fcio_buffer_get_header(buffer)->next;
+    fcio_pool.bytes -= fcio_buffer_get_header(buffer)->capacity;
   }
-  if(debug>2) fprintf(stderr,"FCIOOpen: io structure initialized, size %ld KB\n",(long)sizeof(FCIOData)/1024);
-  return x;
+  fcio_pool_unlock();
+  return buffer;
+}
+
+// adds the buffer to the pool, the pool lock must be held
+static void fcio_pool_link(void *buffer)
+{
+  fcio_buffer_header *header = fcio_buffer_get_header(buffer);
+  header->next = fcio_pool.buffers;
+  fcio_pool.buffers = buffer;
+  fcio_pool.bytes += header->capacity;
 }
 
+// returns 1 if the buffer has been added to the pool, 0 if the pool is disabled or full
+static int fcio_pool_put(void *buffer)
+{
+  int pooled = 0;
+  fcio_pool_lock();
+  if (fcio_pool.bytes + fcio_buffer_get_header(buffer)->capacity <= fcio_pool.limit) {
+    fcio_pool_link(buffer);
+    pooled = 1;
+  }
+  fcio_pool_unlock();
+  return pooled;
+}
 
+// frees pooled buffers until at most max_bytes are kept, the buffers are
+// unlinked under the lock and released after it, as munmap and munlock may block
+static void fcio_pool_trim(size_t max_bytes)
+{
+  void *released = NULL;
+  fcio_pool_lock();
+  while (fcio_pool.buffers && fcio_pool.bytes > max_bytes) {
+    void *buffer = fcio_pool.buffers;
+    fcio_pool.buffers = fcio_buffer_get_header(buffer)->next;
+    fcio_pool.bytes -= fcio_buffer_get_header(buffer)->capacity;
+    fcio_buffer_get_header(buffer)->next = released;
+    released = buffer;
+  }
+  fcio_pool_unlock();
 
-/*=== Function ===================================================*/
+  while (released) {
+    void *buffer = released;
+    released = fcio_buffer_get_header(buffer)->next;
+    fcio_buffer_delete(buffer);
+  }
+}
 
-int FCIOClose(FCIOData *x)
+static void *fcio_buffer_alloc(size_t size, int flags)
+{
+  void *buffer = fcio_pool_take(size, flags);
+  if (!buffer)
+    buffer = fcio_buffer_new(size, flags);
+  if (!buffer)
+    return NULL;
 
-/*--- Description ------------------------------------------------//
+  fcio_buffer_header *header = fcio_buffer_get_header(buffer);
+  header->next = NULL;
+  header->size = size;
+  header->flags = flags;
+  return buffer;
+}
 
-Disconnects to any FCIOData source and closes any communication to
-the endpoint and frees all associated data. x becomes invalid
-after the function call.
+// as fcio_buffer_alloc, but a buffer reused from the pool is cleared
+static void *fcio_buffer_calloc(size_t size)
+{
+  void *buffer = fcio_pool_take(size, 0);
+  if (buffer)
+    memset(buffer, 0, size);
+  else
+    buffer = fcio_buffer_new(size, 0);
+  if (!buffer)
+    return NULL;
 
-Returns 0 on success or <0 on error.
+  fcio_buffer_header *header = fcio_buffer_get_header(buffer);
+  header->next = NULL;
+  header->size = size;
+  header->flags = 0;
+  return buffer;
+}
 
-//----------------------------------------------------------------*/
+static void fcio_buffer_free(void *buffer)
 {
-  if (!x) return -1;
-  FCIOStream xio=x->ptmio;
-  FCIODisconnect(xio);
-  free(x);
-  if(debug > 3) fprintf(stderr,"FCIOClose/DEBUG: closed\n");
-  return 0;
+  if (buffer && !fcio_pool_put(buffer))
+    fcio_buffer_delete(buffer);
 }
 
+static inline size_t fcio_buffer_size(const void *buffer)
+{
+  return buffer ? fcio_buffer_get_header(buffer)->size : 0;
+}
 
-/*=== Function ===================================================*/
+static inline int fcio_buffer_flags(const void *buffer)
+{
+  return buffer ? fcio_buffer_get_header(buffer)->flags : 0;
+}
 
-FCIOStream FCIOStreamHandle(FCIOData *x)
+// returns a buffer of exactly size bytes, the content is only kept if size and flags did not change
+static void *fcio_buffer_resize(void *buffer, size_t size, int flags)
+{
+  if (buffer && fcio_buffer_size(buffer) == size && fcio_buffer_flags(buffer) == flags)
+    return buffer;
 
-/*--- Description ------------------------------------------------//
+  fcio_buffer_free(buffer);
+  return fcio_buffer_alloc(size, flags);
+}
 
-Returns the internal FCIOStream object on success or NULL on error.
+/*
+  Trace layout within event.traces: the header of trace i starts at
+  fcio_trace_offset + i * fcio_trace_stride samples, followed by its
+  samples. Without FCIOAllocAligned this is the packed layout used on
+  the wire, with FCIOAllocAligned the samples of each trace start at a
+  FCIOTraceAlignment boundary and the stride is padded accordingly.
+*/
 
-//----------------------------------------------------------------*/
+#define FCIOTraceAlignmentSamples ((int)(FCIOTraceAlignment / sizeof(unsigned short)))
+
+static inline int fcio_trace_offset(int alloc_flags)
 {
-  if(!x) return NULL;
-  FCIOStream xio=x->ptmio;
-  if(debug > 3) fprintf(stderr,"FCIOStream/DEBUG: return stream pointer.\n");
-  return xio;
+  return (alloc_flags & FCIOAllocAligned) ? FCIOTraceAlignmentSamples - 2 : 0;
 }
 
+static inline int fcio_trace_stride(const fcio_config *config, int alloc_flags)
+{
+  const int length = config->eventsamples + 2;
+  if (!(alloc_flags & FCIOAllocAligned))
+    return length;
 
-static inline int fcio_put_config(FCIOStream output, fcio_config* config)
+  return (length + FCIOTraceAlignmentSamples - 1) / FCIOTraceAlignmentSamples * FCIOTraceAlignmentSamples;
+}
+
+// returns the number of traces fitting into the trace storage with the layout of config
+static inline int fcio_trace_capacity(const fcio_event *event, const fcio_config *config)
 {
-  if (!output || !config)
-    return -1;
+  const int flags = fcio_buffer_flags(event->traces);
+  const size_t samples = fcio_buffer_size(event->traces) / sizeof(unsigned short);
+  const size_t offset = fcio_trace_offset(flags);
+  if (samples <= offset)
+    return 0;
 
-  FCIOWriteMessage(output,FCIOConfig);
-  FCIOWriteInt(output,config->adcs);
-  FCIOWriteInt(output,config->triggers);
-  FCIOWriteInt(output,config->eventsamples);
-  FCIOWriteInt(output,config->blprecision);
-  FCIOWriteInt(output,config->sumlength);
-  FCIOWriteInt(output,config->adcbits);
-  FCIOWriteInt(output,config->mastercards);
-  FCIOWriteInt(output,config->triggercards);
-  FCIOWriteInt(output,config->adccards);
-  FCIOWriteInt(output,config->gps);
-  FCIOWriteInts(output,(config->adcs+config->triggers),config->tracemap);
-  FCIOWriteInt(output,config->streamid);
+  size_t capacity = (samples - offset) / fcio_trace_stride(config, flags);
+  return capacity > FCIOMaxChannels ? FCIOMaxChannels : (int)capacity;
+}
 
-  return FCIOFlush(output);
+static inline unsigned short *fcio_trace_header(const fcio_event *event, const fcio_config *config, int trace_idx)
+{
+  const int flags = fcio_buffer_flags(event->traces);
+  return &event->traces[fcio_trace_offset(flags) + (size_t)trace_idx * fcio_trace_stride(config, flags)];
 }
 
-/*=== Function ===================================================*/
+// moves ntraces traces in place from the packed wire layout to a padded stride
+static inline void fcio_unpack_traces(unsigned short *traces, int ntraces, int length, int stride)
+{
+  for (int i = ntraces - 1; i > 0; i--)
+    memmove(&traces[(size_t)i * stride], &traces[(size_t)i * length], length * sizeof(unsigned short));
+}
 
-int FCIOPutConfig(FCIOStream output, FCIOData *input)
 
-/*--- Description ------------------------------------------------//
+static inline size_t fcio_traces_size(const fcio_config *config, int alloc_flags)
+{
+  if (config && (alloc_flags & FCIOAllocDynamic))
+    return (fcio_trace_offset(alloc_flags) + (size_t)(config->adcs + config->triggers) * fcio_trace_stride(config, alloc_flags)) * sizeof(unsigned short);
 
-Writes a record of config data (struct fcio_config) to remote peer or file.
-A record consist of the message tag and all data members of the struct.
+  if (alloc_flags & FCIOAllocAligned)
+    return (FCIOTraceBufferLength + (size_t)FCIOMaxChannels * FCIOTraceAlignmentSamples) * sizeof(unsigned short);
 
-Returns 0 on success or <0 on error.
+  return FCIOTraceBufferLength * sizeof(unsigned short);
+}
 
-//----------------------------------------------------------------*/
+static inline void fcio_set_trace_pointers(fcio_event *event, const fcio_config *config, int trace_idx)
 {
-  if (!output) {
-    fprintf(stderr, "FCIOPutConfig/ERROR: Output not connected.\n");
+  event->theader[trace_idx] = fcio_trace_header(event, config, trace_idx);
+  event->trace[trace_idx] = event->theader[trace_idx] + 2;
+}
+
+static inline int fcio_alloc_traces(fcio_event *event, const fcio_config *config, int alloc_flags)
+{
+  const size_t size = fcio_traces_size(config, alloc_flags);
+  event->traces = (unsigned short *)fcio_buffer_resize(event->traces, size, alloc_flags);
+  if (!event->traces) {
+    if (fcio_debug())
+      fprintf(stderr, "FCIO/fcio_alloc_traces/ERROR: can not allocate %zu bytes of trace storage\n", size);
     return -1;
   }
-  if (!input) {
-    fprintf(stderr, "FCIOPutConfig/ERROR: Input not valid (null pointer).\n");
+
+  if (!config)
+    return 0;
+
+  const int ntraces = config->adcs + config->triggers;
+  if (ntraces > fcio_trace_capacity(event, config)) {
+    if (fcio_debug())
+      fprintf(stderr, "FCIO/fcio_alloc_traces/ERROR: %d traces with %d samples exceed the trace storage of %zu samples\n",
+        ntraces, config->eventsamples, fcio_buffer_size(event->traces) / sizeof(unsigned short));
     return -1;
   }
+  for (int i = 0; i < ntraces; i++)
+    fcio_set_trace_pointers(event, config, i);
+  for (int i = ntraces; i < FCIOMaxChannels; i++)
+    event->trace[i] = event->theader[i] = NULL;
 
-  return fcio_put_config(output, &input->config);
+  return 0;
 }
 
+// only (re)allocates and sets up the trace storage if the required size or layout changed
+static inline int fcio_reserve_traces(fcio_event *event, const fcio_config *config, int alloc_flags)
+{
+  if (event->traces && fcio_buffer_size(event->traces) == fcio_traces_size(config, alloc_flags)
+    && fcio_buffer_flags(event->traces) == alloc_flags)
+    return 0;
 
-static inline int fcio_put_status(FCIOStream output, fcio_status* status)
+  return fcio_alloc_traces(event, config, alloc_flags);
+}
+
+static inline int fcio_alloc_pulses(fcio_recevent *recevent, int npulses, int alloc_flags)
 {
-  if (!output || !status)
+  size_t size = FCIOMaxPulses;
+  if (alloc_flags & FCIOAllocDynamic)
+    size = npulses < 1 ? 1 : (npulses > FCIOMaxPulses ? FCIOMaxPulses : npulses);
+
+  recevent->flags = (int *)fcio_buffer_resize(recevent->flags, size * sizeof(int), alloc_flags);
+  recevent->times = (float *)fcio_buffer_resize(recevent->times, size * sizeof(float), alloc_flags);
+  recevent->amplitudes = (float *)fcio_buffer_resize(recevent->amplitudes, size * sizeof(float), alloc_flags);
+  if (!recevent->flags || !recevent->times || !recevent->amplitudes) {
+    if (fcio_debug())
+      fprintf(stderr, "FCIO/fcio_alloc_pulses/ERROR: can not allocate storage for %zu pulses\n", size);
     return -1;
+  }
+  return 0;
+}
 
-  FCIOWriteMessage(output, FCIOStatus);
-  FCIOWriteInt(output, status->status);
-  FCIOWriteInts(output, 10, status->statustime);
-  FCIOWriteInt(output, status->cards);
-  FCIOWriteInt(output, status->size);
-  for (int i = 0; i < status->cards; i++)
-    FCIOWrite(output, status->size, (void*)&status->data[i]);
+static inline void fcio_free_traces(fcio_event *event)
+{
+  fcio_buffer_free(event->traces);
+  event->traces = NULL;
+  for (int i = 0; i < FCIOMaxChannels; i++)
+    event->trace[i] = event->theader[i] = NULL;
+}
 
-  return FCIOFlush(output);
+static inline void fcio_free_pulses(fcio_recevent *recevent)
+{
+  fcio_buffer_free(recevent->flags);
+  fcio_buffer_free(recevent->times);
+  fcio_buffer_free(recevent->amplitudes);
+  recevent->flags = NULL;
+  recevent->times = NULL;
+  recevent->amplitudes = NULL;
 }
 
+
 /*=== Function ===================================================*/
 
-int FCIOPutStatus(FCIOStream output, FCIOData *input)
+int FCIOAllocBuffers(FCIOData *x)
 
 /*--- Description ------------------------------------------------//
 
-Writes a record of config data (struct fcio_status) to remote peer or file.
-A record consist of the message tag and all data members of the struct.
-
-The size of status.data from individual cards is sent depending on
-status.cards and status.size.
+(Re)allocates the trace storage event.traces and the pulse storage
+recevent.flags/times/amplitudes according to x->alloc_flags and
+sets up event.trace[] and event.theader[] for the current x->config.
+
+With FCIOAllocStatic (default) the storage is sized for the
+compile-time maxima and is only allocated once.
+With FCIOAllocDynamic the trace storage is sized to
+(config.adcs + config.triggers) * (config.eventsamples + 2) and the
+pulse storage to max(recevent.totalpulses, config.adcs); it grows
+on demand while reading FCIORecEvent records.
+With FCIOAllocAligned the traces are placed in the padded layout
+described at FCIOAllocFlags, with FCIOAllocHugePages the storage is
+backed by huge pages where available.
+
+FCIOGetRecord calls this function on every FCIOConfig record.
+Writers which compose their own FCIOData must call it after filling
+x->config, before accessing traces or pulses.
+The content of the storage is undefined after a change of size.
 
 Returns 0 on success or <0 on error.
 
 //----------------------------------------------------------------*/
 {
-  if (!output) {
-    fprintf(stderr, "FCIOPutStatus/ERROR: Output not connected.\n");
+  if (!x)
     return -1;
-  }
-  if (!input) {
-    fprintf(stderr, "FCIOPutStatus/ERROR: Input not valid (null pointer).\n");
+
+  int npulses = x->recevent.totalpulses > x->config.adcs ? x->recevent.totalpulses : x->config.adcs;
+  if (fcio_alloc_traces(&x->event, &x->config, x->alloc_flags) < 0
+    || fcio_alloc_pulses(&x->recevent, npulses, x->alloc_flags) < 0)
     return -1;
-  }
 
-  return fcio_put_status(output, &input->status);
+  if (fcio_debug() > 3)
+    fprintf(stderr, "FCIOAllocBuffers/DEBUG: trace storage %zu KB, pulse storage %zu KB\n",
+      fcio_buffer_size(x->event.traces) / 1024, 3 * fcio_buffer_size(x->recevent.flags) / 1024);
+  return 0;
 }
 
 
-static inline int fcio_put_event(FCIOStream output, fcio_config* config, fcio_event* event)
+/*=== Function ===================================================*/
+
+void FCIOFreeBuffers(FCIOData *x)
+
+/*--- Description ------------------------------------------------//
+
+Frees the trace and pulse storage allocated by FCIOAllocBuffers
+and the payload storage of FCIOGetRecordView.
+Must be called by writers which allocated the buffers of their own
+FCIOData before freeing it. FCIOClose calls this function.
+
+//----------------------------------------------------------------*/
 {
-  if (!output || !config || !event)
-    return -1;
+  if (!x)
+    return;
 
-  FCIOWriteMessage(output,FCIOEvent);
-  FCIOWriteInt(output,event->type);
-  FCIOWriteFloat(output,event->pulser);
-  FCIOWriteInts(output, event->timeoffset_size, event->timeoffset);
-  FCIOWriteInts(output, event->timestamp_size, event->timestamp);
-  FCIOWriteUShorts(output,(config->adcs+config->triggers)*(config->eventsamples+2),event->traces);
-  FCIOWriteInts(output, event->deadregion_size, event->deadregion);
-  return FCIOFlush(output);
+  fcio_free_traces(&x->event);
+  fcio_free_pulses(&x->recevent);
+  fcio_buffer_free(x->view_traces);
+  x->view_traces = NULL;
 }
 
+
 /*=== Function ===================================================*/
 
-int FCIOPutEvent(FCIOStream output, FCIOData *input)
+int FCIOSetAllocFlags(FCIOData *x, int alloc_flags)
 
 /*--- Description ------------------------------------------------//
 
-Writes a record of event data (struct fcio_event) to remote peer or file.
-A record consist of the message tag and all data members of the struct.
-
-The number of items in event.timeoffset, timestamp and deadregion sent
-to remote depends on their corresponding *_size items.
-
-The number of items in event.traces sent to remote depends on
-(config.adcs + config.triggers) * (config.eventsamples+2).
+Sets the FCIOAllocFlags used for the trace and pulse storage of x.
+The flags take effect on the next FCIOConfig record or call of
+FCIOAllocBuffers. Use FCIOAllocDynamic directly after FCIOOpen
+to size all storage from the configuration of the stream.
 
-Returns 0 on success or <0 on error.
+Returns the previously set flags or <0 on error.
 
 //----------------------------------------------------------------*/
 {
-  if (!output) {
-    fprintf(stderr, "FCIOPutEvent/ERROR: Output not connected.\n");
-    return -1;
-  }
-  if (!input) {
-    fprintf(stderr, "FCIOPutEvent/ERROR: Input not valid (null pointer).\n");
+  if (!x)
     return -1;
-  }
 
-  return fcio_put_event(output, &input->config, &input->event);
+  int old = x->alloc_flags;
+  x->alloc_flags = alloc_flags;
+  return old;
 }
 
 
+/*=== Function ===================================================*/
+
+int FCIOSetDecodeFlags(FCIOData *x, int decode_flags)
 
-static inline int fcio_put_sparseevent(FCIOStream output, fcio_config* config, fcio_event* event)
+/*--- Description ------------------------------------------------//
+
+Sets the FCIODecodeFlags for the records read with FCIOGetRecord.
+With FCIODecodeHeaders the samples of FCIOEvent and FCIOSparseEvent
+records are skipped, on streams connected with mmap:// without
+touching them, and the tags of the records are returned unchanged.
+
+Returns the previously set flags or <0 on error.
+
+//----------------------------------------------------------------*/
 {
-  if (!output || !config || !event)
+  if (!x)
     return -1;
 
-  FCIOWriteMessage(output,FCIOSparseEvent);
-  FCIOWriteInt(output,event->type);
-  FCIOWriteFloat(output,event->pulser);
-  FCIOWriteInts(output, event->timeoffset_size, event->timeoffset);
-  FCIOWriteInts(output, event->timestamp_size, event->timestamp);
-  FCIOWriteInts(output, event->deadregion_size, event->deadregion);
-  FCIOWriteInts(output,1,&event->num_traces);
-  FCIOWriteUShorts(output,event->num_traces,event->trace_list);
+  int old = x->decode_flags;
+  x->decode_flags = decode_flags;
+  return old;
+}
 
-  int length = config->eventsamples+2;
-  for (int i = 0; i < event->num_traces; i++)
-  {
-    int j = event->trace_list[i];
-    FCIOWriteUShorts(output,length,&event->traces[j * length]);
+static int fcio_set_channel_mask(unsigned int *mask, int *masked, int nchannels, const int *channels)
+{
+  if (nchannels < 0 || !channels) {
+    *masked = 0;
+    return FCIOMaxChannels;
+  }
+  memset(mask, 0, (FCIOMaxChannels + 31) / 32 * sizeof(unsigned int));
+  int nselected = 0;
+  for (int i = 0; i < nchannels; i++) {
+    if (channels[i] < 0 || channels[i] >= FCIOMaxChannels) {
+      if (fcio_debug()) fprintf(stderr, "FCIO/fcio_set_channel_mask/ERROR: channel %d out of range\n", channels[i]);
+      continue;
+    }
+    if (!(mask[channels[i] / 32] & (1u << channels[i] % 32)))
+      nselected++;
+    mask[channels[i] / 32] |= 1u << channels[i] % 32;
   }
+  *masked = 1;
+  return nselected;
+}
 
-  return FCIOFlush(output);
+static inline int fcio_channel_selected(const unsigned int *mask, int trace_idx)
+{
+  return !mask || (mask[trace_idx / 32] & (1u << trace_idx % 32));
 }
 
+
 /*=== Function ===================================================*/
 
-int FCIOPutSparseEvent(FCIOStream output, FCIOData *input)
+int FCIOSetChannelMask(FCIOData *x, int nchannels, const int *channels)
 
 /*--- Description ------------------------------------------------//
 
-Writes a sparse record of event data (struct fcio_event) to remote peer or file.
-A record consist of the message tag and all data members of the struct.
-
-The number of items in event.timeoffset, timestamp and deadregion sent
-to remote depends on their corresponding *_size items.
-
-The number of theaders sent depends on the trace_list array (with size num_traces).
-Only those traces, whose indices are stored in trace_list will be serialized.
+Selects the traces whose samples are read from FCIOEvent and
+FCIOSparseEvent records with FCIOGetRecord. channels lists
+nchannels trace indices, nchannels < 0 selects all traces again.
+The samples of other traces are skipped and these traces are not
+reported by FCIOTraceValid, the event metadata, num_traces and
+trace_list are not affected.
+Mapped streams (mmap://) copy only the selected traces, tmio
+streams read the trace frame up to the last selected trace.
 
-Returns 0 on success or <0 on error.
+Returns the number of selected traces or <0 on error.
 
 //----------------------------------------------------------------*/
 {
-  if (!output) {
-    fprintf(stderr, "FCIOPutSparseEvent/ERROR: Output not connected.\n");
-    return -1;
-  }
-  if (!input) {
-    fprintf(stderr, "FCIOPutSparseEvent/ERROR: Input not valid (null pointer).\n");
+  if (!x)
     return -1;
-  }
 
-  return fcio_put_sparseevent(output, &input->config, &input->event);
+  return fcio_set_channel_mask(x->channel_mask, &x->channel_masked, nchannels, channels);
 }
 
 
-static inline int fcio_put_eventheader(FCIOStream output, fcio_config* config, fcio_event* event)
-{
-  if (!output || !config || !event)
-    return -1;
+/*=== Function ===================================================*/
 
-  FCIOWriteMessage(output,FCIOEventHeader);
-  FCIOWriteInt(output,event->type);
-  FCIOWriteFloat(output,event->pulser);
-  FCIOWriteInts(output, event->timeoffset_size, event->timeoffset);
-  FCIOWriteInts(output, event->timestamp_size, event->timestamp);
-  FCIOWriteInts(output, event->deadregion_size, event->deadregion);
-  FCIOWriteUShorts(output,event->num_traces,event->trace_list);
+size_t FCIOSetPoolLimit(size_t max_bytes)
 
-  const int length = config->eventsamples + 2;
-  unsigned short write_buffer[FCIOMaxChannels * 2];
-  for (int i = 0; i < event->num_traces; i++)
-  {
-    int j = event->trace_list[i];
-    for (int k = 0; k < 2; k++)
-      write_buffer[i * 2 + k] = event->traces[j * length + k];
-  }
-  FCIOWriteUShorts(output, event->num_traces * 2, write_buffer);
+/*--- Description ------------------------------------------------//
 
-  return FCIOFlush(output);
+Enables the library wide buffer pool and sets the maximum number
+of bytes it keeps. Trace and pulse storage and the record buffers
+of FCIOStateReader released by FCIOClose, FCIODestroyStateReader
+or a config change are kept in the pool and reused by subsequent
+allocations, e.g. after reopening a rotated file. This avoids
+allocating and page-faulting the storage again.
+
+Specify 0 (default) to disable the pool and free all kept buffers.
+
+Returns the previously set limit.
+
+//----------------------------------------------------------------*/
+{
+  fcio_pool_lock();
+  size_t old = fcio_pool.limit;
+  fcio_pool.limit = max_bytes;
+  fcio_pool_unlock();
+  fcio_pool_trim(max_bytes);
+  return old;
 }
 
+
 /*=== Function ===================================================*/
 
-int FCIOPutEventHeader(FCIOStream output, FCIOData *input)
+int FCIOReservePool(size_t size, int count, int pool_flags)
 
 /*--- Description ------------------------------------------------//
 
-Writes the metadata and header of event data (struct fcio_event) to remote peer or file.
-
-The number of items in event.timeoffset, timestamp and deadregion sent
-to remote depends on their corresponding *_size items.
+Adds count buffers of size bytes to the buffer pool, raising the
+pool limit if required. Specify size 0 to reserve buffers for the
+FCIOAllocStatic trace storage of one event.
+Buffers are reused for allocations between size/2 and size bytes.
 
-The number of theaders sent depends on the trace_list array (with size num_traces).
-Only those traces, whose indices are stored in trace_list will be serialized.
+pool_flags is a combination of FCIOPoolFlags. With
+FCIOPoolPrefault all pages are touched now, with FCIOPoolLock they
+are additionally locked into memory, so the first records after
+opening a stream do not suffer from page fault latencies.
+Locking requires a sufficient RLIMIT_MEMLOCK.
 
-Returns 0 on success or <0 on error.
+Returns 0 on success or <0 on error. Buffers which could be
+allocated stay in the pool on error.
 
 //----------------------------------------------------------------*/
 {
-  if (!output) {
-    fprintf(stderr, "FCIOPutEventHeader/ERROR: Output not connected.\n");
-    return -1;
-  }
-  if (!input) {
-    fprintf(stderr, "FCIOPutEventHeader/ERROR: Input not valid (null pointer).\n");
+  if (size == 0)
+    size = fcio_traces_size(NULL, FCIOAllocStatic | FCIOAllocAligned);
+  if (count < 0)
     return -1;
-  }
 
-  return fcio_put_eventheader(output, &input->config, &input->event);
+  int rc = 0;
+  size_t pooled_bytes = 0;
+  for (int i = 0; i < count; i++) {
+    void *buffer = fcio_buffer_new(size, (pool_flags & FCIOPoolHugePages) ? FCIOAllocHugePages : 0);
+    if (!buffer) {
+      if (fcio_debug())
+        fprintf(stderr, "FCIOReservePool/ERROR: can not allocate %zu bytes\n", size);
+      return -1;
+    }
+    fcio_buffer_header *header = fcio_buffer_get_header(buffer);
+    if (pool_flags & (FCIOPoolPrefault | FCIOPoolLock))
+      memset(buffer, 0, size);
+    if (pool_flags & FCIOPoolLock) {
+      if (mlock(header->mem, header->mapped ? header->mapped : sizeof(fcio_buffer_header) + FCIOTraceAlignment + size) == 0) {
+        header->locked = 1;
+      } else {
+        if (fcio_debug())
+          fprintf(stderr, "FCIOReservePool/ERROR: can not lock %zu bytes into memory\n", size);
+        rc = -1;
+      }
+    }
+
+    // raising the limit and adding the buffer is one step, concurrent puts can not fill the room
+    fcio_pool_lock();
+    if (fcio_pool.limit < fcio_pool.bytes + header->capacity)
+      fcio_pool.limit = fcio_pool.bytes + header->capacity;
+    fcio_pool_link(buffer);
+    pooled_bytes = fcio_pool.bytes;
+    fcio_pool_unlock();
+  }
+  if (fcio_debug() > 3)
+    fprintf(stderr, "FCIOReservePool/DEBUG: pool keeps %zu KB\n", pooled_bytes / 1024);
+  return rc;
 }
 
-static inline int fcio_put_recevent(FCIOStream output, fcio_config* config, fcio_recevent* recevent)
-{
-  if (!output || !config || !recevent) return -1;
-  FCIOWriteMessage(output,FCIORecEvent);
-  FCIOWriteInt(output, recevent->type);
-  FCIOWriteFloat(output, recevent->pulser);
-  FCIOWriteInts(output, recevent->timeoffset_size, recevent->timeoffset);
-  FCIOWriteInts(output, recevent->timestamp_size, recevent->timestamp);
-  FCIOWriteInts(output, recevent->deadregion_size, recevent->deadregion);
-  FCIOWriteInt(output, recevent->totalpulses);
-  FCIOWriteInts(output, config->adcs, recevent->channel_pulses);
-  FCIOWriteInts(output, recevent->totalpulses, recevent->flags);
-  FCIOWriteFloats(output, recevent->totalpulses, recevent->amplitudes);
-  FCIOWriteFloats(output, recevent->totalpulses, recevent->times);
 
-  return FCIOFlush(output);
+/*=== Function ===================================================*/
+
+void FCIOReleasePool(void)
+
+/*--- Description ------------------------------------------------//
+
+Frees all buffers kept in the buffer pool. The pool limit is not
+changed.
+
+//----------------------------------------------------------------*/
+{
+  fcio_pool_trim(0);
 }
 
+
 /*=== Function ===================================================*/
 
-int FCIOPutRecEvent(FCIOStream output, FCIOData *input)
+FCIOData *FCIOOpen(const char *name, int timeout, int buffer)
 
 /*--- Description ------------------------------------------------//
 
-Writes a record of recevent data (struct fcio_recevent) to remote peer or file.
-A record consist of the message tag and all data members of the struct.
+Connects to a file, server or client for FCIO read data transfer.
 
-The number of items in event.timeoffset, timestamp and deadregion sent
-to remote depends on their corresponding *_size items.
+name is the connection endpoint of the underlying TMIO/BUFIO
+library. Please refer to the documentation of TMIO/BUFIO for
+more information.
 
-The number of items in recevent.channel_pulses depends on config.adcs.
+name can be:
 
-The number of items in recevent.flags, recevent.amplitudes and recevent.times
-depends on recevent.totalpulses.
+tcp://listen/port           to listen to port at all interfaces
+tcp://listen/port/nodename  to listen to port at nodename interface
+tcp://connect/port/nodename to connect to port and nodename
 
-Returns 0 on success or <0 on error.
+Any other name not starting with tcp: is treated as a file name.
+
+timeout specifies the time to wait for a connection in milliseconds.
+Specify 0 to return immediately (within the typical delays imposed by the
+connection and OS) or -1 to block indefinitely.
+
+buffer may be used to initialize the size (in kB) of the protocol buffers. If 0
+is specified a default value will be used.
+
+The trace and pulse storage is allocated on the first FCIOConfig
+record, see FCIOAllocBuffers and FCIOSetAllocFlags.
+
+Returns a FCIOData structure or 0 on error.
 
 //----------------------------------------------------------------*/
 {
-  if (!output) {
-    fprintf(stderr, "FCIOPutRecEvent/ERROR: Output not connected.\n");
-    return -1;
+  FCIOData *x=(FCIOData*)calloc(1,sizeof(FCIOData));
+  if(!x)
+  {
+    if(fcio_debug()) fprintf(stderr,"FCIOOpen/ERROR: can not init structure\n");
+    return 0;
   }
-  if (!input) {
-    fprintf(stderr, "FCIOPutRecEvent/ERROR: Input not valid (null pointer).\n");
-    return -1;
+  x->ptmio=(void*)FCIOConnect(name,'r',timeout,buffer);
+  if(x->ptmio==0)
+  {
+    if(fcio_debug()) fprintf(stderr,"FCIOOpen/ERROR: can not connect to data source %s \n",(name)?name:"(NULL)");
+    free(x);
+    return 0;
   }
-
-  return fcio_put_recevent(output, &input->config, &input->recevent);
+  if(fcio_debug()>2) fprintf(stderr,"FCIOOpen: io structure initialized, size %ld KB\n",(long)sizeof(FCIOData)/1024);
+  return x;
 }
 
 
+
 /*=== Function ===================================================*/
 
-int FCIOPutRecord(FCIOStream output, FCIOData* input, int tag)
+int FCIOClose(FCIOData *x)
 
 /*--- Description ------------------------------------------------//
 
-Writes a record of data to remote peer or file.
-A record consist of a message tag and all data items stored under
-this tag.
-
-Known record tags are listed in the FCIOTag enum.
-
-This function wraps the family of FCIOPut<..> functions.
-Refer to their documentation for more details.
+Disconnects to any FCIOData source and closes any communication to
+the endpoint and frees all associated data. x becomes invalid
+after the function call.
 
-Returns 0 success, <0 on error or >0 on warning.
-  -1 : invalid inputs (null pointer)
-   1 : unknown tag
+Returns 0 on success or <0 on error.
 
 //----------------------------------------------------------------*/
 {
-  if (!output) {
-    fprintf(stderr, "FCIOPutRecord/ERROR: Output not connected.\n");
-    return -1;
-  }
-  if (!input) {
-    fprintf(stderr, "FCIOPutRecord/ERROR: Input not valid (null pointer).\n");
-    return -1;
-  }
+  if (!x) return -1;
+  FCIOStream xio=x->ptmio;
+  FCIODisconnect(xio);
+  FCIOFreeBuffers(x);
+  free(x);
+  if(fcio_debug() > 3) fprintf(stderr,"FCIOClose/DEBUG: closed\n");
+  return 0;
+}
 
-  switch (tag) {
-    case FCIOEvent:
-      return fcio_put_event(output, &input->config, &input->event);
 
-    case FCIOSparseEvent:
-      return fcio_put_sparseevent(output, &input->config, &input->event);
+/*=== Function ===================================================*/
 
-    case FCIORecEvent:
-      return fcio_put_recevent(output, &input->config, &input->recevent);
+FCIOStream FCIOStreamHandle(FCIOData *x)
 
-    case FCIOConfig:
-      return fcio_put_config(output, &input->config);
+/*--- Description ------------------------------------------------//
 
-    case FCIOStatus:
-      return fcio_put_status(output, &input->status);
+Returns the internal FCIOStream object on success or NULL on error.
 
-    case FCIOEventHeader:
-      return fcio_put_eventheader(output, &input->config, &input->event);
-  }
-  return 1;
+//----------------------------------------------------------------*/
+{
+  if(!x) return NULL;
+  FCIOStream xio=x->ptmio;
+  if(fcio_debug() > 3) fprintf(stderr,"FCIOStream/DEBUG: return stream pointer.\n");
+  return xio;
 }
 
-static inline int fcio_get_config(FCIOStream stream, fcio_config *config)
-{
+
+static inline int fcio_put_config(FCIOStream output, fcio_config* config)
+{
+  if (!output || !config)
+    return -1;
+
+  FCIOWriteMessage(output,FCIOConfig);
+  FCIOWriteInt(output,config->adcs);
+  FCIOWriteInt(output,config->triggers);
+  FCIOWriteInt(output,config->eventsamples);
+  FCIOWriteInt(output,config->blprecision);
+  FCIOWriteInt(output,config->sumlength);
+  FCIOWriteInt(output,config->adcbits);
+  FCIOWriteInt(output,config->mastercards);
+  FCIOWriteInt(output,config->triggercards);
+  FCIOWriteInt(output,config->adccards);
+  FCIOWriteInt(output,config->gps);
+  FCIOWriteInts(output,(config->adcs+config->triggers),config->tracemap);
+  FCIOWriteInt(output,config->streamid);
+
+  return FCIOFlush(output);
+}
+
+/*=== Function ===================================================*/
+
+int FCIOPutConfig(FCIOStream output, FCIOData *input)
+
+/*--- Description ------------------------------------------------//
+
+Writes a record of config data (struct fcio_config) to remote peer or file.
+A record consist of the message tag and all data members of the struct.
+
+Returns 0 on success or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!output) {
+    fprintf(stderr, "FCIOPutConfig/ERROR: Output not connected.\n");
+    return -1;
+  }
+  if (!input) {
+    fprintf(stderr, "FCIOPutConfig/ERROR: Input not valid (null pointer).\n");
+    return -1;
+  }
+
+  return fcio_put_config(output, &input->config);
+}
+
+
+static inline int fcio_put_status(FCIOStream output, fcio_status* status)
+{
+  if (!output || !status)
+    return -1;
+
+  if (status->cards > 0)
+    fcio_index_hint(output, -1, status->data[0].pps, status->data[0].ticks);
+  FCIOWriteMessage(output, FCIOStatus);
+  FCIOWriteInt(output, status->status);
+  FCIOWriteInts(output, 10, status->statustime);
+  FCIOWriteInt(output, status->cards);
+  FCIOWriteInt(output, status->size);
+  for (int i = 0; i < status->cards; i++)
+    FCIOWrite(output, status->size, (void*)&status->data[i]);
+
+  return FCIOFlush(output);
+}
+
+/*=== Function ===================================================*/
+
+int FCIOPutStatus(FCIOStream output, FCIOData *input)
+
+/*--- Description ------------------------------------------------//
+
+Writes a record of config data (struct fcio_status) to remote peer or file.
+A record consist of the message tag and all data members of the struct.
+
+The size of status.data from individual cards is sent depending on
+status.cards and status.size.
+
+Returns 0 on success or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!output) {
+    fprintf(stderr, "FCIOPutStatus/ERROR: Output not connected.\n");
+    return -1;
+  }
+  if (!input) {
+    fprintf(stderr, "FCIOPutStatus/ERROR: Input not valid (null pointer).\n");
+    return -1;
+  }
+
+  return fcio_put_status(output, &input->status);
+}
+
+
+// the trace and pulse storage of writers is allocated by FCIOAllocBuffers, a zeroed FCIOData has none
+static inline int fcio_put_storage(const void *storage, const char *caller)
+{
+  if (storage)
+    return 0;
+  fprintf(stderr, "%s/ERROR: storage not allocated, call FCIOAllocBuffers after filling the config.\n", caller);
+  return -1;
+}
+
+static inline int fcio_put_event(FCIOStream output, fcio_config* config, fcio_event* event)
+{
+  if (!output || !config || !event || fcio_put_storage(event->traces, "FCIOPutEvent") < 0)
+    return -1;
+
+  fcio_index_hint_timestamp(output, event->timestamp, event->timestamp_size);
+  FCIOWriteMessage(output,FCIOEvent);
+  FCIOWriteInt(output,event->type);
+  FCIOWriteFloat(output,event->pulser);
+  FCIOWriteInts(output, event->timeoffset_size, event->timeoffset);
+  FCIOWriteInts(output, event->timestamp_size, event->timestamp);
+
+  // traces are sent packed in one frame, a padded trace storage is packed into
+  // the staging space of the stream, the traces of the caller stay untouched
+  const int ntraces = config->adcs + config->triggers;
+  const int length = config->eventsamples + 2;
+  const int stride = fcio_trace_stride(config, fcio_buffer_flags(event->traces));
+  const unsigned short *traces = fcio_trace_header(event, config, 0);
+  if (stride != length) {
+    unsigned short *packed = (unsigned short *)fcio_stream_scratch(output, (size_t)ntraces * length * sizeof(unsigned short));
+    if (!packed)
+      return -1;
+    for (int i = 0; i < ntraces; i++)
+      memcpy(&packed[(size_t)i * length], &traces[(size_t)i * stride], length * sizeof(unsigned short));
+    traces = packed;
+  }
+  FCIOWriteUShorts(output,ntraces*length,traces);
+
+  FCIOWriteInts(output, event->deadregion_size, event->deadregion);
+  return FCIOFlush(output);
+}
+
+/*=== Function ===================================================*/
+
+int FCIOPutEvent(FCIOStream output, FCIOData *input)
+
+/*--- Description ------------------------------------------------//
+
+Writes a record of event data (struct fcio_event) to remote peer or file.
+A record consist of the message tag and all data members of the struct.
+
+The number of items in event.timeoffset, timestamp and deadregion sent
+to remote depends on their corresponding *_size items.
+
+The number of items in event.traces sent to remote depends on
+(config.adcs + config.triggers) * (config.eventsamples+2).
+
+Returns 0 on success or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!output) {
+    fprintf(stderr, "FCIOPutEvent/ERROR: Output not connected.\n");
+    return -1;
+  }
+  if (!input) {
+    fprintf(stderr, "FCIOPutEvent/ERROR: Input not valid (null pointer).\n");
+    return -1;
+  }
+
+  return fcio_put_event(output, &input->config, &input->event);
+}
+
+
+
+static inline int fcio_put_sparseevent(FCIOStream output, fcio_config* config, fcio_event* event)
+{
+  if (!output || !config || !event || fcio_put_storage(event->traces, "FCIOPutSparseEvent") < 0)
+    return -1;
+
+  // one frame per trace, the frame list is kept in the staging space of the stream
+  int num_traces = event->num_traces < FCIOMaxChannels ? event->num_traces : FCIOMaxChannels;
+  FCIOFrame *frames = (FCIOFrame *)fcio_stream_scratch(output, (7 + (size_t)(num_traces > 0 ? num_traces : 0)) * sizeof(FCIOFrame));
+  if (!frames)
+    return -1;
+  int nframes = 0;
+  frames[nframes++] = (FCIOFrame){&event->type, sizeof(int)};
+  frames[nframes++] = (FCIOFrame){&event->pulser, sizeof(float)};
+  frames[nframes++] = (FCIOFrame){event->timeoffset, event->timeoffset_size * sizeof(int)};
+  frames[nframes++] = (FCIOFrame){event->timestamp, event->timestamp_size * sizeof(int)};
+  frames[nframes++] = (FCIOFrame){event->deadregion, event->deadregion_size * sizeof(int)};
+  frames[nframes++] = (FCIOFrame){&event->num_traces, sizeof(int)};
+  frames[nframes++] = (FCIOFrame){event->trace_list, event->num_traces * sizeof(unsigned short)};
+
+  int length = (config->eventsamples + 2) * sizeof(unsigned short);
+  for (int i = 0; i < num_traces; i++)
+    frames[nframes++] = (FCIOFrame){fcio_trace_header(event, config, event->trace_list[i]), length};
+
+  // the tag is buffered and goes out with the frames in one write
+  fcio_index_hint_timestamp(output, event->timestamp, event->timestamp_size);
+  if (FCIOWriteMessage(output, FCIOSparseEvent) < 0 || FCIOWriteFrames(output, nframes, frames) < 0)
+    return -1;
+
+  return FCIOFlush(output);
+}
+
+/*=== Function ===================================================*/
+
+int FCIOPutSparseEvent(FCIOStream output, FCIOData *input)
+
+/*--- Description ------------------------------------------------//
+
+Writes a sparse record of event data (struct fcio_event) to remote peer or file.
+A record consist of the message tag and all data members of the struct.
+
+The number of items in event.timeoffset, timestamp and deadregion sent
+to remote depends on their corresponding *_size items.
+
+The number of theaders sent depends on the trace_list array (with size num_traces).
+Only those traces, whose indices are stored in trace_list will be serialized.
+
+Returns 0 on success or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!output) {
+    fprintf(stderr, "FCIOPutSparseEvent/ERROR: Output not connected.\n");
+    return -1;
+  }
+  if (!input) {
+    fprintf(stderr, "FCIOPutSparseEvent/ERROR: Input not valid (null pointer).\n");
+    return -1;
+  }
+
+  return fcio_put_sparseevent(output, &input->config, &input->event);
+}
+
+
+static inline int fcio_put_eventheader(FCIOStream output, fcio_config* config, fcio_event* event)
+{
+  if (!output || !config || !event || fcio_put_storage(event->traces, "FCIOPutEventHeader") < 0)
+    return -1;
+
+  // the trace headers are gathered in the staging space of the stream, as they form a single frame on the wire
+  int num_traces = event->num_traces < FCIOMaxChannels ? event->num_traces : FCIOMaxChannels;
+  unsigned short *write_buffer = (unsigned short *)fcio_stream_scratch(output, 2 * (size_t)(num_traces > 0 ? num_traces : 0) * sizeof(unsigned short));
+  if (!write_buffer)
+    return -1;
+  for (int i = 0; i < num_traces; i++)
+  {
+    const unsigned short *theader = fcio_trace_header(event, config, event->trace_list[i]);
+    for (int k = 0; k < 2; k++)
+      write_buffer[i * 2 + k] = theader[k];
+  }
+
+  FCIOFrame frames[] = {
+    {&event->type, sizeof(int)},
+    {&event->pulser, sizeof(float)},
+    {event->timeoffset, event->timeoffset_size * sizeof(int)},
+    {event->timestamp, event->timestamp_size * sizeof(int)},
+    {event->deadregion, event->deadregion_size * sizeof(int)},
+    {event->trace_list, num_traces * sizeof(unsigned short)},
+    {write_buffer, num_traces * 2 * sizeof(unsigned short)},
+  };
+  fcio_index_hint_timestamp(output, event->timestamp, event->timestamp_size);
+  if (FCIOWriteMessage(output, FCIOEventHeader) < 0 || FCIOWriteFrames(output, sizeof(frames) / sizeof(*frames), frames) < 0)
+    return -1;
+
+  return FCIOFlush(output);
+}
+
+/*=== Function ===================================================*/
+
+int FCIOPutEventHeader(FCIOStream output, FCIOData *input)
+
+/*--- Description ------------------------------------------------//
+
+Writes the metadata and header of event data (struct fcio_event) to remote peer or file.
+
+The number of items in event.timeoffset, timestamp and deadregion sent
+to remote depends on their corresponding *_size items.
+
+The number of theaders sent depends on the trace_list array (with size num_traces).
+Only those traces, whose indices are stored in trace_list will be serialized.
+
+Returns 0 on success or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!output) {
+    fprintf(stderr, "FCIOPutEventHeader/ERROR: Output not connected.\n");
+    return -1;
+  }
+  if (!input) {
+    fprintf(stderr, "FCIOPutEventHeader/ERROR: Input not valid (null pointer).\n");
+    return -1;
+  }
+
+  return fcio_put_eventheader(output, &input->config, &input->event);
+}
+
+static inline int fcio_put_recevent(FCIOStream output, fcio_config* config, fcio_recevent* recevent)
+{
+  if (!output || !config || !recevent || fcio_put_storage(recevent->flags, "FCIOPutRecEvent") < 0) return -1;
+  fcio_index_hint_timestamp(output, recevent->timestamp, recevent->timestamp_size);
+  FCIOWriteMessage(output,FCIORecEvent);
+  FCIOWriteInt(output, recevent->type);
+  FCIOWriteFloat(output, recevent->pulser);
+  FCIOWriteInts(output, recevent->timeoffset_size, recevent->timeoffset);
+  FCIOWriteInts(output, recevent->timestamp_size, recevent->timestamp);
+  FCIOWriteInts(output, recevent->deadregion_size, recevent->deadregion);
+  FCIOWriteInt(output, recevent->totalpulses);
+  FCIOWriteInts(output, config->adcs, recevent->channel_pulses);
+  FCIOWriteInts(output, recevent->totalpulses, recevent->flags);
+  FCIOWriteFloats(output, recevent->totalpulses, recevent->amplitudes);
+  FCIOWriteFloats(output, recevent->totalpulses, recevent->times);
+
+  return FCIOFlush(output);
+}
+
+/*=== Function ===================================================*/
+
+int FCIOPutRecEvent(FCIOStream output, FCIOData *input)
+
+/*--- Description ------------------------------------------------//
+
+Writes a record of recevent data (struct fcio_recevent) to remote peer or file.
+A record consist of the message tag and all data members of the struct.
+
+The number of items in event.timeoffset, timestamp and deadregion sent
+to remote depends on their corresponding *_size items.
+
+The number of items in recevent.channel_pulses depends on config.adcs.
+
+The number of items in recevent.flags, recevent.amplitudes and recevent.times
+depends on recevent.totalpulses.
+
+Returns 0 on success or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!output) {
+    fprintf(stderr, "FCIOPutRecEvent/ERROR: Output not connected.\n");
+    return -1;
+  }
+  if (!input) {
+    fprintf(stderr, "FCIOPutRecEvent/ERROR: Input not valid (null pointer).\n");
+    return -1;
+  }
+
+  return fcio_put_recevent(output, &input->config, &input->recevent);
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIOPutRecord(FCIOStream output, FCIOData* input, int tag)
+
+/*--- Description ------------------------------------------------//
+
+Writes a record of data to remote peer or file.
+A record consist of a message tag and all data items stored under
+this tag.
+
+Known record tags are listed in the FCIOTag enum.
+
+This function wraps the family of FCIOPut<..> functions.
+Refer to their documentation for more details.
+
+Returns 0 success, <0 on error or >0 on warning.
+  -1 : invalid inputs (null pointer)
+   1 : unknown tag
+
+//----------------------------------------------------------------*/
+{
+  if (!output) {
+    fprintf(stderr, "FCIOPutRecord/ERROR: Output not connected.\n");
+    return -1;
+  }
+  if (!input) {
+    fprintf(stderr, "FCIOPutRecord/ERROR: Input not valid (null pointer).\n");
+    return -1;
+  }
+
+  switch (tag) {
+    case FCIOEvent:
+      return fcio_put_event(output, &input->config, &input->event);
+
+    case FCIOSparseEvent:
+      return fcio_put_sparseevent(output, &input->config, &input->event);
+
+    case FCIORecEvent:
+      return fcio_put_recevent(output, &input->config, &input->recevent);
+
+    case FCIOConfig:
+      return fcio_put_config(output, &input->config);
+
+    case FCIOStatus:
+      return fcio_put_status(output, &input->status);
+
+    case FCIOEventHeader:
+      return fcio_put_eventheader(output, &input->config, &input->event);
+  }
+  return 1;
+}
+
+static inline int fcio_get_config(FCIOStream stream, fcio_config *config)
+{
   if (!stream || !config)
     return -1;
 
-  FCIOReadInt(stream,config->adcs);
-  FCIOReadInt(stream,config->triggers);
-  const int n_configured_traces = config->adcs + config->triggers;
-  if (n_configured_traces < 0 || n_configured_traces > FCIOMaxChannels) {
-    if (debug)
-      fprintf(stderr, "FCIO/fcio_get_config/ERROR: number of configured channels %d (adc %d + trigger %d) outside allowed range [0,%d]\n", n_configured_traces, config->adcs, config->triggers, FCIOMaxChannels);
-    return -1;
+  FCIOReadInt(stream,config->adcs);
+  FCIOReadInt(stream,config->triggers);
+  const int n_configured_traces = config->adcs + config->triggers;
+  if (n_configured_traces < 0 || n_configured_traces > FCIOMaxChannels) {
+    if (fcio_stream_debug(stream))
+      fprintf(stderr, "FCIO/fcio_get_config/ERROR: number of configured channels %d (adc %d + trigger %d) outside allowed range [0,%d]\n", n_configured_traces, config->adcs, config->triggers, FCIOMaxChannels);
+    return -1;
+  }
+
+  FCIOReadInt(stream,config->eventsamples);
+  if (config->eventsamples < 0 || config->eventsamples > FCIOMaxSamples) {
+    if (fcio_stream_debug(stream))
+      fprintf(stderr, "FCIO/fcio_get_config/ERROR: eventsamples %d outside allowed range [0,%d]\n", config->eventsamples, FCIOMaxSamples);
+    return -1;
+  }
+  FCIOReadInt(stream,config->blprecision);
+  FCIOReadInt(stream,config->sumlength);
+  FCIOReadInt(stream,config->adcbits);
+  FCIOReadInt(stream,config->mastercards);
+  FCIOReadInt(stream,config->triggercards);
+  FCIOReadInt(stream,config->adccards);
+  FCIOReadInt(stream,config->gps);
+  int tracemap_size = FCIOReadInts(stream, FCIOMaxChannels, config->tracemap)/sizeof(int);
+  FCIOReadInt(stream,config->streamid);
+
+  if (fcio_stream_debug(stream) > 3)
+    fprintf(stderr,"FCIO/fcio_get_config/DEBUG: %d/%d/%d adcs %d triggers %d samples %d adcbits %d blprec %d sumlength %d gps %d\n",
+      config->mastercards, config->triggercards, config->adccards,
+      config->adcs,config->triggers,config->eventsamples,config->adcbits,config->blprecision,config->sumlength,config->gps);
+  if (fcio_stream_debug(stream) > 4) {
+    for (int i = 0; i < tracemap_size; i++)
+       fprintf(stderr,"FCIO/fcio_get_config/DEBUG: trace %d mapped to 0x%x\n",i,config->tracemap[i]);
+  }
+
+
+  // tracemap must not be present, but should match number of traces.
+  if (tracemap_size && tracemap_size != n_configured_traces) {
+    fprintf(stderr, "FCIO/fcio_get_config/WARNING: got unexpected tracemap size %d/%d\n", tracemap_size, n_configured_traces);
+    return 1;
+  }
+  return 0;
+}
+
+static inline void fcio_scatter_card_status(fcio_status *status, int i)
+{
+  // copies the card status data[i] into column i of status->fields
+  status->fields.reqid[i] = status->data[i].reqid;
+  status->fields.status[i] = status->data[i].status;
+  status->fields.eventno[i] = status->data[i].eventno;
+  status->fields.pps[i] = status->data[i].pps;
+  status->fields.ticks[i] = status->data[i].ticks;
+  status->fields.maxticks[i] = status->data[i].maxticks;
+  status->fields.numenv[i] = status->data[i].numenv;
+  status->fields.numctilinks[i] = status->data[i].numctilinks;
+  status->fields.numlinks[i] = status->data[i].numlinks;
+  status->fields.totalerrors[i] = status->data[i].totalerrors;
+  status->fields.enverrors[i] = status->data[i].enverrors;
+  status->fields.ctierrors[i] = status->data[i].ctierrors;
+  status->fields.linkerrors[i] = status->data[i].linkerrors;
+  for (int k = 0; k < 5; k++)
+    status->fields.othererrors[k][i] = status->data[i].othererrors[k];
+  for (int k = 0; k < 16; k++)
+    status->fields.environment[k][i] = status->data[i].environment[k];
+  for (int k = 0; k < 4; k++)
+    status->fields.ctilinks[k][i] = status->data[i].ctilinks[k];
+}
+
+static inline int fcio_get_status(FCIOStream stream, fcio_status *status)
+{
+  if (!stream || !status)
+    return -1;
+
+  FCIOReadInt(stream,status->status);
+  FCIOReadInts(stream,10,status->statustime);
+  FCIOReadInt(stream,status->cards);
+  FCIOReadInt(stream,status->size);
+  if (status->cards < 0 || status->cards > 256) {
+    if (fcio_stream_debug(stream))
+      fprintf(stderr, "FCIO/fcio_get_status/ERROR: number of cards %d exceeds status capacity of 256.\n", status->cards);
+    return -1;
+  }
+  for (int i = 0; i < status->cards; i++) {
+    FCIORead(stream, status->size, (void*)&status->data[i]);
+    fcio_scatter_card_status(status, i);
+  }
+
+  if (fcio_stream_debug(stream) > 3) {
+    int totalerrors = 0;
+    for (int i = 0; i < status->cards; i++)
+      totalerrors += status->fields.totalerrors[i];
+    fprintf(stderr,"FCIO/fcio_get_status/DEBUG: overall %d errors %d time pps %d ticks %d unix %d %d delta %d cards %d\n",
+      status->status,totalerrors,status->statustime[0], status->statustime[1],status->statustime[2],
+      status->statustime[3],status->statustime[4],status->cards);
+
+    if (fcio_stream_debug(stream) > 4) {
+      for (int i = 0; i < status->cards; i++) {
+        fprintf(stderr,"FCIO/fcio_get_status/DEBUG: card %d: status %d errors %d time %d %9d env",i,
+          status->data[i].status,status->data[i].totalerrors,status->data[i].pps,status->data[i].ticks);
+        if (fcio_stream_debug(stream) > 5) {
+          for (int i1 = 0; i1 < (int)status->data[i].numenv; i1++)
+            fprintf(stderr," %d",(int)status->data[i].environment[i1]);
+        }
+        fprintf(stderr,"\n");
+      }
+    }
+  }
+  return 0;
+}
+
+static inline void fcio_next_generation(fcio_event *event)
+{
+  // starts a new record generation; on wrap-around all traces are invalidated explicitly
+  if (++event->generation == 0) {
+    memset(event->trace_generation, 0, sizeof(event->trace_generation));
+    event->generation = 1;
+  }
+}
+
+// reads only the two header words of the packed traces of an FCIOEvent trace frame
+static int fcio_read_trace_headers(FCIOStream stream, fcio_config *config, fcio_event *event, int ntraces, int length)
+{
+  const unsigned short *payload = NULL;
+  if (fcio_read_views(stream, 1, ntraces * length * sizeof(unsigned short), (const void **)&payload) == 0) {
+    for (int i = 0; i < ntraces; i++) {
+      unsigned short *theader = fcio_trace_header(event, config, i);
+      theader[0] = payload[(size_t)i * length];
+      theader[1] = payload[(size_t)i * length + 1];
+    }
+    return ntraces;
+  }
+
+  // tmio delivers the frame as a whole, only the headers are moved to their padded position
+  unsigned short *traces = fcio_trace_header(event, config, 0);
+  const int frame_size = FCIOReadUShorts(stream, ntraces * length, traces);
+  const int nread = frame_size > 0 ? frame_size / (int)sizeof(unsigned short) / length : 0;
+  for (int i = (nread < ntraces ? nread : ntraces) - 1; i > 0; i--) {
+    unsigned short *theader = fcio_trace_header(event, config, i);
+    theader[0] = traces[(size_t)i * length];
+    theader[1] = traces[(size_t)i * length + 1];
+  }
+  return nread;
+}
+
+// reads the selected traces of an FCIOEvent trace frame, returns the number of traces in the frame
+static int fcio_read_trace_subset(FCIOStream stream, fcio_config *config, fcio_event *event, int ntraces, int length, const unsigned int *mask)
+{
+  const unsigned short *payload = NULL;
+  if (fcio_read_views(stream, 1, ntraces * length * sizeof(unsigned short), (const void **)&payload) == 0) {
+    for (int i = 0; i < ntraces; i++) {
+      if (!fcio_channel_selected(mask, i))
+        continue;
+      memcpy(fcio_trace_header(event, config, i), &payload[(size_t)i * length], length * sizeof(unsigned short));
+      event->trace_generation[i] = event->generation;
+    }
+    return ntraces;
+  }
+
+  // tmio copies frames from the start, the part after the last selected trace is skipped
+  int last = ntraces - 1;
+  while (last >= 0 && !fcio_channel_selected(mask, last))
+    last--;
+  unsigned short *traces = fcio_trace_header(event, config, 0);
+  unsigned short skip;
+  const int frame_size = last < 0 ? FCIORead(stream, 0, &skip) : FCIOReadUShorts(stream, (last + 1) * length, traces);
+  const int nread = frame_size > 0 ? frame_size / (int)sizeof(unsigned short) / length : 0;
+  const int stride = fcio_trace_stride(config, fcio_buffer_flags(event->traces));
+  if (stride != length && last > 0)
+    fcio_unpack_traces(traces, last + 1, length, stride);
+  for (int i = 0; i <= last && i < nread; i++)
+    if (fcio_channel_selected(mask, i))
+      event->trace_generation[i] = event->generation;
+  return nread;
+}
+
+static inline int fcio_get_event(FCIOStream stream, fcio_config *config, fcio_event *event, int decode_flags, const unsigned int *mask)
+{
+  if (!stream || !config || !event)
+    return -1;
+
+  const int num_expected_traces = config->adcs + config->triggers;
+  if (num_expected_traces < 0 || num_expected_traces > FCIOMaxChannels)
+    return -1;
+
+  fcio_next_generation(event);
+  FCIOReadInt(stream,event->type);
+  FCIOReadFloat(stream,event->pulser);
+  event->timeoffset_size = FCIOReadInts(stream,10,event->timeoffset)/sizeof(int);
+  event->timestamp_size = FCIOReadInts(stream,10,event->timestamp)/sizeof(int);
+  // traces are sent packed, they are moved in place to a padded trace storage
+  const int length = config->eventsamples + 2;
+  const int stride = fcio_trace_stride(config, fcio_buffer_flags(event->traces));
+  unsigned short *traces = fcio_trace_header(event, config, 0);
+  const int ntraces = num_expected_traces < fcio_trace_capacity(event, config) ? num_expected_traces : fcio_trace_capacity(event, config);
+  if (decode_flags & FCIODecodeHeaders) {
+    fcio_read_trace_headers(stream, config, event, ntraces, length);
+  } else if (mask) {
+    fcio_read_trace_subset(stream, config, event, ntraces, length, mask);
+  } else {
+    const int frame_size = FCIOReadUShorts(stream,ntraces*length,traces);
+    if (stride != length)
+      fcio_unpack_traces(traces, ntraces, length, stride);
+    const int nread = frame_size > 0 ? frame_size / (int)sizeof(unsigned short) / length : 0;
+    for (int i = 0; i < nread && i < ntraces; i++)
+      event->trace_generation[i] = event->generation;
+  }
+  event->deadregion_size = FCIOReadInts(stream,10,event->deadregion)/sizeof(int);
+  // If an FCIOSparseEvent has been read previous to an FCIOEvent
+  // num_traces and trace_list might have been adjusted to match the sparse layout
+  if (event->num_traces != num_expected_traces) {
+    event->num_traces = num_expected_traces;
+    for (int i = 0; i < num_expected_traces; i++)
+      event->trace_list[i] = i;
+  }
+  event->deadregion[5] = 0;
+  event->deadregion[6] = num_expected_traces;
+
+  if (fcio_stream_debug(stream) > 3) {
+    fprintf(stderr,"FCIO/fcio_get_event/DEBUG: type %d pulser %g, offset %d %d %d traces %d timestamp[%d] ",
+      event->type,event->pulser,event->timeoffset[0],event->timeoffset[1],event->timeoffset[2],event->num_traces, event->timestamp_size);
+    for (int i = 0; i < event->timestamp_size; i++)
+      fprintf(stderr," %d",event->timestamp[i]);
+    fprintf(stderr, " deadregion[%d]", event->deadregion_size);
+    for (int i = 0; i < event->deadregion_size; i++)
+      fprintf(stderr," %d",event->deadregion[i]);
+    fprintf(stderr,"\n");
+  }
+  return 0;
+}
+
+static inline int fcio_get_sparseevent(FCIOStream stream, fcio_config *config, fcio_event *event, int decode_flags, const unsigned int *mask)
+{
+  if (!stream || !config || !event)
+    return -1;
+
+  const int tracesamples = config->eventsamples + 2;
+  if (tracesamples < 0 || tracesamples > FCIOMaxSamples+2)
+    return -1;
+
+  fcio_next_generation(event);
+  FCIOReadInt(stream,event->type);
+  FCIOReadFloat(stream,event->pulser);
+  event->timeoffset_size = FCIOReadInts(stream,10,event->timeoffset)/sizeof(int);
+  event->timestamp_size = FCIOReadInts(stream,10,event->timestamp)/sizeof(int);
+  event->deadregion_size = FCIOReadInts(stream,10,event->deadregion)/sizeof(int);
+
+  FCIOReadInts(stream,1,&event->num_traces);
+  int read_trace_list_size = FCIOReadUShorts(stream, FCIOMaxChannels, event->trace_list)/sizeof(unsigned short);
+  if (read_trace_list_size != event->num_traces) {
+    if (fcio_stream_debug(stream) > 1) fprintf(stderr, "FCIO/fcio_get_sparsevent/WARNING: trace_list size does not match %d/%d\n", read_trace_list_size, event->num_traces);
+    if (read_trace_list_size < event->num_traces)
+      event->num_traces = read_trace_list_size;
+  }
+  const int max_traces = fcio_trace_capacity(event, config);
+  for (int i = 0; i < event->num_traces; i++) {
+    int trace_idx = event->trace_list[i];
+    if (trace_idx >= FCIOMaxChannels || trace_idx >= max_traces) {
+      if (fcio_stream_debug(stream)) fprintf(stderr, "FCIO/fcio_get_sparsevent/ERROR: trace_list contains out-of-bounds trace index for traces buffer %d/%d\n", trace_idx, max_traces < FCIOMaxChannels ? max_traces : FCIOMaxChannels);
+      return -1;
+    }
+    // the remaining samples of a trace frame are skipped by the next read
+    unsigned short skip;
+    if (decode_flags & FCIODecodeHeaders)
+      FCIOReadUShorts(stream,2,fcio_trace_header(event, config, trace_idx));
+    else if (!fcio_channel_selected(mask, trace_idx))
+      FCIORead(stream,0,&skip);
+    else if (FCIOReadUShorts(stream,tracesamples,fcio_trace_header(event, config, trace_idx)) >= (int)(tracesamples * sizeof(unsigned short)))
+      event->trace_generation[trace_idx] = event->generation;
+  }
+
+  if (fcio_stream_debug(stream) > 3) {
+    fprintf(stderr,"FCIO/fcio_get_sparseevent/DEBUG: type %d pulser %g, offset %d %d %d",event->type,event->pulser,event->timeoffset[0],event->timeoffset[1],event->timeoffset[2]);
+    fprintf(stderr," timestamp[%d]", event->timestamp_size); for (int i = 0; i < event->timestamp_size; i++) fprintf(stderr," %d",event->timestamp[i]);
+    fprintf(stderr," deadregion[%d]", event->deadregion_size); for (int i = 0; i < event->deadregion_size; i++) fprintf(stderr," %d",event->deadregion[i]);
+    if (fcio_stream_debug(stream) > 5) {
+      fprintf(stderr," traces[%d]", event->num_traces);
+      for (int i = 0; i < event->num_traces; i++) fprintf(stderr," %d",event->trace_list[i]);
+    }
+    fprintf(stderr,"\n");
+  }
+  return 0;
+}
+
+static inline int fcio_get_eventheader(FCIOStream stream, fcio_config* config, fcio_event *event)
+{
+  if (!stream || !config || !event)
+    return -1;
+
+  fcio_next_generation(event);
+  FCIOReadInt(stream,event->type);
+  FCIOReadFloat(stream,event->pulser);
+  event->timeoffset_size = FCIOReadInts(stream,10,event->timeoffset)/sizeof(int);
+  event->timestamp_size = FCIOReadInts(stream,10,event->timestamp)/sizeof(int);
+  event->deadregion_size = FCIOReadInts(stream,10,event->deadregion)/sizeof(int);
+  event->num_traces = FCIOReadUShorts(stream, FCIOMaxChannels, event->trace_list)/sizeof(unsigned short);
+
+  unsigned short read_buffer[FCIOMaxChannels * 2];
+  int read_header_elements = FCIOReadUShorts(stream, FCIOMaxChannels * 2, read_buffer)/sizeof(unsigned short)/2;
+  if (read_header_elements != event->num_traces) {
+    if (fcio_stream_debug(stream) > 1) fprintf(stderr, "FCIO/fcio_get_eventheader/WARNING: trace_list size does not match %d/%d\n", read_header_elements, event->num_traces);
+    if (read_header_elements < event->num_traces)
+      event->num_traces = read_header_elements;
+  }
+  const int max_traces = fcio_trace_capacity(event, config);
+  for (int i = 0; i < event->num_traces; i++) {
+    int trace_idx = event->trace_list[i];
+    if (trace_idx >= FCIOMaxChannels || trace_idx >= max_traces) {
+      if (fcio_stream_debug(stream)) fprintf(stderr, "FCIO/fcio_get_eventheader/ERROR: trace_list contains out-of-bounds trace index for traces buffer %d/%d\n", trace_idx, max_traces < FCIOMaxChannels ? max_traces : FCIOMaxChannels);
+      return -1;
+    }
+    unsigned short *theader = fcio_trace_header(event, config, trace_idx);
+    for (int k = 0; k < 2; k++)
+      theader[k] = read_buffer[i * 2 + k];
+  }
+
+  if (fcio_stream_debug(stream) > 3) {
+    fprintf(stderr,"FCIO/fcio_get_eventheader/DEBUG: type %d pulser %g, offset %d %d %d",event->type,event->pulser,event->timeoffset[0],event->timeoffset[1],event->timeoffset[2]);
+    fprintf(stderr," timestamp[%d]", event->timestamp_size); for (int i = 0; i < event->timestamp_size; i++) fprintf(stderr," %d",event->timestamp[i]);
+    fprintf(stderr," deadregion[%d]", event->deadregion_size); for (int i = 0; i < event->deadregion_size; i++) fprintf(stderr," %d",event->deadregion[i]);
+    if (fcio_stream_debug(stream) > 5) {
+      fprintf(stderr," traces[%d]", event->num_traces);
+      for (int i = 0; i < event->num_traces; i++)
+        fprintf(stderr," %d %u",event->trace_list[i], event->theader[event->trace_list[i]][1]);
+    }
+    fprintf(stderr,"\n");
+  }
+  return 0;
+}
+
+static inline int fcio_get_recevent(FCIOStream stream, fcio_recevent *recevent, int alloc_flags)
+{
+  if (!stream || !recevent)
+    return -1;
+
+  FCIOReadInt(stream,recevent->type);
+  FCIOReadFloat(stream,recevent->pulser);
+  recevent->timeoffset_size = FCIOReadInts(stream,10,recevent->timeoffset)/sizeof(int);
+  recevent->timestamp_size = FCIOReadInts(stream,10,recevent->timestamp)/sizeof(int);
+  recevent->deadregion_size = FCIOReadInts(stream,10,recevent->deadregion)/sizeof(int);
+  FCIOReadInt(stream, recevent->totalpulses);
+  FCIOReadInts(stream,FCIOMaxChannels,recevent->channel_pulses);
+
+  int max_pulses = fcio_buffer_size(recevent->flags)/sizeof(int);
+  if (!recevent->flags || ((alloc_flags & FCIOAllocDynamic) && recevent->totalpulses > max_pulses)) {
+    if (fcio_alloc_pulses(recevent, recevent->totalpulses > 2 * max_pulses ? recevent->totalpulses : 2 * max_pulses, alloc_flags) < 0)
+      return -1;
+    max_pulses = fcio_buffer_size(recevent->flags)/sizeof(int);
+  }
+  int flags_size = FCIOReadInts(stream,max_pulses,recevent->flags)/sizeof(int);
+  int amplitudes_size = FCIOReadFloats(stream,max_pulses,recevent->amplitudes)/sizeof(float);
+  int times_size = FCIOReadFloats(stream,max_pulses,recevent->times)/sizeof(float);
+
+  if (fcio_stream_debug(stream) > 3) {
+    fprintf(stderr,"FCIO/fcio_get_recevent/DEBUG: type %d pulser %g, offset %d %d %d timestamp ",
+        recevent->type,recevent->pulser,recevent->timeoffset[0],recevent->timeoffset[1],recevent->timeoffset[2]);
+    for (int i = 0; i < recevent->timestamp_size; i++)
+      fprintf(stderr," %d",recevent->timestamp[i]);
+    fprintf(stderr,"\n");
+  }
+
+  if ( (flags_size != amplitudes_size) || (amplitudes_size != times_size) || (times_size != recevent->totalpulses) ) {
+    if ( fcio_stream_debug(stream) > 1 ) fprintf(stderr, "FCIO/fcio_get_recevent/WARNING: Mismatch in pulse parameter sizes: totalpulses %d flags %d amplitudes %d times %d\n",
+      recevent->totalpulses, flags_size, amplitudes_size, times_size);
+    return 1;
+  }
+  return 0;
+}
+
+// makes sure x->view_traces holds at least size bytes, the content is not kept
+static inline int fcio_reserve_view(FCIOData *x, size_t size)
+{
+  if (x->view_traces && fcio_buffer_size(x->view_traces) >= size)
+    return 0;
+
+  const int flags = x->alloc_flags & FCIOAllocHugePages;
+  x->view_traces = (unsigned short *)fcio_buffer_resize(x->view_traces, size ? size : 1, flags);
+  if (!x->view_traces) {
+    if (fcio_stream_debug(x->ptmio))
+      fprintf(stderr, "FCIO/fcio_reserve_view/ERROR: can not allocate %zu bytes of payload storage\n", size);
+    return -1;
+  }
+  return 0;
+}
+
+static inline int fcio_get_event_view(FCIOData *x, FCIORecordView *view)
+{
+  FCIOStream stream = x->ptmio;
+  fcio_config *config = &x->config;
+  fcio_event *event = &x->event;
+
+  const int num_expected_traces = config->adcs + config->triggers;
+  if (num_expected_traces < 0 || num_expected_traces > FCIOMaxChannels)
+    return -1;
+
+  const int length = config->eventsamples + 2;
+  const int payload_size = num_expected_traces * length * (int)sizeof(unsigned short);
+
+  fcio_next_generation(event);
+  FCIOReadInt(stream,event->type);
+  FCIOReadFloat(stream,event->pulser);
+  event->timeoffset_size = FCIOReadInts(stream,10,event->timeoffset)/sizeof(int);
+  event->timestamp_size = FCIOReadInts(stream,10,event->timestamp)/sizeof(int);
+  const void *payload = NULL;
+  int frame_size = payload_size;
+  if (fcio_read_views(stream, 1, payload_size, &payload) < 0) {
+    if (fcio_reserve_view(x, payload_size) < 0)
+      return -1;
+    frame_size = FCIOReadUShorts(stream,num_expected_traces*length,x->view_traces);
+    payload = x->view_traces;
+  }
+  event->deadregion_size = FCIOReadInts(stream,10,event->deadregion)/sizeof(int);
+  if (event->num_traces != num_expected_traces) {
+    event->num_traces = num_expected_traces;
+    for (int i = 0; i < num_expected_traces; i++)
+      event->trace_list[i] = i;
+  }
+  event->deadregion[5] = 0;
+  event->deadregion[6] = num_expected_traces;
+
+  const int nread = frame_size > 0 ? frame_size / (int)sizeof(unsigned short) / length : 0;
+  view->num_traces = nread < num_expected_traces ? nread : num_expected_traces;
+  view->traces = (const unsigned short *)payload;
+  view->trace_stride = length;
+  return 0;
+}
+
+static inline int fcio_get_sparseevent_view(FCIOData *x, FCIORecordView *view)
+{
+  FCIOStream stream = x->ptmio;
+  fcio_event *event = &x->event;
+
+  const int tracesamples = x->config.eventsamples + 2;
+  if (tracesamples < 0 || tracesamples > FCIOMaxSamples+2)
+    return -1;
+
+  fcio_next_generation(event);
+  FCIOReadInt(stream,event->type);
+  FCIOReadFloat(stream,event->pulser);
+  event->timeoffset_size = FCIOReadInts(stream,10,event->timeoffset)/sizeof(int);
+  event->timestamp_size = FCIOReadInts(stream,10,event->timestamp)/sizeof(int);
+  event->deadregion_size = FCIOReadInts(stream,10,event->deadregion)/sizeof(int);
+
+  FCIOReadInts(stream,1,&event->num_traces);
+  int read_trace_list_size = FCIOReadUShorts(stream, FCIOMaxChannels, event->trace_list)/sizeof(unsigned short);
+  if (read_trace_list_size != event->num_traces) {
+    if (fcio_stream_debug(x->ptmio) > 1) fprintf(stderr, "FCIO/fcio_get_sparseevent_view/WARNING: trace_list size does not match %d/%d\n", read_trace_list_size, event->num_traces);
+    if (read_trace_list_size < event->num_traces)
+      event->num_traces = read_trace_list_size;
+  }
+  if (event->num_traces < 0 || event->num_traces > FCIOMaxChannels)
+    return -1;
+
+  // the traces are sent as one frame each, mapped files provide them in place
+  // separated by the frame headers, otherwise they are collected in trace_list order
+  const void *payload = NULL;
+  const int frame_size = tracesamples * (int)sizeof(unsigned short);
+  if (fcio_read_views(stream, event->num_traces, frame_size, &payload) == 0) {
+    view->trace_stride = tracesamples + (int)(sizeof(int) / sizeof(unsigned short));
+  } else {
+    if (fcio_reserve_view(x, (size_t)event->num_traces * frame_size) < 0)
+      return -1;
+    for (int i = 0; i < event->num_traces; i++)
+      FCIOReadUShorts(stream,tracesamples,&x->view_traces[(size_t)i * tracesamples]);
+    payload = x->view_traces;
+    view->trace_stride = tracesamples;
+  }
+
+  view->num_traces = event->num_traces;
+  view->traces = (const unsigned short *)payload;
+  return 0;
+}
+
+// decodes the items of a record with tag into x, returns <0 on error
+static int fcio_get_record(FCIOData *x, int tag)
+{
+  FCIOStream xio=x->ptmio;
+
+  // Events preceding the first config still need a valid trace storage
+  if (!x->event.traces && (tag == FCIOEvent || tag == FCIOSparseEvent || tag == FCIOEventHeader)
+    && fcio_alloc_traces(&x->event, &x->config, x->alloc_flags) < 0)
+    return -1;
+
+  int rc = 0;
+  switch (tag) {
+    case FCIOConfig:
+      rc = fcio_get_config(xio, &x->config);
+
+      // On config, the storage is (re)allocated and the pointers can be set.
+      if (rc >= 0 && FCIOAllocBuffers(x) < 0)
+        rc = -1;
+    break;
+
+    case FCIOEvent:
+      rc = fcio_get_event(xio, &x->config, &x->event, x->decode_flags, x->channel_masked ? x->channel_mask : NULL);
+    break;
+
+    case FCIOSparseEvent:
+      rc = fcio_get_sparseevent(xio, &x->config, &x->event, x->decode_flags, x->channel_masked ? x->channel_mask : NULL);
+    break;
+
+    case FCIORecEvent:
+      rc = fcio_get_recevent(xio, &x->recevent, x->alloc_flags);
+    break;
+
+    case FCIOStatus:
+      rc = fcio_get_status(xio, &x->status);
+    break;
+
+    case FCIOEventHeader:
+      rc = fcio_get_eventheader(xio, &x->config, &x->event);
+    break;
+  }
+
+  return rc;
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIOGetRecord(FCIOData* x)
+
+/*--- Description ------------------------------------------------//
+
+Reads a record of data from remote peer or file.
+A record consist of a message tag and all data items stored under
+this tag.
+
+valid record tags are described above
+
+Returns the tag (>0) on success or 0 on timeout and <0 on error.
+
+If a the data items are copied to the corresponding data structure
+FCIOData *x. You can access all items directly by the x pointer
+e.g.: x->config.adcs yields the number of adcs of camera.
+
+note: the structure is not complete up to now and will be extended by
+further items.
+
+//----------------------------------------------------------------*/
+{
+  if (!x)
+    return -1;
+
+  FCIOStream xio=x->ptmio;
+  for (;;) {
+    int tag = FCIOReadMessage(xio);
+    if (fcio_stream_debug(x->ptmio) > 4) fprintf(stderr,"FCIOGetRecord: got tag %d \n",tag);
+    if (tag <= 0)
+      return tag;
+
+    // get implementations return status >0 on inconsistency and
+    // are expected to emit their own warning messages.
+    // we fail only on error, or continue at the next sync marker in recovery mode.
+    if (fcio_get_record(x, tag) >= 0)
+      return tag;
+    if (fcio_recover(xio) < 0)
+      return -1;
+  }
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIOGetRecordView(FCIOData *x, FCIORecordView *view)
+
+/*--- Description ------------------------------------------------//
+
+Reads a record like FCIOGetRecord, but leaves the trace payload of
+FCIOEvent and FCIOSparseEvent records in a packed buffer described
+by view instead of copying it to x->event.traces. All other items
+are decoded to x as usual.
+
+The trace with index view->trace_list[i] starts at
+view->traces[i * view->trace_stride] with its two header words.
+The payload stays valid until the next read from x. For streams
+connected with mmap:// it points into the mapped file and is not
+copied at all.
+For records without trace payload view->num_traces is 0 and
+view->traces is NULL.
+
+Use this for consumers which only scan or forward traces. The
+traces in x->event are not updated and not reported valid by
+FCIOTraceValid for records read this way.
+
+Returns the tag (>0) on success or 0 on timeout and <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!x || !view)
+    return -1;
+
+  FCIOStream xio=x->ptmio;
+  int tag = FCIOReadMessage(xio);
+  if (fcio_stream_debug(x->ptmio) > 4) fprintf(stderr,"FCIOGetRecordView: got tag %d \n",tag);
+
+  view->tag = tag;
+  view->num_traces = 0;
+  view->trace_stride = 0;
+  view->trace_list = x->event.trace_list;
+  view->traces = NULL;
+  if (tag <= 0)
+    return tag;
+
+  int rc = 0;
+  switch (tag) {
+    case FCIOEvent:
+      rc = fcio_get_event_view(x, view);
+    break;
+
+    case FCIOSparseEvent:
+      rc = fcio_get_sparseevent_view(x, view);
+    break;
+
+    default:
+      rc = fcio_get_record(x, tag);
+    break;
+  }
+  view->trace_length = x->config.eventsamples + 2;
+  if (!view->trace_stride)
+    view->trace_stride = view->trace_length;
+
+  if (rc < 0)
+    return -1;
+
+  return tag;
+}
+
+/*=== Function ===================================================*/
+
+int FCIOTraceValid(const fcio_event *event, int trace_idx)
+
+/*--- Description ------------------------------------------------//
+
+Returns 1 if trace[trace_idx] holds samples of the event record
+last read into event, 0 otherwise.
+
+Traces not contained in an FCIOSparseEvent keep the samples of an
+earlier record, an FCIOEventHeader only updates the trace headers.
+The check uses the generation counter of the event and does not
+require clearing the trace buffers.
+
+//----------------------------------------------------------------*/
+{
+  if (!event || trace_idx < 0 || trace_idx >= FCIOMaxChannels)
+    return 0;
+
+  return event->generation && event->trace_generation[trace_idx] == event->generation;
+}
+
+/*=== Function ===================================================*/
+
+int FCIONextValidTrace(const fcio_event *event, int *cursor)
+
+/*--- Description ------------------------------------------------//
+
+Iterates over the traces holding samples of the event record last
+read into event, in trace_list order.
+Start with *cursor = 0, each call advances *cursor.
+
+Returns the next valid trace index or -1 if there are no more
+valid traces, e.g.:
+
+  int cursor = 0, trace_idx;
+  while ((trace_idx = FCIONextValidTrace(&io->event, &cursor)) >= 0)
+    process(io->event.trace[trace_idx]);
+
+//----------------------------------------------------------------*/
+{
+  if (!event || !cursor)
+    return -1;
+
+  while (*cursor >= 0 && *cursor < event->num_traces && *cursor < FCIOMaxChannels) {
+    int trace_idx = event->trace_list[(*cursor)++];
+    if (FCIOTraceValid(event, trace_idx))
+      return trace_idx;
+  }
+  return -1;
+}
+
+
+
+/*=== Example reading a data with Structured I/O ==================//
+
+// only a few items are accessed by this example
+
+char *fcio="datafile";
+fprintf(stderr,"plot FC250b events FCIO format %s\n",fcio);
+int iotag;
+
+FCIODebug(debug);
+FCIOData *x=FCIOOpen(fcio,10000,0);
+if(!x) exit(1);
+
+while((iotag=FCIOGetRecord(x))>0)
+{
+  int i;
+  switch(iotag)
+  {
+    case FCIOConfig:  // a config record
+    // do something here
+    break;
+
+    case FCIOStatus:  // a status record
+    // do something here
+    break;
+
+    case FCIOEvent:   // event record
+    // show some info
+    fprintf(stderr,"  adc       bl    isum-bl    tsum-bl   max-bl   pos\n");
+    for(i=0;i<x->config.adcs;i++)
+    {
+      // calculate baseline, integrator and trace integral
+      double bl=1.0*x->event.theader[i][0]/x->config.blprecision;
+      double intsum=1.0*x->config.sumlength/x->config.blprecision*
+         (x->event.theader[i][1]-x->event.theader[i][0]);
+      double max=0; int imax=0; double tsum=0; int i1;
+      for(i1=0;i1<x->config.eventsamples;i1++)
+      {
+        double amp=x->event.trace[i][i1]-bl;
+        if(amp>max) max=amp, imax=i1;
+        tsum+=amp;
+      }
+      if(max>0) fprintf(stderr,"%5d %8.2f %10g %10.2f %8.2f %5d\n",
+         i,bl,intsum,tsum,max,imax);
+    }
+    break;
+
+    case FCIOSparseEvent:  // sparse event record, also compatible with FCIOEvent
+    for (j = 0; j < x->event.num_traces; j++)
+    {
+      i = x->event.trace_list[j];
+      double bl=1.0*x->event.theader[i][0]/x->config.blprecision;
+      double intsum=1.0*x->config.sumlength/x->config.blprecision*
+         (x->event.theader[i][1]-x->event.theader[i][0]);
+      double max=0; int imax=0; double tsum=0; int i1;
+      for(i1=0;i1<x->config.eventsamples;i1++)
+      {
+        double amp=x->event.trace[i][i1]-bl;
+        if(amp>max) max=amp, imax=i1;
+        tsum+=amp;
+      }
+      if(max>0) fprintf(stderr,"%5d %8.2f %10g %10.2f %8.2f %5d\n",
+         i,bl,intsum,tsum,max,imax);
+    }
+
+    case FCIORecEvent:  // reconstructed event record
+    // do something here
+    break;
+
+    default:
+    fprintf(stderr,"record tag %d... skipped \n",iotag);
+    break;
+  }
+}
+
+fprintf(stderr,"end of file \n");
+FCIOClose(x);
+
+
+//----------------------------------------------------------------*/
+
+
+
+/*=== FCIO Low Level I/O functions ================================//
+
+Functions for composing and transferring messages within the FCIO
+stream based I/O system.
+
+Please refer to the first part FCIO Structured I/O
+if you are reading FlashCam data only and skip the rest of this document
+
+//----------------------------------------------------------------*/
+
+
+/*--- Streams ----------------------------------------------------//
+
+An FCIOStream refers to an fcio_stream, which either wraps a tmio
+stream, a read-only memory mapping of an FCIO file (mmap://) or a
+file descriptor written with writev (writev://) or io_uring (uring://).
+
+The mapping is parsed in place with the tmio frame layout: after
+the protocol frame (a frame header followed by TMIO_PROTOCOL_SIZE
+bytes) each frame starts with an int, negative values are the
+negated tag of a record, positive values the number of data bytes
+following the frame header.
+This layout is not part of the tmio API, the mapped reader relies
+on the frame format of the tmio version FCIO is built with and has
+to follow changes of it (see FCIOMapProtocolSize and
+fcio_map_header).
+
+The writev backend lets tmio create the file and write the protocol
+frame, then appends frames in the same layout. Single items are
+collected in a buffer, FCIOWriteFrames emits the buffer and all
+frames of a record with one writev call without copying.
+
+//----------------------------------------------------------------*/
+
+typedef struct fcio_uring fcio_uring;
+typedef struct fcio_async fcio_async;
+
+typedef struct fcio_stream {
+  tmio_stream *tmio;    // tmio stream, NULL for mapped files and writev
+  int debug;            // debug level, see FCIOSetStreamDebug
+  size_t marks[3];      // byte counts of the last FCIOByteCountDelta per direction
+
+  const char *map;      // start of the mapped file
+  size_t map_size;      // size of the mapping in bytes
+  size_t pos;           // offset of the next frame header
+  size_t bytesread;     // bytes of read frames incl. frame headers
+  size_t bytesskipped;  // bytes of skipped frames incl. frame headers
+  int timeout;          // stored for FCIOTimeout only, mapped files never block
+  int writable;         // connected with direction 'w'
+
+  int fd;               // file descriptor of the writev backend, -1 otherwise
+  char *wbuf;           // pending frames written by FCIOWriteMessage/FCIOWrite
+  size_t wbuf_size;
+  size_t wbuf_len;
+  struct iovec *iov;    // scratch space of FCIOWriteFrames
+  int *headers;
+  int max_frames;
+  size_t byteswritten;  // bytes written incl. the protocol frame
+  fcio_uring *uring;    // asynchronous writes of the uring backend, NULL otherwise
+  fcio_async *async;    // writer thread, see FCIOSetAsyncWriter, NULL otherwise
+
+  FILE *index;          // sidecar index, see FCIOSetIndexFile
+  FCIOIndexEntry hint;  // event number and time of the next record written
+  int configs;          // FCIOConfig records read or written so far
+  FCIOIndexEntry *entries;  // index loaded by FCIOLoadIndex or collected for the trailer
+  int nentries;
+  int ascending;            // bit 1 << FCIOSeekEvent/FCIOSeekTime set if the loaded index is sorted by it
+  int max_entries;
+  int trailer;              // append an FCIOTrailer on FCIODisconnect
+
+  int sync_interval;        // records between FCIOSync records, see FCIOSetSyncInterval
+  int sync_pending;         // records written since the last FCIOSync record
+  FCIOSyncMarker sync;      // stream state announced by the next FCIOSync record
+  int recover;              // resynchronize at FCIOSync records on damaged frames, see FCIOSetRecovery
+  int need_config;          // skip records up to the next FCIOConfig after a resynchronization
+
+  char *path;               // file name of readers of files, NULL otherwise
+  char *wpath;              // file name of writers of files, stamps the sidecar index
+  int advice_fd;            // descriptor for posix_fadvise, see FCIOSetReadahead
+  size_t readahead;         // bytes advised ahead of the read position, 0 if disabled
+  int drop_behind;          // drop consumed ranges from the page cache
+  size_t advised;           // end of the range advised with POSIX_FADV_WILLNEED
+  size_t dropped;           // end of the range dropped behind the read position
+
+  void *scratch;            // staging space of the record writers, see fcio_stream_scratch
+  size_t scratch_size;
+} fcio_stream;
+
+// returns staging space of at least size bytes owned by the stream, valid up to the next call,
+// never NULL for size 0 as frames of empty lists still need valid data
+static void *fcio_stream_scratch(FCIOStream stream, size_t size)
+{
+  fcio_stream *x = (fcio_stream *)stream;
+  if (size > x->scratch_size || !x->scratch) {
+    void *scratch = realloc(x->scratch, size ? size : 1);
+    if (!scratch) {
+      if (fcio_stream_debug(x)) fprintf(stderr, "fcio_stream_scratch/ERROR: can not allocate %zu bytes\n", size);
+      return NULL;
+    }
+    x->scratch = scratch;
+    x->scratch_size = size;
+  }
+  return x->scratch;
+}
+
+static int fcio_write_trailer(fcio_stream *x);
+static size_t fcio_index_covered(fcio_stream *x);
+static int fcio_index_close(fcio_stream *x, size_t covered);
+static int fcio_map_resync(fcio_stream *x, size_t from);
+
+// debug level of a stream, the library default for NULL
+static inline int fcio_stream_debug(const void *x)
+{
+  return x ? __atomic_load_n(&((const fcio_stream *)x)->debug, __ATOMIC_RELAXED) : fcio_debug();
+}
+
+static int fcio_async_caller(const fcio_stream *x);
+static FCIOIndexEntry *fcio_async_hint(fcio_stream *x);
+static size_t fcio_async_accepted(fcio_stream *x);
+static int fcio_async_write(fcio_stream *x, int tag, const void *data, size_t size);
+static void fcio_async_commit(fcio_stream *x);
+static int fcio_async_stop(fcio_stream *x);
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// assumes the tmio file layout: an int frame header and the protocol string before the first record
+#define FCIOMapProtocolSize (sizeof(int) + TMIO_PROTOCOL_SIZE)
+
+// tags above are treated as damaged frames by streams in recovery mode
+#define FCIOMapMaxTag 31
+
+// granularity of the ranges dropped from the page cache, see FCIOSetReadahead
+#define FCIOAdviceStep ((size_t)1 << 20)
+
+static fcio_stream *fcio_map_open(const char *filename, const char *proto)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  fcio_stream *x = NULL;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= FCIOMapProtocolSize
+    && (x = (fcio_stream *)calloc(1, sizeof(fcio_stream)))) {
+    x->fd = -1;
+    x->debug = fcio_debug();
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED) {
+      x->map = (const char *)map;
+      x->map_size = st.st_size;
+    } else {
+      free(x);
+      x = NULL;
+    }
+  }
+  close(fd);  // the mapping keeps the file referenced
+  if (!x)
+    return NULL;
+
+  if (fcio_debug() > 1 && strncmp(x->map + sizeof(int), proto, strlen(proto)))
+    fprintf(stderr, "FCIOConnect/WARNING: %s does not start with protocol %s\n", filename, proto);
+
+  x->pos = FCIOMapProtocolSize;
+  x->bytesread = FCIOMapProtocolSize;
+  return x;
+}
+
+static fcio_stream *fcio_writev_create(const char *filename, const char *proto, int timeout, int buffer)
+{
+  // tmio creates the file and writes the protocol frame, all further frames are appended
+  tmio_stream *tmio = tmio_init(proto, timeout, buffer, 0);
+  if (!tmio)
+    return NULL;
+  int rc = tmio_create(tmio, filename, timeout);
+  if (rc >= 0)
+    rc = tmio_flush(tmio);
+  size_t protocol_size = tmio->byteswritten;
+  tmio_delete(tmio);
+  if (rc < 0)
+    return NULL;
+
+  fcio_stream *x = (fcio_stream *)calloc(1, sizeof(fcio_stream));
+  if (!x)
+    return NULL;
+  x->debug = fcio_debug();
+  x->wbuf_size = (buffer > 0 ? (size_t)buffer : 256) * 1024;
+  x->wbuf = (char *)malloc(x->wbuf_size);
+  x->fd = x->wbuf ? open(filename, O_WRONLY | O_APPEND) : -1;
+  if (x->fd < 0) {
+    free(x->wbuf);
+    free(x);
+    return NULL;
+  }
+  x->byteswritten = protocol_size;
+  x->timeout = timeout;
+  x->writable = 1;
+  return x;
+}
+
+// writes all iovecs, continuing after partial writes, returns 0 on success
+static int fcio_writev_all(int fd, struct iovec *iov, int niov)
+{
+  while (niov > 0) {
+    ssize_t written = writev(fd, iov, niov < IOV_MAX ? niov : IOV_MAX);
+    if (written < 0)
+      return -1;
+    while (niov > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      niov--;
+    }
+    if (niov > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 0;
+}
+
+/*--- io_uring and O_DIRECT backends -----------------------------//
+
+Streams connected with uring:// are writev streams whose pending
+frames are collected in one of depth buffers registered with an
+io_uring instance. A full buffer (or FCIOFlush) is submitted as an
+asynchronous write at the next file offset and the writer continues
+with the next buffer, it only waits if all buffers are in flight.
+A failed write is reported by the following calls, FCIODisconnect
+waits for all writes and fails if any of them (or the truncation of
+a direct:// file) failed. Frames are copied, so all writes but the
+last cover a full buffer.
+
+Streams connected with direct:// use the same buffers (two by
+default) on a file opened with O_DIRECT, bypassing the page cache.
+All writes start and end at FCIODirectAlignment boundaries: the
+protocol frame written by tmio is rewritten with the first buffer,
+FCIOFlush writes the pending frames with the unaligned tail padded
+by zeros to a full block and moves the tail to the next buffer, whose
+write starts at this block again (drained behind the previous writes
+to keep them in order). Until FCIODisconnect truncates the file to
+its size, the file ends with the padding of the last block. Without
+io_uring the buffers are written synchronously.
+
+The ring is set up with the raw system calls. Without io_uring
+support (kernel, seccomp filters) uring:// streams stay writev
+streams, without O_DIRECT support (e.g. tmpfs) direct:// streams
+use the page cache.
+
+//----------------------------------------------------------------*/
+
+#define FCIOUringDefaultDepth 8
+#define FCIODirectDefaultDepth 2
+#define FCIOUringMaxDepth 1024
+#define FCIODirectAlignment 4096
+
+#if defined(FCIO_HAVE_URING)
+
+struct fcio_uring {
+  int ring;                      // io_uring file descriptor, -1 for synchronous writes
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  void *cq_map;
+  size_t sq_map_size;
+  size_t cq_map_size;
+  size_t sqes_size;
+
+  int depth;                     // number of buffers
+  int fixed;                     // buffers are registered with the ring
+  int direct;                    // the file is opened with O_DIRECT, writes are aligned
+  int current;                   // buffer collecting the pending frames
+  int inflight;                  // submitted writes not completed yet
+  struct iovec *buffers;         // iov_len is the size of the submitted write
+  long long *offsets;            // file offset of the submitted write
+  char *busy;
+  long long offset;              // file offset of the next write
+  size_t tail;                   // unaligned bytes at offset already written padded by direct writes
+  int error;                     // errno of a failed write, reported by all following calls
+};
+
+static void fcio_uring_free(fcio_uring *u)
+{
+  if (u->sqes && u->sqes != MAP_FAILED)
+    munmap(u->sqes, u->sqes_size);
+  if (u->cq_map && u->cq_map != MAP_FAILED)
+    munmap(u->cq_map, u->cq_map_size);
+  if (u->sq_map && u->sq_map != MAP_FAILED)
+    munmap(u->sq_map, u->sq_map_size);
+  if (u->ring >= 0)
+    close(u->ring);
+  for (int i = 0; u->buffers && i < u->depth; i++)
+    free(u->buffers[i].iov_base);
+  free(u->buffers);
+  free(u->offsets);
+  free(u->busy);
+  free(u);
+}
+
+static int fcio_uring_setup(fcio_uring *u, int depth)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  u->ring = (int)syscall(__NR_io_uring_setup, depth, &params);
+  if (u->ring < 0) {
+    if (fcio_debug() > 3) fprintf(stderr, "FCIO/fcio_uring_setup/DEBUG: io_uring_setup failed, %s\n", strerror(errno));
+    return -1;
+  }
+
+  u->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  u->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  u->sq_map = mmap(NULL, u->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_SQ_RING);
+  u->cq_map = mmap(NULL, u->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_CQ_RING);
+  u->sqes = (struct io_uring_sqe *)mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_SQES);
+  if (u->sq_map == MAP_FAILED || u->cq_map == MAP_FAILED || u->sqes == MAP_FAILED) {
+    if (u->sqes != MAP_FAILED)
+      munmap(u->sqes, u->sqes_size);
+    if (u->cq_map != MAP_FAILED)
+      munmap(u->cq_map, u->cq_map_size);
+    if (u->sq_map != MAP_FAILED)
+      munmap(u->sq_map, u->sq_map_size);
+    u->sqes = NULL;
+    u->sq_map = u->cq_map = NULL;
+    close(u->ring);
+    u->ring = -1;
+    return -1;
+  }
+
+  char *sq = (char *)u->sq_map, *cq = (char *)u->cq_map;
+  u->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  u->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  u->sq_array = (unsigned *)(sq + params.sq_off.array);
+  u->cq_head = (unsigned *)(cq + params.cq_off.head);
+  u->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  u->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return 0;
+}
+
+/* Replaces the write buffer of the writev stream x by depth buffers written
+   with io_uring, and with O_DIRECT if direct is set. Returns 0 or -1, x is
+   unchanged in this case. */
+static int fcio_uring_attach(fcio_stream *x, const char *filename, int depth, int direct)
+{
+  fcio_uring *u = (fcio_uring *)calloc(1, sizeof(fcio_uring));
+  if (!u)
+    return -1;
+  u->ring = -1;
+  u->depth = depth;
+
+  // writes are placed by offset, which O_APPEND would override
+  int fd = direct ? open(filename, O_WRONLY | O_DIRECT) : -1;
+  u->direct = fd >= 0;
+  if (direct && fd < 0 && fcio_stream_debug(x) > 1)
+    fprintf(stderr, "FCIOConnect/WARNING: can not open %s with O_DIRECT, %s\n", filename, strerror(errno));
+  if (fd < 0)
+    fd = open(filename, O_WRONLY);
+  if (fd < 0 || (fcio_uring_setup(u, depth) < 0 && !u->direct)) {
+    if (fd >= 0)
+      close(fd);
+    fcio_uring_free(u);
+    return -1;
+  }
+
+  size_t buffer_size = x->wbuf_size;
+  if (u->direct)
+    buffer_size = (buffer_size + FCIODirectAlignment - 1) / FCIODirectAlignment * FCIODirectAlignment;
+  u->buffers = (struct iovec *)calloc(depth, sizeof(struct iovec));
+  u->offsets = (long long *)calloc(depth, sizeof(long long));
+  u->busy = (char *)calloc(depth, 1);
+  int ok = u->buffers && u->offsets && u->busy;
+  for (int i = 0; ok && i < depth; i++) {
+    ok = posix_memalign(&u->buffers[i].iov_base, FCIODirectAlignment, buffer_size) == 0;
+    u->buffers[i].iov_len = buffer_size;
+  }
+  // the first aligned write starts at offset 0 and repeats the protocol frame
+  size_t protocol_size = u->direct ? x->byteswritten : 0;
+  if (ok && protocol_size) {
+    int input = open(filename, O_RDONLY);
+    ok = input >= 0 && pread(input, u->buffers[0].iov_base, protocol_size, 0) == (ssize_t)protocol_size;
+    if (input >= 0)
+      close(input);
+  }
+  if (!ok) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIO/fcio_uring_attach/ERROR: can not set up %d buffers of %zu bytes\n", depth, buffer_size);
+    close(fd);
+    fcio_uring_free(u);
+    return -1;
+  }
+  // unregistered buffers (e.g. exceeding RLIMIT_MEMLOCK) are written with IORING_OP_WRITEV
+  if (u->ring >= 0)
+    u->fixed = syscall(__NR_io_uring_register, u->ring, IORING_REGISTER_BUFFERS, u->buffers, depth) == 0;
+
+  u->offset = x->byteswritten - protocol_size;
+  memcpy((char *)u->buffers[0].iov_base + protocol_size, x->wbuf, x->wbuf_len);
+  free(x->wbuf);
+  x->wbuf = (char *)u->buffers[0].iov_base;
+  x->wbuf_size = buffer_size;
+  x->wbuf_len += protocol_size;
+  x->byteswritten -= protocol_size;
+  close(x->fd);
+  x->fd = fd;
+  x->uring = u;
+  if (fcio_stream_debug(x) > 3) fprintf(stderr, "FCIO/fcio_uring_attach/DEBUG: %d buffers of %zu bytes, io_uring %d, registered %d, direct %d\n",
+    depth, buffer_size, u->ring >= 0, u->fixed, u->direct);
+  return 0;
+}
+
+// writes buffer i synchronously from byte done on
+static int fcio_uring_pwrite(fcio_stream *x, int i, size_t done)
+{
+  fcio_uring *u = x->uring;
+  while (!u->error && done < u->buffers[i].iov_len) {
+    ssize_t written = pwrite(x->fd, (char *)u->buffers[i].iov_base + done, u->buffers[i].iov_len - done, u->offsets[i] + done);
+    if (written <= 0) {
+      u->error = written < 0 ? errno : EIO;
+      if (fcio_stream_debug(x)) fprintf(stderr, "FCIO/fcio_uring_pwrite/ERROR: write at offset %lld failed, %s\n", u->offsets[i] + (long long)done, strerror(u->error));
+    } else {
+      done += written;
+    }
+  }
+  return u->error ? -1 : 0;
+}
+
+// processes the completed writes, short writes are completed synchronously
+static void fcio_uring_reap(fcio_stream *x)
+{
+  fcio_uring *u = x->uring;
+  if (u->ring < 0)
+    return;
+  unsigned head = *u->cq_head;
+  while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+    const struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+    int i = (int)cqe->user_data;
+    if (cqe->res < 0) {
+      u->error = -cqe->res;
+      if (fcio_stream_debug(x)) fprintf(stderr, "FCIO/fcio_uring_reap/ERROR: write at offset %lld failed, %s\n", u->offsets[i], strerror(u->error));
+    } else {
+      fcio_uring_pwrite(x, i, cqe->res);
+    }
+    u->busy[i] = 0;
+    u->inflight--;
+    head++;
+  }
+  __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// waits until the current buffer is available, or for all writes
+static int fcio_uring_wait(fcio_stream *x, int all)
+{
+  fcio_uring *u = x->uring;
+  fcio_uring_reap(x);
+  while (u->inflight && (all || u->busy[u->current])) {
+    if (syscall(__NR_io_uring_enter, u->ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+      u->error = errno;
+      return -1;
+    }
+    fcio_uring_reap(x);
+  }
+  return u->error ? -1 : 0;
+}
+
+// submits the pending frames, aligned for O_DIRECT, and continues with the next buffer
+static int fcio_uring_submit(fcio_stream *x)
+{
+  fcio_uring *u = x->uring;
+  if (u->error)
+    return -1;
+  if (x->wbuf_len == u->tail)
+    return 0;
+
+  // a direct write includes the tail padded to a full block, which the next write covers again
+  size_t size = x->wbuf_len, advance = x->wbuf_len;
+  if (u->direct) {
+    advance -= size % FCIODirectAlignment;
+    size = (size + FCIODirectAlignment - 1) / FCIODirectAlignment * FCIODirectAlignment;
+    memset(x->wbuf + x->wbuf_len, 0, size - x->wbuf_len);
+  }
+
+  int i = u->current;
+  u->buffers[i].iov_len = size;
+  u->offsets[i] = u->offset;
+  if (u->ring < 0) {
+    if (fcio_uring_pwrite(x, i, 0) < 0)
+      return -1;
+  } else {
+    unsigned tail = *u->sq_tail;
+    unsigned slot = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = x->fd;
+    sqe->off = u->offset;
+    sqe->user_data = i;
+    if (u->tail)
+      sqe->flags = IOSQE_IO_DRAIN;
+    if (u->fixed) {
+      sqe->opcode = IORING_OP_WRITE_FIXED;
+      sqe->addr = (uintptr_t)u->buffers[i].iov_base;
+      sqe->len = size;
+      sqe->buf_index = i;
+    } else {
+      sqe->opcode = IORING_OP_WRITEV;
+      sqe->addr = (uintptr_t)&u->buffers[i];
+      sqe->len = 1;
+    }
+    u->sq_array[slot] = slot;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (syscall(__NR_io_uring_enter, u->ring, 1, 0, 0, NULL, 0) < 0) {
+      u->error = errno;
+      if (fcio_stream_debug(x)) fprintf(stderr, "FCIO/fcio_uring_submit/ERROR: submitting %zu bytes failed, %s\n", size, strerror(errno));
+      return -1;
+    }
+    u->busy[i] = 1;
+    u->inflight++;
+  }
+  u->offset += advance;
+  x->byteswritten += advance;
+
+  // the unaligned tail of a direct write is moved to the next buffer
+  u->current = (i + 1) % u->depth;
+  if (fcio_uring_wait(x, 0) < 0)
+    return -1;
+  x->wbuf = (char *)u->buffers[u->current].iov_base;
+  memmove(x->wbuf, (char *)u->buffers[i].iov_base + advance, x->wbuf_len - advance);
+  x->wbuf_len -= advance;
+  u->tail = x->wbuf_len;
+  return 0;
+}
+
+// appends bytes to the pending frames, submitting full buffers
+static int fcio_uring_copy(fcio_stream *x, const void *data, size_t size)
+{
+  const char *bytes = (const char *)data;
+  while (size) {
+    size_t n = x->wbuf_size - x->wbuf_len < size ? x->wbuf_size - x->wbuf_len : size;
+    memcpy(x->wbuf + x->wbuf_len, bytes, n);
+    x->wbuf_len += n;
+    bytes += n;
+    size -= n;
+    if (x->wbuf_len == x->wbuf_size && fcio_uring_submit(x) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* Waits for all writes and releases the buffers, including the write
+   buffer of x. The last direct write is padded to the alignment, the
+   file is truncated to the written size afterwards. */
+static int fcio_uring_close(fcio_stream *x)
+{
+  fcio_uring *u = x->uring;
+  int rc = fcio_uring_submit(x);
+  if (fcio_uring_wait(x, 1) < 0)
+    rc = -1;
+  if (u->direct && !u->error) {
+    if (ftruncate(x->fd, u->offset + x->wbuf_len) < 0)
+      rc = -1;
+    x->byteswritten += x->wbuf_len;
+    x->wbuf_len = 0;
+  }
+  fcio_uring_free(u);
+  x->uring = NULL;
+  x->wbuf = NULL;
+  return rc;
+}
+
+#else
+
+struct fcio_uring {
+  int unused;
+};
+
+static int fcio_uring_attach(fcio_stream *x, const char *filename, int depth, int direct)
+{
+  (void)x; (void)filename; (void)depth; (void)direct;
+  return -1;
+}
+
+static int fcio_uring_submit(fcio_stream *x) { (void)x; return -1; }
+static int fcio_uring_copy(fcio_stream *x, const void *data, size_t size) { (void)x; (void)data; (void)size; return -1; }
+static int fcio_uring_close(fcio_stream *x) { (void)x; return -1; }
+
+#endif
+
+static int fcio_writev_flush(fcio_stream *x)
+{
+  if (x->uring)
+    return fcio_uring_submit(x);
+  if (!x->wbuf_len)
+    return 0;
+
+  struct iovec iov = { x->wbuf, x->wbuf_len };
+  int rc = fcio_writev_all(x->fd, &iov, 1);
+  x->byteswritten += x->wbuf_len;
+  x->wbuf_len = 0;
+  return rc;
+}
+
+// appends a frame header and optionally its payload to the pending buffer
+static int fcio_writev_append(fcio_stream *x, int header, const void *data, size_t size)
+{
+  if (x->uring)
+    return (fcio_uring_copy(x, &header, sizeof(int)) < 0 || fcio_uring_copy(x, data, size) < 0) ? -1 : 0;
+  if (x->wbuf_len + sizeof(int) + size > x->wbuf_size) {
+    if (fcio_writev_flush(x) < 0)
+      return -1;
+    if (sizeof(int) + size > x->wbuf_size) {
+      struct iovec iov[2] = { { &header, sizeof(int) }, { (void *)data, size } };
+      if (fcio_writev_all(x->fd, iov, 2) < 0)
+        return -1;
+      x->byteswritten += sizeof(int) + size;
+      return 0;
+    }
+  }
+  memcpy(x->wbuf + x->wbuf_len, &header, sizeof(int));
+  if (size)
+    memcpy(x->wbuf + x->wbuf_len + sizeof(int), data, size);
+  x->wbuf_len += sizeof(int) + size;
+  return 0;
+}
+
+static inline int fcio_map_header(const fcio_stream *x, size_t pos, int *header)
+{
+  if (pos > x->map_size || x->map_size - pos < sizeof(int))
+    return 0;
+
+  memcpy(header, x->map + pos, sizeof(int));
+  return 1;
+}
+
+// returns the next tag, skipping unread data frames of the previous record, or 0 at the end of the file
+static int fcio_map_read_tag(fcio_stream *x)
+{
+  int header;
+  while (fcio_map_header(x, x->pos, &header)) {
+    if (header < 0 && (!x->recover || header >= -FCIOMapMaxTag)) {
+      x->pos += sizeof(int);
+      if (x->need_config && header != -FCIOConfig) {
+        x->bytesskipped += sizeof(int);
+        continue;
+      }
+      x->need_config = 0;
+      x->bytesread += sizeof(int);
+      return -header;
+    }
+    if (header < 0 || (size_t)header > x->map_size - x->pos - sizeof(int)) {
+      if (x->recover && fcio_map_resync(x, x->pos + 1) == 0)
+        continue;
+      if (fcio_stream_debug(x) > 1)
+        fprintf(stderr, "FCIOReadMessage/WARNING: truncated frame at offset %zu\n", x->pos);
+      x->pos = x->map_size;
+      break;
+    }
+    x->pos += sizeof(int) + header;
+    x->bytesskipped += sizeof(int) + header;
+  }
+  return 0;
+}
+
+// consumes the next data frame and returns its payload, -2 if the next frame is a tag
+static int fcio_map_read_frame(fcio_stream *x, const char **payload)
+{
+  int header;
+  if (!fcio_map_header(x, x->pos, &header))
+    return -1;
+  if (header < 0)
+    return -2;  // the tag is left for the next FCIOReadMessage
+  if ((size_t)header > x->map_size - x->pos - sizeof(int)) {
+    if (!x->recover)
+      x->pos = x->map_size;  // otherwise the next FCIOReadMessage resynchronizes
+    return -1;
+  }
+
+  *payload = x->map + x->pos + sizeof(int);
+  x->pos += sizeof(int) + header;
+  x->bytesread += sizeof(int) + header;
+  return header;
+}
+
+// returns the payload of the next nframes data frames of frame_size bytes each, which are
+// spaced by a frame header, without copying; -1 if the stream does not provide views or
+// the frames do not match, nothing is consumed in this case
+static int fcio_read_views(FCIOStream stream, int nframes, int frame_size, const void **payload)
+{
+  fcio_stream *x = (fcio_stream *)stream;
+  if (!x || x->tmio || nframes < 1 || frame_size < 0)
+    return -1;
+
+  size_t pos = x->pos;
+  for (int i = 0; i < nframes; i++, pos += sizeof(int) + frame_size) {
+    int header;
+    if (!fcio_map_header(x, pos, &header) || header != frame_size
+      || (size_t)frame_size > x->map_size - pos - sizeof(int))
+      return -1;
+  }
+  const char *first = x->map + x->pos + sizeof(int);
+  if ((size_t)first % sizeof(unsigned short))
+    return -1;
+
+  *payload = first;
+  x->bytesread += pos - x->pos;
+  x->pos = pos;
+  return 0;
+}
+
+
+/*=== Function ===================================================*/
+
+FCIOStream FCIOConnect(const char *name, int direction, int timeout, int buffer)
+
+/*--- Description ------------------------------------------------//
+
+Connects to a file, server or client for FCIO data transfer.
+
+name is the connection endpoint of the underlying TMIO/BUFIO
+library. Please refer to the documentation of TMIO/BUFIO for
+more information.
+
+Creates a connection or file, with name being a plain file name, "-" for
+stdout, or
+
+tcp://listen/port           to listen to port at all interfaces
+tcp://listen/port/nodename  to listen to port at nodename interface
+tcp://connect/port/nodename to connect to port and nodename
+mmap://filename             to map a file for reading (direction 'r' only),
+                            records are parsed in place without buffered
+                            reads, and FCIOSeekOffset allows random access
+writev://filename           to write a file (direction 'w' only) with one
+                            writev call per record and without copying
+                            trace payloads (see FCIOWriteFrames)
+uring://filename[?depth=n]  to write a file (direction 'w' only) with
+                            asynchronous io_uring writes of up to n
+                            buffers (default 8) of buffer kB each, if
+                            io_uring is not available like writev://
+direct://filename[?depth=n] to write a file (direction 'w' only) like
+                            uring:// with O_DIRECT, bypassing the page
+                            cache, n defaults to 2 (double buffering),
+                            until FCIODisconnect the file ends with the
+                            zero padding of the last flushed block
+
+Any other name not starting with tcp: is treated as a file name.
+
+direction must be an character 'r' or 'w' to specify the direction
+of read and write,
+
+timeout specifies the time to wait for a connection in milliseconds.
+Specify 0 to return immediately (within the typical delays imposed by the
+connection and OS) or -1 to block indefinitely.
+
+buffer may be used to initialize the size (in kB) of the protocol buffers. If 0
+is specified a default value will be used.
+
+Returns a FCIOStream or NULL on error.
+
+//----------------------------------------------------------------*/
+{
+  const char *proto="FlashCamV1";
+  if(name==0) {
+    if(fcio_debug()) fprintf(stderr,"FCIOConnect/ERROR: endpoint not given, output will be discarded \n");
+    return NULL;
+  }
+
+  if(strncmp(name,"mmap://",7)==0) {
+    fcio_stream *x = (direction=='r') ? fcio_map_open(name+7, proto) : NULL;
+    if(x==0) {
+      if(fcio_debug()) fprintf(stderr,"FCIOConnect/ERROR: can not map %s for reading\n",name);
+      return NULL;
+    }
+    x->timeout = timeout;
+    x->path = strdup(name+7);
+    if(fcio_debug()>3) fprintf(stderr,"FCIOConnect/DEBUG: %s mapped, %zu bytes\n",name,x->map_size);
+    return (FCIOStream)x;
+  }
+
+  int direct = strncmp(name,"direct://",9)==0;
+  if(direct || strncmp(name,"uring://",8)==0) {
+    const char *path = name + (direct ? 9 : 8);
+    const char *query = strstr(path, "?depth=");
+    const int default_depth = direct ? FCIODirectDefaultDepth : FCIOUringDefaultDepth;
+    int depth = query ? atoi(query+7) : default_depth;
+    if (depth < 1 || depth > FCIOUringMaxDepth)
+      depth = default_depth;
+    char *filename = query ? strndup(path, query-path) : strdup(path);
+    fcio_stream *x = (filename && direction=='w') ? fcio_writev_create(filename, proto, timeout, buffer) : NULL;
+    if (x && fcio_uring_attach(x, filename, depth, direct) < 0 && fcio_debug() > 1)
+      fprintf(stderr,"FCIOConnect/WARNING: io_uring not available, writing %s with writev\n",filename);
+    if (x)
+      x->wpath = filename;
+    else
+      free(filename);
+    if(x==0) {
+      if(fcio_debug()) fprintf(stderr,"FCIOConnect/ERROR: can not create %s for writing\n",name);
+      return NULL;
+    }
+    if(fcio_debug()>3) fprintf(stderr,"FCIOConnect/DEBUG: %s connected, proto %s, %d buffers\n",name,proto,x->uring?depth:0);
+    return (FCIOStream)x;
+  }
+
+  if(strncmp(name,"writev://",9)==0) {
+    fcio_stream *x = (direction=='w') ? fcio_writev_create(name+9, proto, timeout, buffer) : NULL;
+    if(x==0) {
+      if(fcio_debug()) fprintf(stderr,"FCIOConnect/ERROR: can not create %s for writing\n",name);
+      return NULL;
+    }
+    x->wpath = strdup(name+9);
+    if(fcio_debug()>3) fprintf(stderr,"FCIOConnect/DEBUG: %s connected, proto %s \n",name,proto);
+    return (FCIOStream)x;
+  }
+
+  fcio_stream *x=(fcio_stream *)calloc(1,sizeof(fcio_stream));
+  if(x==0) {
+    if(fcio_debug()) fprintf(stderr,"FCIOConnect/ERROR: can not init structure\n");
+    return NULL;
+  }
+  x->fd = -1;
+  x->debug = fcio_debug();
+
+  int tmio_debug = x->debug-3;
+  x->tmio=tmio_init(proto, timeout, buffer, tmio_debug<0?0:tmio_debug);
+  if(x->tmio==0) {
+    if(fcio_debug()) fprintf(stderr,"FCIOConnect/ERROR: init of tmio structure failed\n");
+    free(x);
+    return NULL;
+  }
+
+  int rc=-1;
+  x->writable = direction=='w';
+  if(direction=='w') rc=tmio_create(x->tmio, name, timeout);
+  else if(direction=='r') rc=tmio_open(x->tmio, name, timeout);
+  if(rc<0) {
+    if(fcio_debug()) fprintf(stderr,"FCIOConnect/ERROR: can not connect to stream %s, %s\n",
+        name,tmio_status_str(x->tmio));
+    tmio_delete(x->tmio);
+    free(x);
+    return NULL;
+  }
+  // file names are either prefixed with file:// or have no protocol prefix
+  if(strcmp(name,"-") && (strncmp(name,"file://",7)==0 || !strstr(name,"://"))) {
+    char *path = strdup(strncmp(name,"file://",7)==0 ? name+7 : name);
+    if(direction=='r')
+      x->path = path;
+    else
+      x->wpath = path;
+  }
+
+  if(fcio_debug()>3) fprintf(stderr,"FCIOConnect/DEBUG: %s connected, proto %s \n",name,proto);
+  return (FCIOStream)x;
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIODisconnect(FCIOStream x)
+
+/*--- Description ------------------------------------------------//
+
+Disconnects to any FCIOStream and closes any communication to
+the endpoint. Records still queued or buffered (asynchronous
+writer, writev/uring/direct backends), the trailer and the index
+are written before.
+
+Returns 0 on success and <0 on error, also if any of these final
+writes failed or if the writer thread failed to write a record
+before. The stream is closed in any case.
+
+//----------------------------------------------------------------*/
+{
+  if (!x) return -1;
+  fcio_stream *xio=(fcio_stream *)x;
+
+  int rc = 0;
+  if (xio->async && fcio_async_stop(xio) < 0) {
+    if (fcio_stream_debug(x)) fprintf(stderr,"FCIODisconnect/ERROR: asynchronous writes of queued records failed\n");
+    rc = -1;
+  }
+  if (xio->trailer && fcio_write_trailer(xio) < 0) {
+    if (fcio_stream_debug(x)) fprintf(stderr,"FCIODisconnect/ERROR: writing the trailer failed\n");
+    rc = -1;
+  }
+  // the index is stamped after the file is closed, with the bytes it covers now
+  size_t covered = xio->index ? fcio_index_covered(xio) : 0;
+
+  if (xio->tmio) {
+    tmio_delete(xio->tmio); // always returns 0
+  } else if (xio->fd >= 0) {
+    if (fcio_writev_flush(xio) < 0) {
+      if (fcio_stream_debug(x)) fprintf(stderr,"FCIODisconnect/ERROR: writing pending frames failed\n");
+      rc = -1;
+    }
+    if (xio->uring && fcio_uring_close(xio) < 0) {
+      if (fcio_stream_debug(x)) fprintf(stderr,"FCIODisconnect/ERROR: asynchronous writes failed\n");
+      rc = -1;
+    }
+    close(xio->fd);
+    free(xio->wbuf);
+    free(xio->iov);
+    free(xio->headers);
+  } else {
+    munmap((void *)xio->map, xio->map_size);
+  }
+  if (xio->index && fcio_index_close(xio, covered) < 0) {
+    if (fcio_stream_debug(x)) fprintf(stderr,"FCIODisconnect/ERROR: closing the index failed\n");
+    rc = -1;
+  }
+  if (xio->readahead || xio->drop_behind)
+    close(xio->advice_fd);
+  int stream_debug = xio->debug;
+  free(xio->path);
+  free(xio->wpath);
+  free(xio->entries);
+  free(xio->scratch);
+  free(xio);
+  if (stream_debug>3) fprintf(stderr,"FCIODisconnect/DEBUG: stream closed\n");
+  return rc;
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIOTimeout(FCIOStream x, int timeout_ms)
+
+/*--- Description ------------------------------------------------//
+
+Sets the timeout for I/O operations in milliseconds.
+
+Returns the previously set timeout.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio=(fcio_stream *)x;
+  if (!xio) return -1;
+  if (xio->tmio)
+    return tmio_timeout(xio->tmio, timeout_ms);
+
+  int old = xio->timeout;
+  xio->timeout = timeout_ms;
+  return old;
+}
+
+
+/*=== Function ===================================================*/
+
+size_t FCIOTell(FCIOStream x)
+
+/*--- Description ------------------------------------------------//
+
+Returns the byte offset of the next frame to be read from x.
+Called before FCIOGetRecord or FCIOReadMessage this is the offset
+of the next record, which can be passed to FCIOSeekOffset later.
+For tmio streams it is the number of bytes read and skipped so far.
+This equals the file offset only as long as tmio counts the
+protocol frame and all frame headers in these counters and reads
+files from their start; it is used as an offset by FCIOReadIndexEntry.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio=(fcio_stream *)x;
+  if (!xio)
+    return 0;
+  if (xio->tmio)  // assumes the tmio byte counters cover the whole file up to the read position
+    return xio->tmio->bytesread + xio->tmio->bytesskipped;
+
+  return xio->pos;
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIOSeekOffset(FCIOStream x, size_t offset)
+
+/*--- Description ------------------------------------------------//
+
+Continues reading a stream connected with mmap:// at the frame
+starting at byte offset, e.g. a value returned by FCIOTell.
+Data frames at offset are skipped by the next FCIOReadMessage up
+to the next record tag.
+
+Note that records following a seek are decoded with the FCIOConfig
+read last, it is up to the caller to seek to a position governed
+by the same config.
+
+Returns 0 on success or <0 on error, e.g. for tmio streams.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio=(fcio_stream *)x;
+  if (!xio || xio->tmio)
+    return -1;
+  if (offset < FCIOMapProtocolSize || offset > xio->map_size) {
+    if (fcio_stream_debug(x))
+      fprintf(stderr, "FCIOSeekOffset/ERROR: offset %zu out of range [%zu,%zu]\n", offset, (size_t)FCIOMapProtocolSize, xio->map_size);
+    return -1;
+  }
+  xio->pos = offset;
+  xio->need_config = 0;
+  xio->advised = 0;
+  if (xio->dropped > offset)
+    xio->dropped = offset / FCIOAdviceStep * FCIOAdviceStep;
+  return 0;
+}
+
+
+/*=== Function ===================================================*/
+
+size_t FCIOByteCount(FCIOStream x, int direction)
+
+/*--- Description ------------------------------------------------//
+
+Returns the number of bytes written ('w'), read ('r') or skipped
+('s') on stream x including frame headers, or 0 on error.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio=(fcio_stream *)x;
+  if (!xio)
+    return 0;
+
+  switch (direction) {
+    case 'w':
+      if (fcio_async_caller(xio))
+        return fcio_async_accepted(xio);
+      return xio->tmio ? xio->tmio->byteswritten : xio->byteswritten + xio->wbuf_len;
+    case 'r': return xio->tmio ? xio->tmio->bytesread : xio->bytesread;
+    case 's': return xio->tmio ? xio->tmio->bytesskipped : xio->bytesskipped;
+    default: return 0;
+  }
+}
+
+
+/*=== Function ===================================================*/
+
+size_t FCIOByteCountDelta(FCIOStream x, int direction)
+
+/*--- Description ------------------------------------------------//
+
+Returns the number of bytes written ('w'), read ('r') or skipped
+('s') on stream x since the previous call with the same direction,
+or since the stream was connected. The counts are kept per stream.
+
+Returns the number of bytes or 0 on error.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio=(fcio_stream *)x;
+  const char *directions = "wrs";
+  const char *d = strchr(directions, direction);
+  if (!xio || !direction || !d)
+    return 0;
+
+  size_t count = FCIOByteCount(x, direction);
+  size_t delta = count - xio->marks[d - directions];
+  xio->marks[d - directions] = count;
+  return delta;
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIOSetStreamDebug(FCIOStream x, int level)
+
+/*--- Description ------------------------------------------------//
+
+Sets the debug level (see FCIODebug) of the calls on stream x,
+including the decoding of its records by FCIOGetRecord and the
+state reader. Streams start with the level set by FCIODebug when
+they are connected.
+
+Returns the previous level or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio=(fcio_stream *)x;
+  if (!xio)
+    return -1;
+
+  return __atomic_exchange_n(&xio->debug, level, __ATOMIC_RELAXED);
+}
+
+
+/*=== Function ===================================================*/
+
+void *FCIOTmioHandle(FCIOStream x)
+
+/*--- Description ------------------------------------------------//
+
+Returns the underlying tmio_stream of x or NULL if x is not a
+tmio stream (e.g. mmap://). Since 2.0.0 x itself must not be cast
+to a tmio_stream.
+
+//----------------------------------------------------------------*/
+{
+  return x ? ((fcio_stream *)x)->tmio : NULL;
+}
+
+
+/*--- Page cache advice ------------------------------------------//
+
+Readers of files may advise the kernel to read ahead of the read
+position and to drop the consumed ranges from the page cache, see
+FCIOSetReadahead. The advice is given with posix_fadvise on a second
+descriptor of the file, which covers the page cache of tmio file
+streams as well as mapped files. Mapped ranges are dropped from the
+mapping with madvise first.
+
+//----------------------------------------------------------------*/
+
+// advises the range ahead of and drops the range behind the read position of x
+static void fcio_advise(fcio_stream *x)
+{
+  size_t pos = x->tmio ? x->tmio->bytesread + x->tmio->bytesskipped : x->pos;
+  // the next range is advised once half of the window has been consumed
+  if (x->readahead && pos + x->readahead / 2 >= x->advised) {
+    size_t from = x->advised > pos ? x->advised : pos;
+    posix_fadvise(x->advice_fd, from, pos + x->readahead - from, POSIX_FADV_WILLNEED);
+    x->advised = pos + x->readahead;
+  }
+  if (x->drop_behind && pos >= x->dropped + 2 * FCIOAdviceStep) {
+    // the step before the position is kept for views of recent records
+    size_t end = (pos / FCIOAdviceStep - 1) * FCIOAdviceStep;
+    if (x->map)
+      madvise((void *)(x->map + x->dropped), end - x->dropped, MADV_DONTNEED);
+    posix_fadvise(x->advice_fd, x->dropped, end - x->dropped, POSIX_FADV_DONTNEED);
+    x->dropped = end;
+  }
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIOSetReadahead(FCIOStream x, int readahead, int drop_behind)
+
+/*--- Description ------------------------------------------------//
+
+Sets the page cache advice of the file reader x, which is either
+connected to a file with tmio or with mmap://, e.g. the stream of
+FCIOOpen (FCIOStreamHandle) or FCIOCreateStateReader (reader->stream).
+With readahead > 0 the next readahead kB after the read position are
+requested from the file system in the background while records are
+decoded, which helps with network file systems and their small
+default readahead.
+With drop_behind != 0 the consumed ranges of the file are dropped
+from the page cache, so that sequential reprocessing of large files
+does not evict the cache of other processes.
+readahead 0 and drop_behind 0 disable the advice.
+
+Returns 0 on success or <0 on error, e.g. for tcp streams.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || !xio->path || readahead < 0) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOSetReadahead/ERROR: stream is not a file reader\n");
+    return -1;
+  }
+  if (!xio->readahead && !xio->drop_behind && (readahead || drop_behind)) {
+    xio->advice_fd = open(xio->path, O_RDONLY);
+    if (xio->advice_fd < 0) {
+      if (fcio_stream_debug(x)) fprintf(stderr, "FCIOSetReadahead/ERROR: can not open %s\n", xio->path);
+      return -1;
+    }
+    if (xio->map)
+      madvise((void *)xio->map, xio->map_size, MADV_SEQUENTIAL);
+  } else if ((xio->readahead || xio->drop_behind) && !readahead && !drop_behind) {
+    close(xio->advice_fd);
+  }
+  xio->readahead = (size_t)readahead * 1024;
+  xio->drop_behind = drop_behind ? 1 : 0;
+  xio->advised = 0;
+  if (xio->readahead || xio->drop_behind)
+    fcio_advise(xio);
+  return 0;
+}
+
+
+/*--- Index ------------------------------------------------------//
+
+A sidecar index (conventionally <file>.fcidx) holds one
+FCIOIndexEntry per record, which allows to find records by event
+number or time without decoding a file from its start.
+The index file starts with the four characters "FCI2" followed by
+an int with sizeof(FCIOIndexEntry) and two long longs with the size
+and modification time (seconds) of the indexed file, the entries
+follow in native byte order. The size and time are set when the
+index is closed and cover the file only if all of it is indexed,
+they are -1 otherwise (e.g. while the file is written). Indexes not
+matching their file are rebuilt by FCIOLoadIndex.
+
+Records written to a stream are indexed in FCIOWriteMessage, the
+put functions announce the event number and time of the record
+with fcio_index_hint before.
+
+//----------------------------------------------------------------*/
+
+static void fcio_index_reset_hint(fcio_stream *x)
+{
+  x->hint.eventnumber = -1;
+  x->hint.pps = -1;
+  x->hint.ticks = -1;
+}
+
+static void fcio_index_hint(FCIOStream x, int eventnumber, int pps, int ticks)
+{
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || !(xio->index || xio->trailer || xio->sync_interval))
+    return;
+  FCIOIndexEntry *hint = fcio_async_hint(xio);
+  hint->eventnumber = eventnumber;
+  hint->pps = pps;
+  hint->ticks = ticks;
+}
+
+#define FCIOIndexMagic "FCI2"
+#define FCIOIndexStampOffset 8  // magic and entry size
+#define FCIOIndexHeaderSize (FCIOIndexStampOffset + 2 * sizeof(long long))
+
+// fills stamp with the size and modification time of file, if its size is covered bytes
+static void fcio_index_stamp(const char *file, size_t covered, long long stamp[2])
+{
+  struct stat st;
+  stamp[0] = stamp[1] = -1;
+  if (file && stat(file, &st) == 0 && (size_t)st.st_size == covered) {
+    stamp[0] = st.st_size;
+    stamp[1] = st.st_mtime;
   }
+}
 
-  FCIOReadInt(stream,config->eventsamples);
-  if (config->eventsamples < 0 || config->eventsamples > FCIOMaxSamples) {
-    if (debug)
-      fprintf(stderr, "FCIO/fcio_get_config/ERROR: eventsamples %d outside allowed range [0,%d]\n", config->eventsamples, FCIOMaxSamples);
+// writes the header of an index, stamp may be NULL for an index still growing
+static int fcio_index_header(FILE *index, const long long *stamp)
+{
+  const int entry_size = sizeof(FCIOIndexEntry);
+  const long long unknown[2] = { -1, -1 };
+  return (fwrite(FCIOIndexMagic, 4, 1, index) != 1 || fwrite(&entry_size, sizeof(int), 1, index) != 1
+    || fwrite(stamp ? stamp : unknown, 2 * sizeof(long long), 1, index) != 1) ? -1 : 0;
+}
+
+/* Stamps the index of x with the file of x and closes it. covered is the
+   number of bytes of the file the index describes, the position of
+   readers or the bytes written by writers. */
+static int fcio_index_close(fcio_stream *x, size_t covered)
+{
+  long long stamp[2];
+  fcio_index_stamp(x->wpath ? x->wpath : x->path, covered, stamp);
+  int rc = (fseek(x->index, FCIOIndexStampOffset, SEEK_SET) || fwrite(stamp, sizeof(stamp), 1, x->index) != 1) ? -1 : 0;
+  if (fclose(x->index))
+    rc = -1;
+  x->index = NULL;
+  return rc;
+}
+
+// returns the bytes of the file of x which have been indexed so far
+static size_t fcio_index_covered(fcio_stream *x)
+{
+  return x->wpath ? FCIOByteCount((FCIOStream)x, 'w') : FCIOTell((FCIOStream)x);
+}
+
+static int fcio_index_append(fcio_stream *x, const FCIOIndexEntry *entry)
+{
+  if (fwrite(entry, sizeof(FCIOIndexEntry), 1, x->index) != 1) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIO/fcio_index_append/ERROR: writing index entry for tag %d failed\n", entry->tag);
     return -1;
   }
-  FCIOReadInt(stream,config->blprecision);
-  FCIOReadInt(stream,config->sumlength);
-  FCIOReadInt(stream,config->adcbits);
-  FCIOReadInt(stream,config->mastercards);
-  FCIOReadInt(stream,config->triggercards);
-  FCIOReadInt(stream,config->adccards);
-  FCIOReadInt(stream,config->gps);
-  int tracemap_size = FCIOReadInts(stream, FCIOMaxChannels, config->tracemap)/sizeof(int);
-  FCIOReadInt(stream,config->streamid);
+  return 0;
+}
 
-  if (debug > 3)
-    fprintf(stderr,"FCIO/fcio_get_config/DEBUG: %d/%d/%d adcs %d triggers %d samples %d adcbits %d blprec %d sumlength %d gps %d\n",
-      config->mastercards, config->triggercards, config->adccards,
-      config->adcs,config->triggers,config->eventsamples,config->adcbits,config->blprecision,config->sumlength,config->gps);
-  if (debug > 4) {
-    for (int i = 0; i < tracemap_size; i++)
-       fprintf(stderr,"FCIO/fcio_get_config/DEBUG: trace %d mapped to 0x%x\n",i,config->tracemap[i]);
-  }
 
+/*--- Trailer ----------------------------------------------------//
 
-  // tracemap must not be present, but should match number of traces.
-  if (tracemap_size && tracemap_size != n_configured_traces) {
-    fprintf(stderr, "FCIO/fcio_get_config/WARNING: got unexpected tracemap size %d/%d\n", tracemap_size, n_configured_traces);
-    return 1;
+Writers with FCIOSetTrailer collect the index entries of all records
+and append an FCIOTrailer record on FCIODisconnect. It consists of
+the frames
+  FCIOSummary
+  FCIOIndexEntry[records]
+  fcio_trailer_footer
+so that the footer ends the file. Mapped readers find the trailer
+from the footer without scanning. The config offsets are the
+FCIOConfig entries of the index.
+
+//----------------------------------------------------------------*/
+
+static inline int fcio_index_is_event(const FCIOIndexEntry *entry)
+{
+  return entry->tag == FCIOEvent || entry->tag == FCIOSparseEvent || entry->tag == FCIOEventHeader || entry->tag == FCIORecEvent;
+}
+
+typedef struct {
+  long long offset;  // byte offset of the FCIOTrailer tag
+  int entry_size;    // sizeof(FCIOIndexEntry)
+  char magic[4];     // "FCTR"
+} fcio_trailer_footer;
+
+static int fcio_trailer_append(fcio_stream *x, const FCIOIndexEntry *entry)
+{
+  if (x->nentries == x->max_entries) {
+    int max_entries = x->max_entries ? 2 * x->max_entries : 1024;
+    FCIOIndexEntry *entries = (FCIOIndexEntry *)realloc(x->entries, max_entries * sizeof(FCIOIndexEntry));
+    if (!entries) {
+      if (fcio_stream_debug(x)) fprintf(stderr, "FCIO/fcio_trailer_append/ERROR: can not grow the index to %d entries\n", max_entries);
+      return -1;
+    }
+    x->entries = entries;
+    x->max_entries = max_entries;
   }
+  x->entries[x->nentries++] = *entry;
   return 0;
 }
 
-static inline int fcio_get_status(FCIOStream stream, fcio_status *status)
+static void fcio_summarize(const FCIOIndexEntry *entries, int nentries, long long data_size, FCIOSummary *summary)
 {
-  if (!stream || !status)
+  memset(summary, 0, sizeof(FCIOSummary));
+  summary->data_size = data_size;
+  summary->records = nentries;
+  summary->first_event = summary->last_event = -1;
+  summary->first_pps = summary->first_ticks = summary->last_pps = summary->last_ticks = -1;
+
+  int first = 1;
+  for (int i = 0; i < nentries; i++) {
+    const FCIOIndexEntry *entry = &entries[i];
+    summary->tags[(entry->tag > 0 && entry->tag < 16) ? entry->tag : 0]++;
+    if (!fcio_index_is_event(entry))
+      continue;
+    if (first) {
+      summary->first_event = entry->eventnumber;
+      summary->first_pps = entry->pps;
+      summary->first_ticks = entry->ticks;
+      first = 0;
+    }
+    summary->last_event = entry->eventnumber;
+    summary->last_pps = entry->pps;
+    summary->last_ticks = entry->ticks;
+  }
+}
+
+static int fcio_write_trailer(fcio_stream *x)
+{
+  x->trailer = 0;  // the trailer itself is not part of the index
+  if ((size_t)x->nentries * sizeof(FCIOIndexEntry) > INT_MAX) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIO/fcio_write_trailer/ERROR: %d records exceed the trailer size\n", x->nentries);
     return -1;
+  }
 
-  FCIOReadInt(stream,status->status);
-  FCIOReadInts(stream,10,status->statustime);
-  FCIOReadInt(stream,status->cards);
-  FCIOReadInt(stream,status->size);
-  for (int i = 0; i < status->cards; i++)
-    FCIORead(stream, status->size, (void*)&status->data[i]);
+  FCIOSummary summary;
+  fcio_trailer_footer footer = {0, sizeof(FCIOIndexEntry), {'F', 'C', 'T', 'R'}};
+  footer.offset = FCIOByteCount((FCIOStream)x, 'w');
+  fcio_summarize(x->entries, x->nentries, footer.offset, &summary);
+
+  FCIOFrame frames[] = {
+    {&summary, sizeof(summary)},
+    {x->entries, x->nentries * sizeof(FCIOIndexEntry)},
+    {&footer, sizeof(footer)},
+  };
+  if (FCIOWriteMessage((FCIOStream)x, FCIOTrailer) < 0 || FCIOWriteFrames((FCIOStream)x, 3, frames) < 0)
+    return -1;
+  return FCIOFlush((FCIOStream)x);
+}
 
-  if (debug > 3) {
-    int totalerrors = 0;
-    for (int i = 0; i < status->cards; i++)
-      totalerrors += status->data[i].totalerrors;
-    fprintf(stderr,"FCIO/fcio_get_status/DEBUG: overall %d errors %d time pps %d ticks %d unix %d %d delta %d cards %d\n",
-      status->status,totalerrors,status->statustime[0], status->statustime[1],status->statustime[2],
-      status->statustime[3],status->statustime[4],status->cards);
+/* Locates the trailer of a mapped file, returns the offsets of the summary
+   and entry payloads in the mapping and the number of entries, 0 if there
+   is no trailer. */
+static int fcio_map_trailer(fcio_stream *x, size_t *summary, size_t *entries, int *nentries)
+{
+  fcio_trailer_footer footer;
+  int header;
+  if (!x->map || x->map_size < FCIOMapProtocolSize + 4 * sizeof(int) + sizeof(FCIOSummary) + sizeof(footer))
+    return 0;
+  size_t pos = x->map_size - sizeof(footer);
+  memcpy(&footer, x->map + pos, sizeof(footer));
+  if (!fcio_map_header(x, pos - sizeof(int), &header) || header != sizeof(footer) ||
+      memcmp(footer.magic, "FCTR", 4) || footer.entry_size != sizeof(FCIOIndexEntry) ||
+      footer.offset < (long long)FCIOMapProtocolSize || (size_t)footer.offset >= pos)
+    return 0;
 
-    if (debug > 4) {
-      for (int i = 0; i < status->cards; i++) {
-        fprintf(stderr,"FCIO/fcio_get_status/DEBUG: card %d: status %d errors %d time %d %9d env",i,
-          status->data[i].status,status->data[i].totalerrors,status->data[i].pps,status->data[i].ticks);
-        if (debug > 5) {
-          for (int i1 = 0; i1 < (int)status->data[i].numenv; i1++)
-            fprintf(stderr," %d",(int)status->data[i].environment[i1]);
-        }
-        fprintf(stderr,"\n");
-      }
-    }
-  }
-  return 0;
+  pos = footer.offset;
+  if (!fcio_map_header(x, pos, &header) || header != -FCIOTrailer)
+    return 0;
+  pos += sizeof(int);
+  if (!fcio_map_header(x, pos, &header) || header != sizeof(FCIOSummary))
+    return 0;
+  *summary = pos + sizeof(int);
+  pos = *summary + sizeof(FCIOSummary);
+  if (!fcio_map_header(x, pos, &header) || header < 0 || header % sizeof(FCIOIndexEntry) ||
+      pos + sizeof(int) + header != x->map_size - sizeof(footer) - sizeof(int))
+    return 0;
+  *entries = pos + sizeof(int);
+  *nentries = header / sizeof(FCIOIndexEntry);
+  return 1;
 }
 
-static inline int fcio_get_event(FCIOStream stream, fcio_event *event, int num_expected_traces)
+
+/*=== Function ===================================================*/
+
+int FCIOSetTrailer(FCIOStream x, int enable)
+
+/*--- Description ------------------------------------------------//
+
+Enables (enable != 0) or disables appending an FCIOTrailer record
+with the index and an FCIOSummary of all records on FCIODisconnect
+of the writer x. Enable it before the first record is written, the
+index is kept in memory until the stream is disconnected.
+Readers of files connected with mmap:// use the trailer for
+FCIOLoadIndex, FCIOSeek and FCIOGetSummary without scanning.
+
+Returns the previous setting or <0 on error.
+
+//----------------------------------------------------------------*/
 {
-  if (!stream || !event)
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || (!xio->tmio && xio->fd < 0))
     return -1;
+  int old = xio->trailer;
+  xio->trailer = enable ? 1 : 0;
+  if (xio->trailer && !old)
+    fcio_index_reset_hint(xio);
+  return old;
+}
 
-  if (num_expected_traces < 0 || num_expected_traces > FCIOMaxChannels)
+
+/*=== Function ===================================================*/
+
+int FCIOGetSummary(FCIOStream x, FCIOSummary *summary)
+
+/*--- Description ------------------------------------------------//
+
+Fills summary for the file read by x. The summary of the FCIOTrailer
+is used if x is connected with mmap:// and the file has one,
+otherwise it is calculated from the index loaded with FCIOLoadIndex
+or built on demand.
+
+Returns 0 on success or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || !summary)
     return -1;
 
-  FCIOReadInt(stream,event->type);
-  FCIOReadFloat(stream,event->pulser);
-  event->timeoffset_size = FCIOReadInts(stream,10,event->timeoffset)/sizeof(int);
-  event->timestamp_size = FCIOReadInts(stream,10,event->timestamp)/sizeof(int);
-  FCIOReadUShorts(stream,FCIOMaxChannels*(FCIOMaxSamples + 2),event->traces);
-  event->deadregion_size = FCIOReadInts(stream,10,event->deadregion)/sizeof(int);
-  // If an FCIOSparseEvent has been read previous to an FCIOEvent
-  // num_traces and trace_list might have been adjusted to match the sparse layout
-  if (event->num_traces != num_expected_traces) {
-    event->num_traces = num_expected_traces;
-    for (int i = 0; i < num_expected_traces; i++)
-      event->trace_list[i] = i;
+  size_t summary_pos, entries_pos;
+  int nentries;
+  if (fcio_map_trailer(xio, &summary_pos, &entries_pos, &nentries)) {
+    memcpy(summary, xio->map + summary_pos, sizeof(FCIOSummary));
+    return 0;
   }
-  event->deadregion[5] = 0;
-  event->deadregion[6] = num_expected_traces;
+  if (!xio->entries && FCIOLoadIndex(x, NULL) < 0)
+    return -1;
 
-  if (debug > 3) {
-    fprintf(stderr,"FCIO/fcio_get_event/DEBUG: type %d pulser %g, offset %d %d %d traces %d timestamp[%d] ",
-      event->type,event->pulser,event->timeoffset[0],event->timeoffset[1],event->timeoffset[2],event->num_traces, event->timestamp_size);
-    for (int i = 0; i < event->timestamp_size; i++)
-      fprintf(stderr," %d",event->timestamp[i]);
-    fprintf(stderr, " deadregion[%d]", event->deadregion_size);
-    for (int i = 0; i < event->deadregion_size; i++)
-      fprintf(stderr," %d",event->deadregion[i]);
-    fprintf(stderr,"\n");
-  }
+  long long data_size = xio->tmio ? 0 : (long long)xio->map_size;
+  fcio_summarize(xio->entries, xio->nentries, data_size, summary);
   return 0;
 }
 
-static inline int fcio_get_sparseevent(FCIOStream stream, fcio_event *event, int tracesamples)
+
+/*=== Function ===================================================*/
+
+int FCIOSetIndexFile(FCIOStream x, const char *name)
+
+/*--- Description ------------------------------------------------//
+
+Creates the sidecar index file name for stream x, replacing an
+existing file, or closes the current index if name is NULL.
+
+For streams connected with direction 'w' every record written is
+added to the index, for streams connected with 'r' every record
+read with FCIOReadIndexEntry. Set the index before the first
+record, the offsets are relative to the start of the stream.
+Closing the index (here or in FCIODisconnect) stores the size and
+modification time of the file, if the index covers all of it.
+
+Returns 0 on success or <0 on error.
+
+//----------------------------------------------------------------*/
 {
-  if (!stream || !event)
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio)
     return -1;
 
-  if (tracesamples < 0 || tracesamples > FCIOMaxSamples+2)
+  int rc = 0;
+  if (xio->index)
+    rc = fcio_index_close(xio, fcio_index_covered(xio));
+  if (!name)
+    return rc;
+
+  FILE *index = fopen(name, "wb");
+  if (!index || fcio_index_header(index, NULL) < 0) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOSetIndexFile/ERROR: can not create index %s\n", name);
+    if (index)
+      fclose(index);
     return -1;
+  }
+  xio->index = index;
+  fcio_index_reset_hint(xio);
+  if (fcio_stream_debug(x) > 3) fprintf(stderr, "FCIOSetIndexFile/DEBUG: indexing to %s\n", name);
+  return rc;
+}
 
-  FCIOReadInt(stream,event->type);
-  FCIOReadFloat(stream,event->pulser);
-  event->timeoffset_size = FCIOReadInts(stream,10,event->timeoffset)/sizeof(int);
-  event->timestamp_size = FCIOReadInts(stream,10,event->timestamp)/sizeof(int);
-  event->deadregion_size = FCIOReadInts(stream,10,event->deadregion)/sizeof(int);
 
-  FCIOReadInts(stream,1,&event->num_traces);
-  int read_trace_list_size = FCIOReadUShorts(stream, FCIOMaxChannels, event->trace_list)/sizeof(unsigned short);
-  if (read_trace_list_size != event->num_traces) {
-    if (debug > 1) fprintf(stderr, "FCIO/fcio_get_sparsevent/WARNING: trace_list size does not match %d/%d\n", read_trace_list_size, event->num_traces);
-    if (read_trace_list_size < event->num_traces)
-      event->num_traces = read_trace_list_size;
-  }
-  for (int i = 0; i < event->num_traces; i++) {
-    int trace_idx = event->trace_list[i];
-    if (trace_idx >= FCIOMaxChannels) {
-      if (debug) fprintf(stderr, "FCIO/fcio_get_sparsevent/ERROR: trace_list contains out-of-bounds trace index for traces buffer %d/%d\n", trace_idx, FCIOMaxChannels);
-      return -1;
+/*=== Function ===================================================*/
+
+int FCIOReadIndexEntry(FCIOStream x, FCIOIndexEntry *entry)
+
+/*--- Description ------------------------------------------------//
+
+Reads the next record tag of x and fills entry from the leading
+frames of the record only, the remaining frames (e.g. traces) are
+skipped by the next read. Use on streams with direction 'r' instead
+of FCIOGetRecord to index existing files at disk speed.
+If an index file is set, the entry is appended to it.
+
+Returns the tag (>0) on success or 0 on timeout and <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || !entry)
+    return -1;
+
+  int tag = FCIOReadMessage(x);
+  if (tag <= 0)
+    return tag;
+
+  entry->offset = FCIOTell(x) - sizeof(int);
+  entry->tag = tag;
+  entry->config_generation = xio->configs;
+  entry->eventnumber = -1;
+  entry->pps = -1;
+  entry->ticks = -1;
+  entry->reserved = 0;
+
+  switch (tag) {
+    case FCIOEvent:
+    case FCIOSparseEvent:
+    case FCIOEventHeader:
+    case FCIORecEvent: {
+      // type, pulser and timeoffset come first in all event records
+      int ints[10];
+      FCIORead(x, sizeof(int), ints);
+      FCIORead(x, sizeof(float), ints);
+      FCIORead(x, sizeof(ints), ints);
+      int size = FCIORead(x, sizeof(ints), ints) / (int)sizeof(int);
+      if (size > 0)
+        entry->eventnumber = ints[0];
+      if (size > 2) {
+        entry->pps = ints[1];
+        entry->ticks = ints[2];
+      }
+      break;
+    }
+    case FCIOStatus: {
+      int ints[10];
+      FCIORead(x, sizeof(int), ints);
+      FCIORead(x, sizeof(ints), ints);
+      int cards = 0;
+      FCIORead(x, sizeof(int), &cards);
+      FCIORead(x, sizeof(int), ints);
+      unsigned int card[5];
+      if (cards > 0 && FCIORead(x, sizeof(card), card) >= (int)sizeof(card)) {
+        entry->pps = card[3];
+        entry->ticks = card[4];
+      }
+      break;
     }
-    FCIOReadUShorts(stream,tracesamples,&event->traces[event->trace_list[i]*tracesamples]);
   }
 
-  if (debug > 3) {
-    fprintf(stderr,"FCIO/fcio_get_sparseevent/DEBUG: type %d pulser %g, offset %d %d %d",event->type,event->pulser,event->timeoffset[0],event->timeoffset[1],event->timeoffset[2]);
-    fprintf(stderr," timestamp[%d]", event->timestamp_size); for (int i = 0; i < event->timestamp_size; i++) fprintf(stderr," %d",event->timestamp[i]);
-    fprintf(stderr," deadregion[%d]", event->deadregion_size); for (int i = 0; i < event->deadregion_size; i++) fprintf(stderr," %d",event->deadregion[i]);
-    if (debug > 5) {
-      fprintf(stderr," traces[%d]", event->num_traces);
-      for (int i = 0; i < event->num_traces; i++) fprintf(stderr," %d",event->trace_list[i]);
-    }
-    fprintf(stderr,"\n");
+  if (xio->index && fcio_index_append(xio, entry) < 0)
+    return -1;
+  return tag;
+}
+
+
+// returns the first event entry at or after i, or x->nentries
+static inline int fcio_index_next_event(const fcio_stream *x, int i)
+{
+  while (i < x->nentries && !fcio_index_is_event(&x->entries[i]))
+    i++;
+  return i;
+}
+
+// returns 1 if the event entry is at or after the event number or time sought with mode
+static inline int fcio_index_reached(const FCIOIndexEntry *entry, int mode, int value, int ticks)
+{
+  if (mode == FCIOSeekEvent)
+    return entry->eventnumber >= value;
+  return entry->pps > value || (entry->pps == value && entry->ticks >= ticks);
+}
+
+// replaces the index of x, noting by which keys its event entries ascend
+static void fcio_index_set_entries(fcio_stream *x, FCIOIndexEntry *entries, int nentries)
+{
+  free(x->entries);
+  x->entries = entries;
+  x->nentries = nentries;
+  x->ascending = (1 << FCIOSeekEvent) | (1 << FCIOSeekTime);
+  int prev = fcio_index_next_event(x, 0);
+  for (int i = fcio_index_next_event(x, prev + 1); i < nentries; prev = i, i = fcio_index_next_event(x, i + 1)) {
+    if (entries[i].eventnumber < entries[prev].eventnumber)
+      x->ascending &= ~(1 << FCIOSeekEvent);
+    if (!fcio_index_reached(&entries[i], FCIOSeekTime, entries[prev].pps, entries[prev].ticks))
+      x->ascending &= ~(1 << FCIOSeekTime);
   }
-  return 0;
 }
 
-static inline int fcio_get_eventheader(FCIOStream stream, fcio_config* config, fcio_event *event)
+/* Builds the index of the mapped file of x from its records and replaces
+   the stale index file name by it. Returns the number of records or -1,
+   failing to write the file only emits a warning. */
+static int fcio_index_rebuild(fcio_stream *x, const char *name)
 {
-  if (!stream || !config || !event)
+  int nentries = FCIOLoadIndex((FCIOStream)x, NULL);
+  if (nentries < 0)
     return -1;
 
-  FCIOReadInt(stream,event->type);
-  FCIOReadFloat(stream,event->pulser);
-  event->timeoffset_size = FCIOReadInts(stream,10,event->timeoffset)/sizeof(int);
-  event->timestamp_size = FCIOReadInts(stream,10,event->timestamp)/sizeof(int);
-  event->deadregion_size = FCIOReadInts(stream,10,event->deadregion)/sizeof(int);
-  event->num_traces = FCIOReadUShorts(stream, FCIOMaxChannels, event->trace_list)/sizeof(unsigned short);
+  long long stamp[2];
+  fcio_index_stamp(x->path, x->map_size, stamp);
+  FILE *index = fopen(name, "wb");
+  int rc = (index && fcio_index_header(index, stamp) == 0
+    && fwrite(x->entries, sizeof(FCIOIndexEntry), nentries, index) == (size_t)nentries) ? 0 : -1;
+  if (index && fclose(index))
+    rc = -1;
+  if (rc < 0 && fcio_stream_debug(x) > 1)
+    fprintf(stderr, "FCIOLoadIndex/WARNING: can not replace %s\n", name);
+  return nentries;
+}
 
-  const int length = config->eventsamples + 2; // checked consistency in fcio_get_config
-  unsigned short read_buffer[FCIOMaxChannels * 2];
-  int read_header_elements = FCIOReadUShorts(stream, FCIOMaxChannels * 2, read_buffer)/sizeof(unsigned short)/2;
-  if (read_header_elements != event->num_traces) {
-    if (debug > 1) fprintf(stderr, "FCIO/fcio_get_eventheader/WARNING: trace_list size does not match %d/%d\n", read_header_elements, event->num_traces);
-    if (read_header_elements < event->num_traces)
-      event->num_traces = read_header_elements;
+
+/*=== Function ===================================================*/
+
+int FCIOLoadIndex(FCIOStream x, const char *name)
+
+/*--- Description ------------------------------------------------//
+
+Loads the sidecar index file name (see FCIOSetIndexFile) of the
+stream x for FCIOSeek and FCIOSeekState. If name is NULL the index
+is built by reading all records with FCIOReadIndexEntry, which needs
+a stream connected with mmap:// and does not change the position.
+
+An index is only used if the size and modification time stored in
+it match the file read by x, i.e. it has been closed after the whole
+file was indexed and the file has not changed since. Otherwise the
+index of files connected with mmap:// is built from their records
+and written to name, other streams return an error.
+
+Returns the number of records in the index or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio)
+    return -1;
+
+  FCIOIndexEntry *entries = NULL;
+  int nentries = 0, max_entries = 0;
+  FILE *index = NULL;
+  size_t pos = xio->pos, bytesread = xio->bytesread, bytesskipped = xio->bytesskipped;
+  int configs = xio->configs;
+
+  size_t summary_pos, entries_pos;
+  if (!name && fcio_map_trailer(xio, &summary_pos, &entries_pos, &nentries)) {
+    entries = (FCIOIndexEntry *)malloc(nentries * sizeof(FCIOIndexEntry) + 1);
+    if (!entries) {
+      if (fcio_stream_debug(x)) fprintf(stderr, "FCIOLoadIndex/ERROR: can not allocate the index\n");
+      return -1;
+    }
+    memcpy(entries, xio->map + entries_pos, nentries * sizeof(FCIOIndexEntry));
+    fcio_index_set_entries(xio, entries, nentries);
+    if (fcio_stream_debug(x) > 3) fprintf(stderr, "FCIOLoadIndex/DEBUG: %d records from the trailer\n", nentries);
+    return nentries;
   }
-  for (int i = 0; i < event->num_traces; i++) {
-    int trace_idx = event->trace_list[i];
-    if (trace_idx >= FCIOMaxChannels) {
-      if (debug) fprintf(stderr, "FCIO/fcio_get_eventheader/ERROR: trace_list contains out-of-bounds trace index for traces buffer %d/%d\n", trace_idx, FCIOMaxChannels);
+
+  if (name) {
+    char magic[4];
+    int entry_size = 0;
+    long long stamp[2], expected[2];
+    index = fopen(name, "rb");
+    int valid = index && fread(magic, 4, 1, index) == 1 && !memcmp(magic, FCIOIndexMagic, 4) &&
+        fread(&entry_size, sizeof(int), 1, index) == 1 && entry_size == sizeof(FCIOIndexEntry) &&
+        fread(stamp, sizeof(stamp), 1, index) == 1;
+    // the stamp is checked against files being read, mapped files are rebuilt from their records
+    if (valid && xio->path) {
+      fcio_index_stamp(xio->path, xio->map ? xio->map_size : (size_t)stamp[0], expected);
+      valid = stamp[0] >= 0 && stamp[0] == expected[0] && stamp[1] == expected[1];
+    }
+    if (!valid) {
+      if (index)
+        fclose(index);
+      if (xio->map) {
+        if (fcio_stream_debug(x) > 1) fprintf(stderr, "FCIOLoadIndex/WARNING: %s does not match %s, rebuilding it\n", name, xio->path);
+        return fcio_index_rebuild(xio, name);
+      }
+      if (fcio_stream_debug(x)) fprintf(stderr, "FCIOLoadIndex/ERROR: %s is not a valid index\n", name);
       return -1;
     }
-    for (int k = 0; k < 2; k++)
-      event->traces[trace_idx * length + k] = read_buffer[i * 2 + k];
+  } else if (xio->tmio || xio->fd >= 0 || FCIOSeekOffset(x, FCIOMapProtocolSize) < 0) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOLoadIndex/ERROR: building the index requires a stream connected with mmap://\n");
+    return -1;
+  } else {
+    xio->configs = 0;
+  }
+
+  while (1) {
+    if (nentries == max_entries) {
+      max_entries = max_entries ? 2 * max_entries : 1024;
+      FCIOIndexEntry *grown = (FCIOIndexEntry *)realloc(entries, max_entries * sizeof(FCIOIndexEntry));
+      if (!grown) {
+        nentries = -1;
+        break;
+      }
+      entries = grown;
+    }
+    if (index) {
+      if (fread(&entries[nentries], sizeof(FCIOIndexEntry), 1, index) != 1)
+        break;
+    } else {
+      // the index file of x is not written to while building the in-memory index
+      FILE *output = xio->index;
+      xio->index = NULL;
+      int tag = FCIOReadIndexEntry(x, &entries[nentries]);
+      xio->index = output;
+      if (tag <= 0)
+        break;
+    }
+    nentries++;
   }
 
-  if (debug > 3) {
-    fprintf(stderr,"FCIO/fcio_get_eventheader/DEBUG: type %d pulser %g, offset %d %d %d",event->type,event->pulser,event->timeoffset[0],event->timeoffset[1],event->timeoffset[2]);
-    fprintf(stderr," timestamp[%d]", event->timestamp_size); for (int i = 0; i < event->timestamp_size; i++) fprintf(stderr," %d",event->timestamp[i]);
-    fprintf(stderr," deadregion[%d]", event->deadregion_size); for (int i = 0; i < event->deadregion_size; i++) fprintf(stderr," %d",event->deadregion[i]);
-    if (debug > 5) {
-      fprintf(stderr," traces[%d]", event->num_traces);
-      for (int i = 0; i < event->num_traces; i++)
-        fprintf(stderr," %d %u",event->trace_list[i], event->theader[event->trace_list[i]][1]);
-    }
-    fprintf(stderr,"\n");
+  if (index)
+    fclose(index);
+  else {
+    xio->pos = pos;
+    xio->bytesread = bytesread;
+    xio->bytesskipped = bytesskipped;
+    xio->configs = configs;
   }
-  return 0;
+  if (nentries < 0) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOLoadIndex/ERROR: can not allocate the index\n");
+    free(entries);
+    return -1;
+  }
+
+  fcio_index_set_entries(xio, entries, nentries);
+  if (fcio_stream_debug(x) > 3) fprintf(stderr, "FCIOLoadIndex/DEBUG: %d records indexed\n", nentries);
+  return nentries;
 }
 
-static inline int fcio_get_recevent(FCIOStream stream, fcio_recevent *recevent)
+static int fcio_sync_find(fcio_stream *x, int pps, int ticks, FCIOIndexEntry *found);
+
+/* Finds the target record of a seek in the index of x, loading the index
+   if necessary. Time seeks in unindexed files with FCIOSync records
+   bisect the markers instead. Returns the record number of the target
+   or -1, found holds the entries of the target, the governing FCIOConfig
+   and the latest FCIOStatus before it (tag 0 if none). */
+static int fcio_index_find(fcio_stream *x, int mode, int value, int ticks, FCIOIndexEntry *found)
 {
-  if (!stream || !recevent)
+  if (!x->entries && mode == FCIOSeekTime) {
+    int target = fcio_sync_find(x, value, ticks, found);
+    if (target > -2)
+      return target;
+  }
+  if (!x->entries && FCIOLoadIndex((FCIOStream)x, NULL) < 0)
     return -1;
 
-  FCIOReadInt(stream,recevent->type);
-  FCIOReadFloat(stream,recevent->pulser);
-  recevent->timeoffset_size = FCIOReadInts(stream,10,recevent->timeoffset)/sizeof(int);
-  recevent->timestamp_size = FCIOReadInts(stream,10,recevent->timestamp)/sizeof(int);
-  recevent->deadregion_size = FCIOReadInts(stream,10,recevent->deadregion)/sizeof(int);
-  FCIOReadInt(stream, recevent->totalpulses);
-  FCIOReadInts(stream,FCIOMaxChannels,recevent->channel_pulses);
-  int flags_size = FCIOReadInts(stream,FCIOMaxPulses,recevent->flags)/sizeof(int);
-  int amplitudes_size = FCIOReadFloats(stream,FCIOMaxPulses,recevent->amplitudes)/sizeof(float);
-  int times_size = FCIOReadFloats(stream,FCIOMaxPulses,recevent->times)/sizeof(float);
-
-  if (debug > 3) {
-    fprintf(stderr,"FCIO/fcio_get_recevent/DEBUG: type %d pulser %g, offset %d %d %d timestamp ",
-        recevent->type,recevent->pulser,recevent->timeoffset[0],recevent->timeoffset[1],recevent->timeoffset[2]);
-    for (int i = 0; i < recevent->timestamp_size; i++)
-      fprintf(stderr," %d",recevent->timestamp[i]);
-    fprintf(stderr,"\n");
+  int target = -1;
+  if (mode == FCIOSeekRecord) {
+    target = (value >= 0 && value < x->nentries) ? value : -1;
+  } else if ((mode == FCIOSeekEvent || mode == FCIOSeekTime) && (x->ascending & (1 << mode))) {
+    // bisect for the first event at or after value, probing the next event entry of each midpoint
+    int lo = 0, hi = x->nentries;
+    while (lo < hi) {
+      int mid = lo + (hi - lo) / 2;
+      int i = fcio_index_next_event(x, mid);
+      if (i == x->nentries || fcio_index_reached(&x->entries[i], mode, value, ticks))
+        hi = mid;
+      else
+        lo = i + 1;
+    }
+    target = fcio_index_next_event(x, lo);
+    if (target == x->nentries || !fcio_index_reached(&x->entries[target], mode, value, ticks))
+      target = -1;
+  } else if (mode == FCIOSeekEvent || mode == FCIOSeekTime) {
+    // e.g. several runs in one file, the first matching event is searched
+    for (int i = fcio_index_next_event(x, 0); i < x->nentries && target < 0; i = fcio_index_next_event(x, i + 1))
+      if (fcio_index_reached(&x->entries[i], mode, value, ticks))
+        target = i;
   }
+  if (target < 0)
+    return -1;
 
-  if ( (flags_size != amplitudes_size) || (amplitudes_size != times_size) || (times_size != recevent->totalpulses) ) {
-    if ( debug > 1 ) fprintf(stderr, "FCIO/fcio_get_recevent/WARNING: Mismatch in pulse parameter sizes: totalpulses %d flags %d amplitudes %d times %d\n",
-      recevent->totalpulses, flags_size, amplitudes_size, times_size);
-    return 1;
+  found[0] = x->entries[target];
+  found[1].tag = found[2].tag = 0;
+  for (int i = target - 1; i >= 0 && !found[1].tag; i--) {
+    if (x->entries[i].tag == FCIOConfig)
+      found[1] = x->entries[i];
+    else if (x->entries[i].tag == FCIOStatus && !found[2].tag)
+      found[2] = x->entries[i];
   }
+  return target;
+}
+
+// positions x at the record of entry, keeping the config count in sync for FCIOReadIndexEntry
+static int fcio_index_seek(fcio_stream *x, const FCIOIndexEntry *entry)
+{
+  if (FCIOSeekOffset((FCIOStream)x, entry->offset) < 0)
+    return -1;
+  x->configs = entry->config_generation - (entry->tag == FCIOConfig);
   return 0;
 }
 
+
 /*=== Function ===================================================*/
 
-int FCIOGetRecord(FCIOData* x)
+int FCIOSeek(FCIOData *x, int mode, int value, int ticks)
 
 /*--- Description ------------------------------------------------//
 
-Reads a record of data from remote peer or file.
-A record consist of a message tag and all data items stored under
-this tag.
-
-valid record tags are described above
-
-Returns the tag (>0) on success or 0 on timeout and <0 on error.
-
-If a the data items are copied to the corresponding data structure
-FCIOData *x. You can access all items directly by the x pointer
-e.g.: x->config.adcs yields the number of adcs of camera.
-
-note: the structure is not complete up to now and will be extended by
-further items.
+Positions the stream of x, which must be connected with mmap://, so
+that the next FCIOGetRecord reads the record selected by mode (see
+FCIOSeekMode) and value, or value and ticks for FCIOSeekTime.
+The index is bisected if the event numbers or times ascend through
+the file, otherwise the first event record at or after them is
+searched from the start.
+The FCIOConfig governing the record and the latest FCIOStatus
+before it are read again, so x describes the state of the stream
+right before the record.
+The index is built on the first call if none has been loaded
+with FCIOLoadIndex.
+
+Returns the record number of the target (>=0) or <0 on error or if
+no record matches.
 
 //----------------------------------------------------------------*/
 {
-  if (!x)
+  fcio_stream *xio = x ? (fcio_stream *)x->ptmio : NULL;
+  if (!xio)
     return -1;
 
-  FCIOStream xio=x->ptmio;
-  int tag = FCIOReadMessage(xio);
-  if (debug > 4) fprintf(stderr,"FCIOGetRecord: got tag %d \n",tag);
-  if (tag <= 0)
-    return tag;
+  FCIOIndexEntry found[3];
+  int target = fcio_index_find(xio, mode, value, ticks, found);
+  if (target < 0) {
+    if (fcio_stream_debug(x->ptmio) > 1) fprintf(stderr, "FCIOSeek/WARNING: no record for mode %d value %d ticks %d\n", mode, value, ticks);
+    return -1;
+  }
+  if (found[1].tag && (fcio_index_seek(xio, &found[1]) < 0 || FCIOGetRecord(x) != FCIOConfig))
+    return -1;
+  if (found[2].tag && (fcio_index_seek(xio, &found[2]) < 0 || FCIOGetRecord(x) != FCIOStatus))
+    return -1;
+  if (fcio_index_seek(xio, &found[0]) < 0)
+    return -1;
 
-  int rc = 0;
-  switch (tag) {
-    case FCIOConfig:
-      rc = fcio_get_config(xio, &x->config);
+  if (fcio_stream_debug(x->ptmio) > 3) fprintf(stderr, "FCIOSeek/DEBUG: record %d at offset %lld\n", target, found[0].offset);
+  return target;
+}
 
-      // On config, the pointers can be set.
-      if (rc >= 0) {
-        for (int i = 0; i < x->config.adcs + x->config.triggers; i++) {
-          x->event.trace[i] = &x->event.traces[2 + i * (x->config.eventsamples + 2)];
-          x->event.theader[i] = &x->event.traces[i * (x->config.eventsamples + 2)];
-        }
-      }
-    break;
 
-    case FCIOEvent:
-      rc = fcio_get_event(xio, &x->event,x->config.adcs+x->config.triggers);
-    break;
+/*--- Sync markers -----------------------------------------------//
 
-    case FCIOSparseEvent:
-      rc = fcio_get_sparseevent(xio, &x->event,x->config.eventsamples+2);
-    break;
+Writers with FCIOSetSyncInterval insert an FCIOSync record every n
+records. Its single frame holds an FCIOSyncMarker, starting with the
+eight characters "FCIOSYNC", with the offsets of the governing
+FCIOConfig and latest FCIOStatus and the time of the latest event.
+FCIOReadMessage skips these records, they are not counted as records
+by the index and the trailer.
 
-    case FCIORecEvent:
-      rc = fcio_get_recevent(xio, &x->recevent);
-    break;
+Readers of mapped files find the markers by scanning for the magic,
+to continue after damaged frames (FCIOSetRecovery) and to bisect
+unindexed files in FCIOSeek with FCIOSeekTime.
 
-    case FCIOStatus:
-      rc = fcio_get_status(xio, &x->status);
-    break;
+//----------------------------------------------------------------*/
 
-    case FCIOEventHeader:
-      rc = fcio_get_eventheader(xio, &x->config, &x->event);
-    break;
+#define FCIOSyncMagic "FCIOSYNC"
+
+// updates the marker state of x with the record of entry written next
+static void fcio_sync_update(fcio_stream *x, const FCIOIndexEntry *entry)
+{
+  if (entry->tag == FCIOConfig) {
+    x->sync.config_offset = entry->offset;
+    x->sync.status_offset = -1;
+  } else if (entry->tag == FCIOStatus) {
+    x->sync.status_offset = entry->offset;
+  } else if (fcio_index_is_event(entry) && entry->pps >= 0) {
+    x->sync.eventnumber = entry->eventnumber;
+    x->sync.pps = entry->pps;
+    x->sync.ticks = entry->ticks;
   }
+  x->sync.config_generation = entry->config_generation;
+  x->sync.records++;
+  x->sync_pending++;
+}
 
-  // get implementations return status >0 on inconsistency and
-  // are expected to emit their own warning messages.
-  // we fail only on error.
-  if (rc < 0)
+static int fcio_write_sync(fcio_stream *x)
+{
+  x->sync.offset = FCIOByteCount((FCIOStream)x, 'w');
+  x->sync_pending = 0;
+  if (FCIOWriteMessage((FCIOStream)x, FCIOSync) < 0 || FCIOWrite((FCIOStream)x, sizeof(FCIOSyncMarker), &x->sync) != sizeof(FCIOSyncMarker)) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIO/fcio_write_sync/ERROR: writing the marker at offset %lld failed\n", x->sync.offset);
     return -1;
+  }
+  return 0;
+}
 
-  return tag;
+/* Finds the first FCIOSync record of a mapping starting in [from,to).
+   Returns 0 and its offset and marker, or -1 if there is none. */
+static int fcio_map_find_sync(const fcio_stream *x, size_t from, size_t to, size_t *pos, FCIOSyncMarker *marker)
+{
+  const size_t prefix = 2 * sizeof(int);  // tag and frame header before the marker
+  if (to > x->map_size)
+    to = x->map_size;
+
+  for (size_t p = from; p < to && x->map_size - p >= prefix + sizeof(FCIOSyncMarker); p++) {
+    const char *magic = memchr(x->map + p + prefix, FCIOSyncMagic[0], x->map_size - p - prefix - sizeof(FCIOSyncMarker) + 1);
+    if (!magic)
+      break;
+    p = magic - x->map - prefix;
+    if (p >= to)
+      break;
+    int header[2];
+    memcpy(header, x->map + p, sizeof(header));
+    if (header[0] == -FCIOSync && header[1] == (int)sizeof(FCIOSyncMarker) && !memcmp(magic, FCIOSyncMagic, 8)) {
+      memcpy(marker, magic, sizeof(FCIOSyncMarker));
+      *pos = p;
+      return 0;
+    }
+  }
+  return -1;
 }
 
+/* Continues reading x behind the next FCIOSync record starting at or after
+   from. Records are skipped up to the next FCIOConfig if the marker tells
+   that an FCIOConfig has been lost. Returns 0 or -1 if there is no marker. */
+static int fcio_map_resync(fcio_stream *x, size_t from)
+{
+  size_t pos;
+  FCIOSyncMarker marker;
+  if (fcio_map_find_sync(x, from, x->map_size, &pos, &marker) < 0)
+    return -1;
 
+  if (fcio_stream_debug(x) > 1)
+    fprintf(stderr, "FCIOReadMessage/WARNING: damaged frame at offset %zu, continuing at offset %zu\n", x->pos, pos);
+  size_t end = pos + 2 * sizeof(int) + sizeof(FCIOSyncMarker);
+  x->bytesskipped += end - x->pos;
+  x->pos = end;
+  if (marker.config_generation != x->configs) {
+    x->configs = marker.config_generation;
+    x->need_config = 1;
+  }
+  return 0;
+}
 
-/*=== Example reading a data with Structured I/O ==================//
+// continues at the next marker after a record failed to decode, if x is in recovery mode
+static int fcio_recover(FCIOStream x)
+{
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || !xio->recover)
+    return -1;
+  return fcio_map_resync(xio, xio->pos);
+}
 
-// only a few items are accessed by this example
+/* Finds the first event record at or after pps/ticks in a mapped file by
+   bisecting its FCIOSync records and reading the records after the last
+   marker before the time. Fills found like fcio_index_find and returns
+   the record number, -1 if no record matches or -2 if the stream is not
+   mapped, has a trailer or no FCIOSync records. */
+static int fcio_sync_find(fcio_stream *x, int pps, int ticks, FCIOIndexEntry *found)
+{
+  size_t summary_pos, entries_pos, pos;
+  int nentries;
+  FCIOSyncMarker marker, best;
+  if (x->tmio || x->fd >= 0 || fcio_map_trailer(x, &summary_pos, &entries_pos, &nentries)
+    || fcio_map_find_sync(x, FCIOMapProtocolSize, x->map_size, &pos, &marker) < 0)
+    return -2;
+
+  // markers are ordered in time, find the last one before pps/ticks
+  size_t lo = FCIOMapProtocolSize, hi = x->map_size, start = FCIOMapProtocolSize;
+  int have_best = 0;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (fcio_map_find_sync(x, mid, hi, &pos, &marker) < 0 ||
+        (marker.pps > pps || (marker.pps == pps && marker.ticks >= ticks))) {
+      hi = mid;
+    } else {
+      best = marker;
+      have_best = 1;
+      start = pos + 2 * sizeof(int) + sizeof(FCIOSyncMarker);
+      lo = pos + 1;
+    }
+  }
 
-char *fcio="datafile";
-fprintf(stderr,"plot FC250b events FCIO format %s\n",fcio);
-int iotag;
+  size_t saved_pos = x->pos, bytesread = x->bytesread, bytesskipped = x->bytesskipped;
+  int configs = x->configs, need_config = x->need_config;
+  FILE *index = x->index;
+  x->index = NULL;
+
+  const FCIOIndexEntry none = { -1, 0, 0, -1, -1, -1, 0 };
+  found[1] = found[2] = none;
+  int record = 0;
+  x->configs = 0;
+  if (have_best) {
+    record = best.records;
+    x->configs = best.config_generation;
+    if (best.config_offset >= 0) {
+      found[1].offset = best.config_offset;
+      found[1].tag = FCIOConfig;
+      found[1].config_generation = best.config_generation;
+    }
+    if (best.status_offset >= 0) {
+      found[2].offset = best.status_offset;
+      found[2].tag = FCIOStatus;
+      found[2].config_generation = best.config_generation;
+    }
+  }
 
-FCIODebug(debug);
-FCIOData *x=FCIOOpen(fcio,10000,0);
-if(!x) exit(1);
+  int target = -1;
+  FCIOIndexEntry entry;
+  x->pos = start;
+  x->need_config = 0;
+  while (target < 0 && FCIOReadIndexEntry((FCIOStream)x, &entry) > 0) {
+    if (fcio_index_is_event(&entry) && (entry.pps > pps || (entry.pps == pps && entry.ticks >= ticks))) {
+      found[0] = entry;
+      target = record;
+    } else if (entry.tag == FCIOConfig) {
+      found[1] = entry;
+      found[2] = none;
+    } else if (entry.tag == FCIOStatus) {
+      found[2] = entry;
+    }
+    record++;
+  }
 
-while((iotag=FCIOGetRecord(x))>0)
-{
-  int i;
-  switch(iotag)
-  {
-    case FCIOConfig:  // a config record
-    // do something here
-    break;
+  x->index = index;
+  x->pos = saved_pos;
+  x->bytesread = bytesread;
+  x->bytesskipped = bytesskipped;
+  x->configs = configs;
+  x->need_config = need_config;
+  if (fcio_stream_debug(x) > 3) fprintf(stderr, "FCIO/fcio_sync_find/DEBUG: record %d, reading from offset %zu\n", target, start);
+  return target;
+}
 
-    case FCIOStatus:  // a status record
-    // do something here
-    break;
 
-    case FCIOEvent:   // event record
-    // show some info
-    fprintf(stderr,"  adc       bl    isum-bl    tsum-bl   max-bl   pos\n");
-    for(i=0;i<x->config.adcs;i++)
-    {
-      // calculate baseline, integrator and trace integral
-      double bl=1.0*x->event.theader[i][0]/x->config.blprecision;
-      double intsum=1.0*x->config.sumlength/x->config.blprecision*
-         (x->event.theader[i][1]-x->event.theader[i][0]);
-      double max=0; int imax=0; double tsum=0; int i1;
-      for(i1=0;i1<x->config.eventsamples;i1++)
-      {
-        double amp=x->event.trace[i][i1]-bl;
-        if(amp>max) max=amp, imax=i1;
-        tsum+=amp;
-      }
-      if(max>0) fprintf(stderr,"%5d %8.2f %10g %10.2f %8.2f %5d\n",
-         i,bl,intsum,tsum,max,imax);
-    }
-    break;
+/*=== Function ===================================================*/
 
-    case FCIOSparseEvent:  // sparse event record, also compatible with FCIOEvent
-    for (j = 0; j < x->event.num_traces; j++)
-    {
-      i = x->event.trace_list[j];
-      double bl=1.0*x->event.theader[i][0]/x->config.blprecision;
-      double intsum=1.0*x->config.sumlength/x->config.blprecision*
-         (x->event.theader[i][1]-x->event.theader[i][0]);
-      double max=0; int imax=0; double tsum=0; int i1;
-      for(i1=0;i1<x->config.eventsamples;i1++)
-      {
-        double amp=x->event.trace[i][i1]-bl;
-        if(amp>max) max=amp, imax=i1;
-        tsum+=amp;
-      }
-      if(max>0) fprintf(stderr,"%5d %8.2f %10g %10.2f %8.2f %5d\n",
-         i,bl,intsum,tsum,max,imax);
-    }
+int FCIOSetSyncInterval(FCIOStream x, int records)
 
-    case FCIORecEvent:  // reconstructed event record
-    // do something here
-    break;
+/*--- Description ------------------------------------------------//
 
-    default:
-    fprintf(stderr,"record tag %d... skipped \n",iotag);
-    break;
+Writes an FCIOSync record before every records-th record written to
+x, records <= 0 disables the markers. Set it before the first record
+is written, the markers describe the records written afterwards.
+Readers skip FCIOSync records, they allow readers of damaged files
+to continue at the next marker (FCIOSetRecovery) and FCIOSeek to
+bisect unindexed files by time.
+
+Returns the previous interval or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || (!xio->tmio && xio->fd < 0))
+    return -1;
+  int old = xio->sync_interval;
+  xio->sync_interval = records > 0 ? records : 0;
+  if (xio->sync_interval && !old) {
+    memset(&xio->sync, 0, sizeof(xio->sync));
+    memcpy(xio->sync.magic, FCIOSyncMagic, 8);
+    xio->sync.config_offset = -1;
+    xio->sync.status_offset = -1;
+    xio->sync.config_generation = xio->configs;
+    xio->sync.eventnumber = -1;
+    xio->sync.pps = -1;
+    xio->sync.ticks = -1;
+    xio->sync_pending = 0;
+    fcio_index_reset_hint(xio);
   }
+  return old;
 }
 
-fprintf(stderr,"end of file \n");
-FCIOClose(x);
 
+/*=== Function ===================================================*/
 
-//----------------------------------------------------------------*/
-
+int FCIOSetRecovery(FCIOStream x, int enable)
 
+/*--- Description ------------------------------------------------//
 
-/*=== FCIO Low Level I/O functions ================================//
+Enables (enable != 0) or disables the recovery of the stream x,
+which must be connected with mmap://. Damaged frames, i.e. frames
+exceeding the file or tags > 31, and records FCIOGetRecord fails
+to decode make the reader continue behind the next FCIOSync record
+instead of ending the stream. If an FCIOConfig has been lost the
+records up to the next FCIOConfig are skipped as well.
+The skipped bytes are counted by FCIOByteCount(x, 's').
 
-Functions for composing and transferring messages within the FCIO
-stream based I/O system.
+Note that damaged frames within the file bounds are not detected,
+tmio streams end at the first damaged frame.
 
-Please refer to the first part FCIO Structured I/O
-if you are reading FlashCam data only and skip the rest of this document
+Returns the previous setting or <0 on error.
 
 //----------------------------------------------------------------*/
+{
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || xio->tmio || xio->fd >= 0) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOSetRecovery/ERROR: recovery requires a stream connected with mmap://\n");
+    return -1;
+  }
+  int old = xio->recover;
+  xio->recover = enable ? 1 : 0;
+  return old;
+}
 
 
-/*=== Function ===================================================*/
+/*--- Asynchronous writer ----------------------------------------//
 
-FCIOStream FCIOConnect(const char *name, int direction, int timeout, int buffer)
+FCIOSetAsyncWriter decouples the caller from the endpoint: records
+composed by FCIOWriteMessage, FCIOWrite, FCIOWriteFrames and the
+FCIOPut* functions are copied into the slots of a single producer,
+single consumer ring in the tmio frame layout. A writer thread
+replays them with the same functions on the stream, which it
+recognizes by its thread id, and flushes whenever the ring runs
+empty. head and tail are only advanced with atomics; the mutex and
+condition are only taken to sleep on an empty or full ring.
 
-/*--- Description ------------------------------------------------//
+//----------------------------------------------------------------*/
 
-Connects to a file, server or client for FCIO data transfer.
+typedef struct {
+  char *data;            // frames in the tmio layout, headers are negated tags or sizes
+  size_t len;
+  size_t size;
+  FCIOIndexEntry hint;   // index hint of the record, see fcio_index_hint
+} fcio_async_slot;
+
+struct fcio_async {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int sleepers;               // threads waiting on cond
+  fcio_async_slot *slots;
+  int depth;
+  int policy;                 // FCIOAsyncPolicy
+  unsigned long head;         // records committed by the caller
+  unsigned long tail;         // records taken from the queue by the thread
+  int open;                   // the caller composes into slots[head % depth]
+  int dropping;               // the record of the caller is dropped
+  int stop;
+  int error;                  // a write of the thread failed
+  unsigned long failed;       // tail of the first record not written, set before error
+  FCIOIndexEntry hint;        // index hint for the next record of the caller
+  size_t base;                // FCIOByteCount when the writer was started
+  size_t accepted;            // bytes committed since
+  int max_queued;
+  long long dropped;
+  long long stalls;
+  double stall_time;
+};
+
+static int fcio_async_caller(const fcio_stream *x)
+{
+  return x->async && !pthread_equal(pthread_self(), x->async->thread);
+}
 
-name is the connection endpoint of the underlying TMIO/BUFIO
-library. Please refer to the documentation of TMIO/BUFIO for
-more information.
+static FCIOIndexEntry *fcio_async_hint(fcio_stream *x)
+{
+  return fcio_async_caller(x) ? &x->async->hint : &x->hint;
+}
 
-Creates a connection or file, with name being a plain file name, "-" for
-stdout, or
+static size_t fcio_async_accepted(fcio_stream *x)
+{
+  return x->async->base + __atomic_load_n(&x->async->accepted, __ATOMIC_RELAXED);
+}
 
-tcp://listen/port           to listen to port at all interfaces
-tcp://listen/port/nodename  to listen to port at nodename interface
-tcp://connect/port/nodename to connect to port and nodename
+static void fcio_async_wake(fcio_async *a)
+{
+  if (__atomic_load_n(&a->sleepers, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&a->lock);
+    pthread_cond_broadcast(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+  }
+}
 
-Any other name not starting with tcp: is treated as a file name.
+// sleeps until the ring is not full (full != 0) or not empty, or the writer is stopped
+static void fcio_async_sleep(fcio_async *a, int full)
+{
+  pthread_mutex_lock(&a->lock);
+  __atomic_add_fetch(&a->sleepers, 1, __ATOMIC_SEQ_CST);
+  for (;;) {
+    unsigned long queued = __atomic_load_n(&a->head, __ATOMIC_SEQ_CST) - __atomic_load_n(&a->tail, __ATOMIC_SEQ_CST);
+    if ((full ? queued < (unsigned long)a->depth : queued > 0) || __atomic_load_n(&a->stop, __ATOMIC_SEQ_CST))
+      break;
+    pthread_cond_wait(&a->cond, &a->lock);
+  }
+  __atomic_sub_fetch(&a->sleepers, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&a->lock);
+}
 
-direction must be an character 'r' or 'w' to specify the direction
-of read and write,
+static int fcio_async_replay(fcio_stream *x, const fcio_async_slot *slot)
+{
+  if (x->index || x->trailer || x->sync_interval)
+    x->hint = slot->hint;
+  for (size_t pos = 0; pos < slot->len; ) {
+    int header;
+    memcpy(&header, slot->data + pos, sizeof(int));
+    pos += sizeof(int);
+    if (header < 0) {
+      if (FCIOWriteMessage((FCIOStream)x, -header) < 0)
+        return -1;
+    } else {
+      if (FCIOWrite((FCIOStream)x, header, slot->data + pos) != header)
+        return -1;
+      pos += header;
+    }
+  }
+  return 0;
+}
 
-timeout specifies the time to wait for a connection in milliseconds.
-Specify 0 to return immediately (within the typical delays imposed by the
-connection and OS) or -1 to block indefinitely.
+static void *fcio_async_run(void *arg)
+{
+  fcio_stream *x = (fcio_stream *)arg;
+  fcio_async *a = x->async;
+  unsigned long tail = a->tail;
+  unsigned long flushed = tail;  // records up to the last flush
+
+  // a->thread is set by FCIOSetAsyncWriter while holding the lock
+  pthread_mutex_lock(&a->lock);
+  pthread_mutex_unlock(&a->lock);
+
+  for (;;) {
+    if (tail == __atomic_load_n(&a->head, __ATOMIC_ACQUIRE)) {
+      // records since the last flush may be lost if the flush fails
+      if (flushed != tail && !__atomic_load_n(&a->error, __ATOMIC_RELAXED) && FCIOFlush((FCIOStream)x) < 0) {
+        a->failed = flushed;
+        __atomic_store_n(&a->error, 1, __ATOMIC_RELEASE);
+      }
+      flushed = tail;
+      if (__atomic_load_n(&a->stop, __ATOMIC_SEQ_CST) && tail == __atomic_load_n(&a->head, __ATOMIC_ACQUIRE))
+        break;
+      fcio_async_sleep(a, 0);
+      continue;
+    }
 
-buffer may be used to initialize the size (in kB) of the protocol buffers. If 0
-is specified a default value will be used.
+    // after an error the queue is still drained, so that the caller never blocks for good
+    fcio_async_slot *slot = &a->slots[tail % a->depth];
+    if (!__atomic_load_n(&a->error, __ATOMIC_RELAXED) && fcio_async_replay(x, slot) < 0) {
+      if (fcio_stream_debug(x)) fprintf(stderr, "FCIO/fcio_async_run/ERROR: writing a queued record failed\n");
+      a->failed = tail;
+      __atomic_store_n(&a->error, 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&a->tail, ++tail, __ATOMIC_SEQ_CST);
+    fcio_async_wake(a);
+  }
+  return NULL;
+}
+
+static void fcio_async_commit(fcio_stream *x)
+{
+  fcio_async *a = x->async;
+  if (a->open) {
+    unsigned long head = a->head + 1;
+    __atomic_add_fetch(&a->accepted, a->slots[a->head % a->depth].len, __ATOMIC_RELAXED);
+    __atomic_store_n(&a->head, head, __ATOMIC_SEQ_CST);
+    int queued = head - __atomic_load_n(&a->tail, __ATOMIC_SEQ_CST);
+    if (queued > a->max_queued)
+      a->max_queued = queued;
+    fcio_async_wake(a);
+  }
+  a->open = 0;
+  a->dropping = 0;
+}
+
+// starts a slot for the next record, returns 1 if the record is dropped
+static int fcio_async_open(fcio_stream *x)
+{
+  fcio_async *a = x->async;
+  fcio_async_commit(x);
+
+  if (a->head - __atomic_load_n(&a->tail, __ATOMIC_SEQ_CST) >= (unsigned long)a->depth) {
+    if (a->policy == FCIOAsyncDrop) {
+      a->dropped++;
+      a->dropping = 1;
+      a->hint.eventnumber = a->hint.pps = a->hint.ticks = -1;
+      return 1;
+    }
+    double start = elapsed_time(0.0);
+    fcio_async_sleep(a, 1);
+    a->stalls++;
+    a->stall_time += elapsed_time(start);
+  }
 
-Returns a FCIOStream or NULL on error.
+  fcio_async_slot *slot = &a->slots[a->head % a->depth];
+  slot->len = 0;
+  slot->hint = a->hint;
+  a->hint.eventnumber = a->hint.pps = a->hint.ticks = -1;
+  a->open = 1;
+  return 0;
+}
 
-//----------------------------------------------------------------*/
+// queues a record tag (tag > 0) or a data frame of size bytes
+static int fcio_async_write(fcio_stream *x, int tag, const void *data, size_t size)
 {
-  const char *proto="FlashCamV1";
-  if(name==0) {
-    if(debug) fprintf(stderr,"FCIOConnect/ERROR: endpoint not given, output will be discarded \n");
-    return NULL;
-  }
+  fcio_async *a = x->async;
+  if (__atomic_load_n(&a->error, __ATOMIC_RELAXED))
+    return -1;
+  if (tag > 0 ? fcio_async_open(x) : (a->dropping || (!a->open && fcio_async_open(x))))
+    return 0;
 
-  int tmio_debug = debug-3;
-  tmio_stream *x=tmio_init(proto, timeout, buffer, tmio_debug<0?0:tmio_debug);
-  if(x==0) {
-    if(debug) fprintf(stderr,"FCIOConnect/ERROR: init of tmio structure failed\n");
-    return NULL;
+  int header = tag > 0 ? -tag : (int)size;
+  fcio_async_slot *slot = &a->slots[a->head % a->depth];
+  if (slot->len + sizeof(int) + size > slot->size) {
+    size_t size_new = 2 * slot->size > slot->len + sizeof(int) + size ? 2 * slot->size : slot->len + sizeof(int) + size;
+    char *data_new = (char *)realloc(slot->data, size_new);
+    if (!data_new) {
+      // the record is dropped as a whole, a truncated record is never queued
+      if (fcio_stream_debug(x)) fprintf(stderr, "FCIO/fcio_async_write/ERROR: can not grow a queue slot to %zu bytes, record dropped\n", size_new);
+      slot->len = 0;
+      a->open = 0;
+      a->dropping = 1;
+      a->dropped++;
+      return -1;
+    }
+    slot->data = data_new;
+    slot->size = size_new;
   }
+  memcpy(slot->data + slot->len, &header, sizeof(int));
+  if (size)
+    memcpy(slot->data + slot->len + sizeof(int), data, size);
+  slot->len += sizeof(int) + size;
+  return 0;
+}
 
-  int rc=-1;
-  if(direction=='w') rc=tmio_create(x, name, timeout);
-  else if(direction=='r') rc=tmio_open(x, name, timeout);
-  if(rc<0) {
-    if(debug) fprintf(stderr,"FCIOConnect/ERROR: can not connect to stream %s, %s\n",
-        name,tmio_status_str(x));
-    tmio_delete(x);
-    return NULL;
-  }
+// drains the queue and stops the thread, returns <0 if a write of the thread failed
+static int fcio_async_stop(fcio_stream *x)
+{
+  fcio_async *a = x->async;
+  if (!a)
+    return 0;
 
-  if(debug>3) fprintf(stderr,"FCIOConnect/DEBUG: %s connected, proto %s \n",name,proto);
-  return (FCIOStream)x;
+  fcio_async_commit(x);
+  __atomic_store_n(&a->stop, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&a->lock);
+  pthread_cond_broadcast(&a->cond);
+  pthread_mutex_unlock(&a->lock);
+  pthread_join(a->thread, NULL);
+
+  int rc = a->error ? -1 : 0;
+  for (int i = 0; i < a->depth; i++)
+    free(a->slots[i].data);
+  free(a->slots);
+  pthread_cond_destroy(&a->cond);
+  pthread_mutex_destroy(&a->lock);
+  free(a);
+  x->async = NULL;
+  return rc;
 }
 
 
 /*=== Function ===================================================*/
 
-int FCIODisconnect(FCIOStream x)
+int FCIOSetAsyncWriter(FCIOStream x, int depth, int policy)
 
 /*--- Description ------------------------------------------------//
 
-Disconnects to any FCIOStream and closes any communication to
-the endpoint.
-
-Returns 0 on success and <0 on error.
+Writes the records of a stream connected for writing in a
+dedicated thread, so that a stalled endpoint (e.g. TCP back
+pressure or a slow disk) does not block the caller.
+
+Records written with FCIOWriteMessage/FCIOWrite/FCIOWriteFrames
+and the FCIOPut* functions are copied into a queue of depth
+records, a record ends with FCIOFlush or the next FCIOWriteMessage.
+FCIOFlush returns without waiting for the write, the thread
+flushes the endpoint whenever the queue runs empty. If the queue
+is full when a record starts, the caller waits (policy
+FCIOAsyncBlock) or the record is dropped (FCIOAsyncDrop). A
+record is also dropped if its slot can not grow, the call then
+returns <0.
+FCIOByteCount(x, 'w') counts the bytes queued.
+
+Index files, trailers and sync markers must be set up before,
+they are written by the thread with the offsets in the stream.
+depth 0 drains the queue and stops the thread, as does
+FCIODisconnect. See FCIOGetAsyncStats for the counters.
+
+Returns the previous depth (0 if disabled) or <0 on error or if
+a write of the thread failed.
 
 //----------------------------------------------------------------*/
 {
-  if (!x) return -1;
-  tmio_stream *xio=(tmio_stream *)x;
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || !xio->writable || depth < 0 || (policy != FCIOAsyncBlock && policy != FCIOAsyncDrop) || (xio->async && !fcio_async_caller(xio))) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOSetAsyncWriter/ERROR: stream not writable or invalid depth %d or policy %d\n", depth, policy);
+    return -1;
+  }
 
-  tmio_delete(xio); // always returns 0
-  if (debug>3) fprintf(stderr,"FCIODisconnect/DEBUG: stream closed\n");
-  return 0;
+  int old = xio->async ? xio->async->depth : 0;
+  if (fcio_async_stop(xio) < 0)
+    return -1;
+  if (!depth)
+    return old;
+
+  fcio_async *a = (fcio_async *)calloc(1, sizeof(fcio_async));
+  if (a)
+    a->slots = (fcio_async_slot *)calloc(depth, sizeof(fcio_async_slot));
+  if (!a || !a->slots) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOSetAsyncWriter/ERROR: can not allocate a queue of %d records\n", depth);
+    free(a);
+    return -1;
+  }
+  a->depth = depth;
+  a->policy = policy;
+  a->hint.eventnumber = a->hint.pps = a->hint.ticks = -1;
+  a->base = FCIOByteCount(x, 'w');
+  pthread_mutex_init(&a->lock, NULL);
+  pthread_cond_init(&a->cond, NULL);
+  xio->async = a;
+  pthread_mutex_lock(&a->lock);
+  int rc = pthread_create(&a->thread, NULL, fcio_async_run, xio);
+  pthread_mutex_unlock(&a->lock);
+  if (rc) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOSetAsyncWriter/ERROR: can not start the writer thread\n");
+    xio->async = NULL;
+    pthread_cond_destroy(&a->cond);
+    pthread_mutex_destroy(&a->lock);
+    free(a->slots);
+    free(a);
+    return -1;
+  }
+  return old;
 }
 
 
 /*=== Function ===================================================*/
 
-int FCIOTimeout(FCIOStream x, int timeout_ms)
+int FCIOGetAsyncStats(FCIOStream x, FCIOAsyncStats *stats)
 
 /*--- Description ------------------------------------------------//
 
-Sets the timeout for I/O operations in milliseconds.
+Fills stats with the counters of the writer thread started by
+FCIOSetAsyncWriter. Each record committed by the caller is either
+queued, written, discarded after a failed write or dropped.
 
-Returns the previously set timeout.
+Returns 0 on success or <0 on error or if the stream has no
+writer thread.
 
 //----------------------------------------------------------------*/
 {
-  return tmio_timeout((tmio_stream *) x, timeout_ms);
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || !xio->async || !stats)
+    return -1;
+
+  fcio_async *a = xio->async;
+  unsigned long tail = __atomic_load_n(&a->tail, __ATOMIC_SEQ_CST);
+  memset(stats, 0, sizeof(FCIOAsyncStats));
+  stats->depth = a->depth;
+  stats->queued = a->head - tail;
+  stats->max_queued = a->max_queued;
+  stats->error = __atomic_load_n(&a->error, __ATOMIC_ACQUIRE);
+  // all records taken from the queue from the failed one on are discarded
+  stats->written = (stats->error && a->failed < tail) ? a->failed : tail;
+  stats->discarded = tail - stats->written;
+  stats->dropped = a->dropped;
+  stats->stalls = a->stalls;
+  stats->stall_time = a->stall_time;
+  return 0;
 }
 
 
@@ -1352,13 +5039,46 @@ Returns 0 on success or <0 on error
   if (!x) return -1;
   // tmio_write_tag checks for tag validity itself
 
-  tmio_stream *xio=(tmio_stream *)x;
+  fcio_stream *stream = (fcio_stream *)x;
+  if (fcio_async_caller(stream))
+    return tag > 0 ? fcio_async_write(stream, tag, NULL, 0) : -1;
+  if (stream->sync_interval && tag > 0 && tag != FCIOSync &&
+      stream->sync_pending >= stream->sync_interval && fcio_write_sync(stream) < 0)
+    return -1;
+  if (tag == FCIOConfig)
+    stream->configs++;
+  if ((stream->index || stream->trailer || stream->sync_interval) && tag > 0 && tag != FCIOSync) {
+    FCIOIndexEntry entry = stream->hint;
+    entry.offset = FCIOByteCount(x, 'w');
+    entry.tag = tag;
+    entry.config_generation = stream->configs;
+    fcio_index_reset_hint(stream);
+    if (stream->sync_interval)
+      fcio_sync_update(stream, &entry);
+    if (stream->index && fcio_index_append(stream, &entry) < 0)
+      return -1;
+    if (stream->trailer && fcio_trailer_append(stream, &entry) < 0)
+      return -1;
+  }
+
+  tmio_stream *xio=((fcio_stream *)x)->tmio;
+  if (!xio && ((fcio_stream *)x)->fd >= 0) {
+    if (tag <= 0 || fcio_writev_append((fcio_stream *)x, -tag, NULL, 0) < 0) {
+      if (fcio_stream_debug(x)) fprintf(stderr,"FCIOWriteMessage/ERROR: writing tag %d \n",tag);
+      return -1;
+    }
+    return 0;
+  }
+  if (!xio) {
+    if (fcio_stream_debug(x)) fprintf(stderr,"FCIOWriteMessage/ERROR: stream is read-only\n");
+    return -1;
+  }
 
-  if (debug > 5)
+  if (fcio_stream_debug(x) > 5)
     fprintf(stderr,"FCIOWriteMessage/DEBUG: tag %d @ %p \n",tag,(void*)xio);
 
   if (tmio_write_tag(xio,tag) ) {
-    if (debug && (tmio_status(xio)<0))
+    if (fcio_stream_debug(x) && (tmio_status(xio)<0))
       fprintf(stderr,"FCIOWriteMessage/ERROR: writing tag %d \n",tag);
     return -1;
   }
@@ -1380,45 +5100,164 @@ Returns size on success, 0 on size < 0 or <0 on error
 //----------------------------------------------------------------*/
 {
   if (!x) {
-    if (debug) fprintf(stderr, "FCIOWrite/ERROR: output not connected\n");
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOWrite/ERROR: output not connected\n");
     return -1;
   }
   if (!data) {
-    if (debug) fprintf(stderr, "FCIOWrite/ERROR: data not valid (null pointer)\n");
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOWrite/ERROR: data not valid (null pointer)\n");
     return -1;
   }
   // tmio_write_data checks on size < 0 and returns 0
   // don't need to check here.
 
-  tmio_stream *xio=(tmio_stream *)x;
+  if (fcio_async_caller((fcio_stream *)x)) {
+    if (size < 0)
+      return 0;
+    return fcio_async_write((fcio_stream *)x, 0, data, size) < 0 ? -1 : size;
+  }
+
+  tmio_stream *xio=((fcio_stream *)x)->tmio;
+  if (!xio && ((fcio_stream *)x)->fd >= 0) {
+    if (size < 0)
+      return 0;
+    if (fcio_writev_append((fcio_stream *)x, size, data, size) < 0) {
+      if (fcio_stream_debug(x)) fprintf(stderr,"FCIOWrite/ERROR: writing %d bytes failed\n", size);
+      return -1;
+    }
+    return size;
+  }
+  if (!xio) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOWrite/ERROR: stream is read-only\n");
+    return -1;
+  }
 
   int written_size = tmio_write_data(xio, data, size);
-  if (debug > 5)
+  if (fcio_stream_debug(x) > 5)
     fprintf(stderr,"FCIOWrite/DEBUG: size %d/%d @ %p \n", written_size, size,(void*)xio);
-  if (debug && written_size != size)
+  if (fcio_stream_debug(x) && written_size != size)
     fprintf(stderr,"FCIOWrite/ERROR: %s with size %d/%d\n", tmio_status_str(xio), written_size, size);
 
   return written_size;
 }
 
 
+/*=== Function ===================================================*/
+
+int FCIOWriteFrames(FCIOStream x, int nframes, const FCIOFrame *frames)
+
+/*--- Description ------------------------------------------------//
+
+Writes nframes data items, equivalent to calling FCIOWrite for each
+of the frames in order. The payloads are only referenced during the
+call.
+
+For streams connected with writev:// all frames and the pending
+frames written before (e.g. the record tag) are passed to the
+kernel with one writev call without copying. Other streams write
+the frames one by one, uring:// streams copy them into their
+buffers.
+
+Returns the number of payload bytes written or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio = (fcio_stream *)x;
+  if (!xio || nframes < 0 || (nframes && !frames)) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOWriteFrames/ERROR: output not connected or frames not valid\n");
+    return -1;
+  }
+
+  // the uring backend and the writer thread copy the frames into their buffers
+  int total = 0;
+  if (xio->fd < 0 || xio->uring || fcio_async_caller(xio)) {
+    for (int i = 0; i < nframes; i++) {
+      if (FCIOWrite(x, frames[i].size, (void *)frames[i].data) != frames[i].size)
+        return -1;
+      total += frames[i].size;
+    }
+    return total;
+  }
+
+  if (nframes > xio->max_frames) {
+    free(xio->iov);
+    free(xio->headers);
+    xio->iov = (struct iovec *)malloc((2 * (size_t)nframes + 1) * sizeof(struct iovec));
+    xio->headers = (int *)malloc(nframes * sizeof(int));
+    xio->max_frames = (xio->iov && xio->headers) ? nframes : 0;
+    if (!xio->max_frames) {
+      if (fcio_stream_debug(x)) fprintf(stderr, "FCIOWriteFrames/ERROR: can not allocate %d io vectors\n", nframes);
+      return -1;
+    }
+  }
+
+  int niov = 0;
+  if (xio->wbuf_len) {
+    xio->iov[niov].iov_base = xio->wbuf;
+    xio->iov[niov++].iov_len = xio->wbuf_len;
+  }
+  size_t bytes = xio->wbuf_len;
+  for (int i = 0; i < nframes; i++) {
+    if (frames[i].size < 0 || (frames[i].size && !frames[i].data))
+      return -1;
+    xio->headers[i] = frames[i].size;
+    xio->iov[niov].iov_base = &xio->headers[i];
+    xio->iov[niov++].iov_len = sizeof(int);
+    if (frames[i].size) {
+      xio->iov[niov].iov_base = (void *)frames[i].data;
+      xio->iov[niov++].iov_len = frames[i].size;
+    }
+    total += frames[i].size;
+    bytes += sizeof(int) + frames[i].size;
+  }
+
+  if (fcio_writev_all(xio->fd, xio->iov, niov) < 0) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOWriteFrames/ERROR: writev of %d frames failed\n", nframes);
+    return -1;
+  }
+  xio->wbuf_len = 0;
+  xio->byteswritten += bytes;
+  if (fcio_stream_debug(x) > 5)
+    fprintf(stderr,"FCIOWriteFrames/DEBUG: %d frames %zu bytes @ %p \n", nframes, bytes, (void*)xio);
+  return total;
+}
+
+
 /*=== Function ===================================================*/
 
 int FCIOFlush(FCIOStream x)
 
 /*--- Description ------------------------------------------------//
 
-Flush all composed messages.
+Flush all composed messages. Streams connected with uring://
+submit the pending frames and return without waiting for the write,
+errors of asynchronous writes are returned by the following calls,
+for the last writes by FCIODisconnect.
+Streams connected with direct:// write the unaligned end of the
+frames padded with zeros to a full block, which is written again by
+the next flush, the file is truncated to its size on FCIODisconnect.
 
 Returns 0 on success or -1 on error.
 
 //----------------------------------------------------------------*/
 {
   if (!x) return -1;
-  tmio_stream *xio = (tmio_stream *)x;
+  if (fcio_async_caller((fcio_stream *)x)) {
+    fcio_async_commit((fcio_stream *)x);
+    return __atomic_load_n(&((fcio_stream *)x)->async->error, __ATOMIC_RELAXED) ? -1 : 0;
+  }
+  tmio_stream *xio = ((fcio_stream *)x)->tmio;
+  if (!xio && ((fcio_stream *)x)->fd >= 0) {
+    if (fcio_writev_flush((fcio_stream *)x) < 0) {
+      if (fcio_stream_debug(x)) fprintf(stderr,"FCIOFlush/ERROR: writing pending frames failed\n");
+      return -1;
+    }
+    return 0;
+  }
+  if (!xio)
+    return 0;
 
   if (tmio_flush(xio)) {
-    if (debug)
+    if (fcio_stream_debug(x))
       fprintf(stderr,"FCIOFlush/ERROR: %s\n",tmio_status_str(xio));
     return -1;
   }
@@ -1439,20 +5278,30 @@ int FCIOReadMessage(FCIOStream x)
 
 /*--- Description ------------------------------------------------//
 
-Read the message tag starting a record.
+Read the message tag starting a record. FCIOSync and FCIOTrailer
+records are skipped.
 
 Returns the tag (>0) on success or 0 on timeout and <0 on error.
 
 //----------------------------------------------------------------*/
 {
   if (!x) return -1;
-  tmio_stream *xio=(tmio_stream *)x;
+  fcio_stream *xio=(fcio_stream *)x;
+  int tag;
+  do {
+    tag = xio->tmio ? tmio_read_tag(xio->tmio) : fcio_map_read_tag(xio);
+  } while (tag == FCIOSync || tag == FCIOTrailer);
+  if (xio->readahead || xio->drop_behind)
+    fcio_advise(xio);
+  if (tag == FCIOConfig)
+    xio->configs++;
+  if (!xio->tmio)
+    return tag;
 
-  int tag = tmio_read_tag(xio);
-  if (debug > 5)
+  if (fcio_stream_debug(x) > 5)
     fprintf(stderr,"FCIOReadMessage/DEBUG: got tag %d @ %p\n", tag, (void*)xio);
-  if (debug && tag < 0)
-    fprintf(stderr, "FCIOReadMessage/ERROR: %s tag %d @ %p\n", tmio_status_str(xio), tag, (void*)xio);
+  if (fcio_stream_debug(x) && tag < 0)
+    fprintf(stderr, "FCIOReadMessage/ERROR: %s tag %d @ %p\n", tmio_status_str(xio->tmio), tag, (void*)xio);
   return tag;
 }
 
@@ -1471,20 +5320,28 @@ Returns tmio frame_size (in bytes) on success or <0 on error
 {
   if (!x) return -1;
 
-  tmio_stream *xio=(tmio_stream *)x;
+  fcio_stream *xio=(fcio_stream *)x;
 
-  int frame_size = tmio_read_data(xio, data, size);
-  if (debug > 5)
+  int frame_size;
+  if (xio->tmio) {
+    frame_size = tmio_read_data(xio->tmio, data, size);
+  } else {
+    const char *payload = NULL;
+    frame_size = size < 0 ? -2 : fcio_map_read_frame(xio, &payload);
+    if (frame_size > 0)
+      memcpy(data, payload, frame_size < size ? frame_size : size);
+  }
+  if (fcio_stream_debug(x) > 5)
     fprintf(stderr,"FCIORead/DEBUG: size %d/%d @ %p \n",
       frame_size, size, (void*)xio);
 
-  if (debug) {
-    if (debug > 1 && frame_size == -2) {
+  if (fcio_stream_debug(x)) {
+    if (fcio_stream_debug(x) > 1 && frame_size == -2) {
       fprintf(stderr, "FCIORead/WARNING: got unexpected tag or read size < 0 (%d)\n", size);
     }
     if (frame_size == -1)
       fprintf(stderr,"FCIORead/ERROR: %s size %d/%d @ %p\n",
-        tmio_status_str(xio), frame_size,size, (void*)xio);
+        xio->tmio ? tmio_status_str(xio->tmio) : "end of mapped file", frame_size,size, (void*)xio);
   }
   return frame_size;
 }
@@ -1521,10 +5378,16 @@ typedef struct {
   int cur_status;
   int cur_recevent;
 
-  fcio_config *configs;
-  fcio_event *events;
-  fcio_status *statuses;
-  fcio_recevent *recevents;
+  fcio_config **configs;
+  fcio_event **events;
+  fcio_status **statuses;
+  fcio_recevent **recevents;
+
+  int alloc_flags;
+  int decode_flags;
+  int channel_masked;
+  unsigned int channel_mask[(FCIOMaxChannels + 31) / 32];
+  void *prefetch;  // background decoding, see FCIOSetStatePrefetch
 } FCIOStateReader;
 
 //----------------------------------------------------------------*/
@@ -1532,6 +5395,7 @@ typedef struct {
 
 // Forward declarations
 int FCIOSelectStateTag(FCIOStateReader *reader, int tag);
+static void fcio_prefetch_stop(FCIOStateReader *reader, int release);
 
 
 /*=== Function ===================================================*/
@@ -1544,13 +5408,25 @@ FCIOStateReader *FCIOCreateStateReader(
 
 /*--- Description ------------------------------------------------//
 
+Connects to peer (see FCIOOpen) and keeps the last state_buffer_depth
+states in a ring buffer.
+
+The record buffers of the ring are allocated when a record of the
+corresponding tag is read for the first time; the trace storage
+of events is sized from the config governing the event.
+Records of deselected tags (see FCIODeselectStateTag) are skipped
+without decoding their payload and do not update the states
+following them. FCIOConfig records are always buffered.
+FCIOSetStatePrefetch moves reading and decoding to a background
+thread.
+
 Returns a FCIOStateReader struct on success or NULL on error.
 
 //----------------------------------------------------------------*/
 {
   FCIOStateReader *reader = (FCIOStateReader *) calloc(1, sizeof(FCIOStateReader));
   if (!reader) {
-    if (debug)
+    if (fcio_debug())
       fprintf(stderr,"FCIOCreateStateReader/ERROR: failed to allocate structure\n");
 
     return (FCIOStateReader *) NULL;
@@ -1559,7 +5435,7 @@ Returns a FCIOStateReader struct on success or NULL on error.
   reader->timeout = io_timeout;
   reader->stream = (void *) FCIOConnect(peer, 'r', io_timeout, io_buffer_size);
   if (!reader->stream) {
-    if (debug)
+    if (fcio_debug())
       fprintf(stderr, "FCIOCreateStateReader/ERROR: failed to connect to data source %s\n", peer ? peer : "(NULL)");
 
     free(reader);
@@ -1568,12 +5444,14 @@ Returns a FCIOStateReader struct on success or NULL on error.
 
   FCIOSelectStateTag(reader, 0);
 
+  // The record buffers are allocated on first use by get_next_record
   reader->max_states = state_buffer_depth + 1;
-  reader->states = (FCIOState*) calloc(state_buffer_depth + 1, sizeof(FCIOState));
-  reader->configs = (fcio_config*) calloc(state_buffer_depth + 1, sizeof(fcio_config));
-  reader->events = (fcio_event*) calloc(state_buffer_depth + 1, sizeof(fcio_event));
-  reader->statuses = (fcio_status*) calloc(state_buffer_depth + 1, sizeof(fcio_status));
-  reader->recevents = (fcio_recevent*) calloc(state_buffer_depth + 1, sizeof(fcio_recevent));
+  reader->alloc_flags = FCIOAllocDynamic;
+  reader->states = (FCIOState*) calloc(reader->max_states, sizeof(FCIOState));
+  reader->configs = (fcio_config**) calloc(reader->max_states, sizeof(fcio_config*));
+  reader->events = (fcio_event**) calloc(reader->max_states, sizeof(fcio_event*));
+  reader->statuses = (fcio_status**) calloc(reader->max_states, sizeof(fcio_status*));
+  reader->recevents = (fcio_recevent**) calloc(reader->max_states, sizeof(fcio_recevent*));
 
   if (reader->states && reader->configs && reader->events && reader->statuses && reader->recevents)
     return reader;  // Success
@@ -1608,7 +5486,18 @@ Returns 0 on success or <0 on error.
   if (!reader)
     return -1;
 
+  fcio_prefetch_stop(reader, 1);
   FCIODisconnect(reader->stream);
+  for (int i = 0; i < reader->max_states; i++) {
+    if (reader->recevents[i])
+      fcio_free_pulses(reader->recevents[i]);
+    if (reader->events[i])
+      fcio_free_traces(reader->events[i]);
+    fcio_buffer_free(reader->recevents[i]);
+    fcio_buffer_free(reader->statuses[i]);
+    fcio_buffer_free(reader->events[i]);
+    fcio_buffer_free(reader->configs[i]);
+  }
   free(reader->recevents);
   free(reader->statuses);
   free(reader->events);
@@ -1662,6 +5551,71 @@ Returns 0 on success or <0 on error.
 }
 
 
+/*=== Function ===================================================*/
+
+int FCIOSetStateAllocFlags(FCIOStateReader *reader, int alloc_flags)
+
+/*--- Description ------------------------------------------------//
+
+Sets the FCIOAllocFlags used for the trace and pulse storage of
+the state buffers, default is FCIOAllocDynamic. Buffers are
+re-allocated with the new flags when they are filled the next time.
+
+Returns the previously set flags or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!reader)
+    return -1;
+
+  int old = reader->alloc_flags;
+  reader->alloc_flags = alloc_flags;
+  return old;
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIOSetStateDecodeFlags(FCIOStateReader *reader, int decode_flags)
+
+/*--- Description ------------------------------------------------//
+
+Sets the FCIODecodeFlags of the events read into the state buffers,
+see FCIOSetDecodeFlags. Default is FCIODecodeFull.
+
+Returns the previously set flags or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!reader)
+    return -1;
+
+  int old = reader->decode_flags;
+  reader->decode_flags = decode_flags;
+  return old;
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIOSetStateChannelMask(FCIOStateReader *reader, int nchannels, const int *channels)
+
+/*--- Description ------------------------------------------------//
+
+Selects the traces read into the state buffers, see
+FCIOSetChannelMask.
+
+Returns the number of selected traces or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!reader)
+    return -1;
+
+  return fcio_set_channel_mask(reader->channel_mask, &reader->channel_masked, nchannels, channels);
+}
+
+
 static int tag_selected(FCIOStateReader *reader, int tag)
 {
   if (tag <= 0 || tag > 31)
@@ -1696,9 +5650,13 @@ frame.
 //----------------------------------------------------------------------------*/
 {
   if (!x) return -1;
-  tmio_stream *xio=(tmio_stream *)x;
+  fcio_stream *xio=(fcio_stream *)x;
+  if (!xio->tmio) {
+    int header;
+    return fcio_map_header(xio, xio->pos, &header) ? 1 : -1;
+  }
 
-  return tmio_wait(xio, tmo);
+  return tmio_wait(xio->tmio, tmo);
 }
 
 
@@ -1718,21 +5676,30 @@ static int get_next_record(FCIOStateReader *reader, int timeout)
   }
 
   int tag = FCIOReadMessage(stream);
-  if (debug > 4)
+  if (fcio_stream_debug(reader->stream) > 4)
     fprintf(stderr, "get_next_record: got tag %d \n", tag);
 
   if (tag <= 0)
     return tag;
 
-  fcio_config *config = reader->nconfigs ? &reader->configs[(reader->cur_config + reader->max_states - 1) % reader->max_states] : NULL;
-  fcio_event *event = reader->nevents ? &reader->events[(reader->cur_event + reader->max_states - 1) % reader->max_states] : NULL;
-  fcio_status *status = reader->nstatuses ? &reader->statuses[(reader->cur_status + reader->max_states - 1) % reader->max_states] : NULL;
-  fcio_recevent *recevent = reader->nrecevents ? &reader->recevents[(reader->cur_recevent + reader->max_states - 1) % reader->max_states] : NULL;
+  fcio_config *config = reader->nconfigs ? reader->configs[(reader->cur_config + reader->max_states - 1) % reader->max_states] : NULL;
+  fcio_event *event = reader->nevents ? reader->events[(reader->cur_event + reader->max_states - 1) % reader->max_states] : NULL;
+  fcio_status *status = reader->nstatuses ? reader->statuses[(reader->cur_status + reader->max_states - 1) % reader->max_states] : NULL;
+  fcio_recevent *recevent = reader->nrecevents ? reader->recevents[(reader->cur_recevent + reader->max_states - 1) % reader->max_states] : NULL;
+
+  // Deselected records are not decoded, their frames are skipped by the next
+  // FCIOReadMessage. Configs are always kept to provide the trace layout.
+  if (tag != FCIOConfig && !tag_selected(reader, tag))
+    return tag;
 
   int rc = 0;
   switch (tag) {
   case FCIOConfig:
-    config = &reader->configs[reader->cur_config];
+    if (!reader->configs[reader->cur_config])
+      reader->configs[reader->cur_config] = (fcio_config*) fcio_buffer_calloc(sizeof(fcio_config));
+    if (!(config = reader->configs[reader->cur_config]))
+      return -1;
+
     rc = fcio_get_config(stream, config);
 
     reader->cur_config = (reader->cur_config + 1) % reader->max_states;
@@ -1740,15 +5707,19 @@ static int get_next_record(FCIOStateReader *reader, int timeout)
     break;
 
   case FCIOEvent:
-    event = &reader->events[reader->cur_event];
-    rc = fcio_get_event(stream, event, config->adcs + config->triggers);
+    if (!reader->events[reader->cur_event])
+      reader->events[reader->cur_event] = (fcio_event*) fcio_buffer_calloc(sizeof(fcio_event));
+    if (!(event = reader->events[reader->cur_event]))
+      return -1;
 
     if (config) {
-      for (int i = 0; i < config->adcs + config->triggers; i++) {
-        event->trace[i] = &event->traces[2 + i * (config->eventsamples + 2)];
-        event->theader[i] = &event->traces[i * (config->eventsamples + 2)];
-      }
-    } else if (debug > 1) {
+      rc = fcio_reserve_traces(event, config, reader->alloc_flags);
+      if (rc >= 0)
+        rc = fcio_get_event(stream, config, event, reader->decode_flags, reader->channel_masked ? reader->channel_mask : NULL);
+
+      for (int i = 0; rc >= 0 && i < config->adcs + config->triggers; i++)
+        fcio_set_trace_pointers(event, config, i);
+    } else if (fcio_stream_debug(reader->stream) > 1) {
       fprintf(stderr, "FCIOGetState/WARNING Received event without known configuration. Unable to adjust trace pointers.\n");
     }
 
@@ -1757,16 +5728,19 @@ static int get_next_record(FCIOStateReader *reader, int timeout)
     break;
 
   case FCIOSparseEvent:
-    event = &reader->events[reader->cur_event];
+    if (!reader->events[reader->cur_event])
+      reader->events[reader->cur_event] = (fcio_event*) fcio_buffer_calloc(sizeof(fcio_event));
+    if (!(event = reader->events[reader->cur_event]))
+      return -1;
+
     if (config) {
-      rc = fcio_get_sparseevent(stream, event, config->eventsamples + 2);
+      rc = fcio_reserve_traces(event, config, reader->alloc_flags);
+      if (rc >= 0)
+        rc = fcio_get_sparseevent(stream, config, event, reader->decode_flags, reader->channel_masked ? reader->channel_mask : NULL);
 
-      for (int i = 0; i < event->num_traces; i++) {
-        int j = event->trace_list[i];
-        event->trace[j] = &event->traces[2 + j * (config->eventsamples + 2)];
-        event->theader[j] = &event->traces[j * (config->eventsamples + 2)];
-      }
-    } else if (debug > 1) {
+      for (int i = 0; rc >= 0 && i < event->num_traces; i++)
+        fcio_set_trace_pointers(event, config, event->trace_list[i]);
+    } else if (fcio_stream_debug(reader->stream) > 1) {
       fprintf(stderr, "FCIOGetState/WARNING Received sparse event without known configuration. Unable to adjust trace pointers.\n");
     }
 
@@ -1775,15 +5749,23 @@ static int get_next_record(FCIOStateReader *reader, int timeout)
     break;
 
   case FCIORecEvent:
-    recevent = &reader->recevents[reader->cur_recevent];
-    rc = fcio_get_recevent(stream, recevent);
+    if (!reader->recevents[reader->cur_recevent])
+      reader->recevents[reader->cur_recevent] = (fcio_recevent*) fcio_buffer_calloc(sizeof(fcio_recevent));
+    if (!(recevent = reader->recevents[reader->cur_recevent]))
+      return -1;
+
+    rc = fcio_get_recevent(stream, recevent, reader->alloc_flags);
 
     reader->cur_recevent = (reader->cur_recevent + 1) % reader->max_states;
     reader->nrecevents++;
     break;
 
   case FCIOStatus:
-    status = &reader->statuses[reader->cur_status];
+    if (!reader->statuses[reader->cur_status])
+      reader->statuses[reader->cur_status] = (fcio_status*) fcio_buffer_calloc(sizeof(fcio_status));
+    if (!(status = reader->statuses[reader->cur_status]))
+      return -1;
+
     rc = fcio_get_status(stream, status);
 
     reader->cur_status = (reader->cur_status + 1) % reader->max_states;
@@ -1791,15 +5773,18 @@ static int get_next_record(FCIOStateReader *reader, int timeout)
     break;
 
   case FCIOEventHeader:
-    event = &reader->events[reader->cur_event];
+    if (!reader->events[reader->cur_event])
+      reader->events[reader->cur_event] = (fcio_event*) fcio_buffer_calloc(sizeof(fcio_event));
+    if (!(event = reader->events[reader->cur_event]))
+      return -1;
+
     if (config) {
-      rc = fcio_get_eventheader(stream, config, event);
+      rc = fcio_reserve_traces(event, config, reader->alloc_flags);
+      if (rc >= 0)
+        rc = fcio_get_eventheader(stream, config, event);
 
-      for (int i = 0; i < event->num_traces; i++) {
-        int j = event->trace_list[i];
-        event->trace[j] = &event->traces[2 + j * (config->eventsamples + 2)];
-        event->theader[j] = &event->traces[j * (config->eventsamples + 2)];
-      }
+      for (int i = 0; rc >= 0 && i < event->num_traces; i++)
+        fcio_set_trace_pointers(event, config, event->trace_list[i]);
     } else {
       fprintf(stderr, "[WARNING] Received event header without known configuration. Unable to adjust trace pointers.\n");
     }
@@ -1835,6 +5820,258 @@ static inline FCIOState *get_last_state(FCIOStateReader *reader)
   return &reader->states[(reader->cur_state + reader->max_states - 1) % reader->max_states];
 }
 
+/*--- Prefetching ------------------------------------------------//
+
+With FCIOSetStatePrefetch a thread runs get_next_record ahead of
+the consumer. The state ring is extended by depth slots, so that
+the states decoded ahead never overwrite the states still reachable
+with negative offsets. States are numbered from the start of the
+thread, state n is kept in slot (first + n) % max_states.
+
+//----------------------------------------------------------------*/
+
+#define FCIOPrefetchPoll 100  // ms the thread blocks on an idle stream before checking for stop
+
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t produced_cond;  // a state was decoded, the stream was idle or has ended
+  pthread_cond_t consumed_cond;  // slots were released or the thread is asked to stop
+  int depth;                     // maximum number of states decoded ahead of the consumer
+  int first;                     // ring slot of the first state after the start of the thread
+  long long produced;            // states decoded by the thread
+  long long consumed;            // states returned by FCIOGetState
+  int running;
+  int stop;
+  int idle;                      // the last wait on the stream timed out
+  int done;                      // end of stream or error
+} fcio_prefetch;
+
+static void *fcio_prefetch_run(void *arg)
+{
+  FCIOStateReader *reader = (FCIOStateReader *) arg;
+  fcio_prefetch *p = (fcio_prefetch *) reader->prefetch;
+
+  pthread_mutex_lock(&p->lock);
+  while (!p->stop) {
+    if (p->produced - p->consumed >= p->depth) {
+      pthread_cond_wait(&p->consumed_cond, &p->lock);
+      continue;
+    }
+    int idle = p->idle;
+    pthread_mutex_unlock(&p->lock);
+
+    // the slot of state p->produced is free, the consumer does not read reader fields
+    int nrecords = reader->nrecords;
+    int tag = get_next_record(reader, idle ? FCIOPrefetchPoll : 0);
+
+    pthread_mutex_lock(&p->lock);
+    p->idle = (tag == 0);
+    if (reader->nrecords != nrecords)
+      p->produced++;
+    else if (tag < 0)
+      p->done = 1;
+    if (p->done || p->idle || reader->nrecords != nrecords)
+      pthread_cond_broadcast(&p->produced_cond);
+    if (p->done)
+      break;
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+static int fcio_prefetch_start(FCIOStateReader *reader)
+{
+  fcio_prefetch *p = (fcio_prefetch *) reader->prefetch;
+  if (p->running)
+    return 0;
+
+  // the states decoded before a stop stay available, FCIOSeekState drops them
+  p->stop = p->idle = p->done = 0;
+  if (pthread_create(&p->thread, NULL, fcio_prefetch_run, reader)) {
+    if (fcio_stream_debug(reader->stream))
+      fprintf(stderr, "FCIOGetState/ERROR: failed to start prefetch thread\n");
+    return -1;
+  }
+  p->running = 1;
+  return 0;
+}
+
+// stops the thread, states decoded ahead of the consumer are dropped
+static void fcio_prefetch_stop(FCIOStateReader *reader, int release)
+{
+  fcio_prefetch *p = (fcio_prefetch *) reader->prefetch;
+  if (!p)
+    return;
+
+  if (p->running) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->consumed_cond);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->thread, NULL);
+    p->running = 0;
+  }
+
+  if (release) {
+    pthread_cond_destroy(&p->consumed_cond);
+    pthread_cond_destroy(&p->produced_cond);
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+    reader->prefetch = NULL;
+  }
+}
+
+static inline FCIOState *fcio_prefetch_state(FCIOStateReader *reader, fcio_prefetch *p, long long n)
+{
+  return &reader->states[(p->first + n % reader->max_states + reader->max_states) % reader->max_states];
+}
+
+// as FCIOGetState with offset > 0, the reader timeout bounds the wait for the thread
+static FCIOState *fcio_prefetch_get(FCIOStateReader *reader, int offset, int *timedout)
+{
+  fcio_prefetch *p = (fcio_prefetch *) reader->prefetch;
+  if (fcio_prefetch_start(reader) < 0)
+    return NULL;
+
+  struct timespec deadline;
+  if (reader->timeout > 0) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += reader->timeout / 1000;
+    deadline.tv_nsec += (reader->timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+
+  // the skipped states are consumed as they arrive, the thread is bounded by depth
+  pthread_mutex_lock(&p->lock);
+  int expired = 0;
+  while (offset > 0 && !expired) {
+    if (p->produced > p->consumed) {
+      long long n = p->produced - p->consumed < offset ? p->produced - p->consumed : offset;
+      p->consumed += n;
+      offset -= n;
+      pthread_cond_signal(&p->consumed_cond);
+    } else if (p->done || (reader->timeout == 0 && p->idle)) {
+      expired = 1;
+    } else if (reader->timeout > 0) {
+      expired = pthread_cond_timedwait(&p->produced_cond, &p->lock, &deadline) == ETIMEDOUT;
+    } else {
+      pthread_cond_wait(&p->produced_cond, &p->lock);
+    }
+  }
+
+  // as without prefetching, the states read before a timeout or the end of stream stay consumed
+  FCIOState *state = NULL;
+  if (!offset)
+    state = fcio_prefetch_state(reader, p, p->consumed - 1);
+  else if (timedout && !p->done)
+    *timedout = 1;
+  if (fcio_stream_debug(reader->stream) > 4)
+    fprintf(stderr, "FCIOGetState: prefetched %lld states, consumed %lld.\n", p->produced, p->consumed);
+  pthread_mutex_unlock(&p->lock);
+
+  return state;
+}
+
+// (re)allocates the empty ring buffers of the reader with max_states slots
+static int fcio_state_resize(FCIOStateReader *reader, int max_states)
+{
+  FCIOState *states = (FCIOState*) calloc(max_states, sizeof(FCIOState));
+  fcio_config **configs = (fcio_config**) calloc(max_states, sizeof(fcio_config*));
+  fcio_event **events = (fcio_event**) calloc(max_states, sizeof(fcio_event*));
+  fcio_status **statuses = (fcio_status**) calloc(max_states, sizeof(fcio_status*));
+  fcio_recevent **recevents = (fcio_recevent**) calloc(max_states, sizeof(fcio_recevent*));
+  if (!states || !configs || !events || !statuses || !recevents) {
+    free(recevents);
+    free(statuses);
+    free(events);
+    free(configs);
+    free(states);
+    return -1;
+  }
+
+  free(reader->recevents);
+  free(reader->statuses);
+  free(reader->events);
+  free(reader->configs);
+  free(reader->states);
+  reader->states = states;
+  reader->configs = configs;
+  reader->events = events;
+  reader->statuses = statuses;
+  reader->recevents = recevents;
+  reader->max_states = max_states;
+  reader->cur_state = reader->cur_config = reader->cur_event = reader->cur_status = reader->cur_recevent = 0;
+  return 0;
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIOSetStatePrefetch(FCIOStateReader *reader, int enable)
+
+/*--- Description ------------------------------------------------//
+
+Enables (enable != 0) or disables decoding in a background thread.
+The thread reads and decodes up to state_buffer_depth records ahead
+of FCIOGetState, so that reading and processing the states run in
+parallel. The offsets of FCIOGetState keep their meaning, the ring
+of the reader is extended to hold the states decoded ahead in
+addition to the last state_buffer_depth states.
+
+Prefetching must be switched before the first record is read. The
+tag selection, decode flags and channel mask must not be changed
+while the thread is running, it is started by the first
+FCIOGetState with a positive offset and stopped by FCIOSeekState
+and FCIODestroyStateReader.
+
+With prefetching, the io_timeout of the reader bounds the wait for
+the thread; timedout is set to 1 on a timeout, deselected tags are
+skipped by the thread and are not reported.
+
+Returns the previous setting (0 or 1) or <0 on error.
+
+//----------------------------------------------------------------*/
+{
+  if (!reader)
+    return -1;
+
+  fcio_prefetch *p = (fcio_prefetch *) reader->prefetch;
+  int old = p ? 1 : 0;
+  if (!enable == !old)
+    return old;
+
+  if (reader->nrecords || reader->nconfigs || reader->nevents || reader->nstatuses || reader->nrecevents) {
+    if (fcio_stream_debug(reader->stream) > 1)
+      fprintf(stderr, "FCIOSetStatePrefetch/WARNING: records have been read already\n");
+    return -1;
+  }
+
+  if (!enable) {
+    int max_states = reader->max_states - p->depth;
+    fcio_prefetch_stop(reader, 1);
+    return fcio_state_resize(reader, max_states) < 0 ? -1 : old;
+  }
+
+  if (!(p = (fcio_prefetch *) calloc(1, sizeof(fcio_prefetch))))
+    return -1;
+
+  p->depth = reader->max_states > 1 ? reader->max_states - 1 : 1;
+  if (fcio_state_resize(reader, reader->max_states + p->depth) < 0) {
+    free(p);
+    return -1;
+  }
+  p->first = reader->cur_state;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->produced_cond, NULL);
+  pthread_cond_init(&p->consumed_cond, NULL);
+  reader->prefetch = p;
+  return old;
+}
+
 
 /*=== Function ===================================================*/
 
@@ -1850,32 +6087,46 @@ tags within the timeout.
 //----------------------------------------------------------------*/
 {
   if (timedout)
-    *timedout = 0;
-
-  if (debug > 4)
-    fprintf(stderr, "FCIOGetState(reader, %i): max_states=%i, cur_state=%i\n", offset, reader->max_states, reader->cur_state);
+    *timedout = 0;
 
   if (!reader)
     return NULL;
 
+  if (fcio_stream_debug(reader->stream) > 4)
+    fprintf(stderr, "FCIOGetState(reader, %i): max_states=%i, cur_state=%i\n", offset, reader->max_states, reader->cur_state);
+
+  fcio_prefetch *p = (fcio_prefetch *) reader->prefetch;
+  if (p) {
+    // the thread only appends states, the consumed ones are stable
+    pthread_mutex_lock(&p->lock);
+    long long consumed = p->consumed;
+    pthread_mutex_unlock(&p->lock);
+
+    if (offset > 0)
+      return fcio_prefetch_get(reader, offset, timedout);
+    if (offset < 0 && (-offset >= consumed || -offset > reader->max_states - 1 - p->depth))
+      return NULL;
+    return fcio_prefetch_state(reader, p, consumed - 1 + offset);
+  }
+
   if (!offset)
     return get_last_state(reader);
 
   if (offset < 0) {
     if (-offset >= reader->nrecords || -offset > reader->max_states - 1) {
-      if (debug > 4)
+      if (fcio_stream_debug(reader->stream) > 4)
         fprintf(stderr, "FCIOGetState: Requested event %i not in buffer.\n", offset);
       return NULL;
     }
 
     int i = (reader->cur_state + reader->max_states - 1 + offset) % reader->max_states;
-    if (debug > 4)
+    if (fcio_stream_debug(reader->stream) > 4)
       fprintf(stderr, "FCIOGetState: Returning state %i.\n", i);
     return &reader->states[i];
   }
 
   // Read new data from stream
-  if (debug > 4)
+  if (fcio_stream_debug(reader->stream) > 4)
     fprintf(stderr, "FCIOGetState: Trying to read %i records from stream...\n", offset);
 
   int tag = 0;
@@ -1904,7 +6155,7 @@ tags within the timeout.
       if (timedout)
         *timedout = 0;  // timedout may have been set to 2 from an interleaved deselected tag
 
-      if (debug > 4)
+      if (fcio_stream_debug(reader->stream) > 4)
         fprintf(stderr, "FCIOGetState: Found record [cur_state=%i, config=%p, event=%p, status=%p, recevent=%p].\n", reader->cur_state,
           (void*)get_last_state(reader)->config,
           (void*)get_last_state(reader)->event,
@@ -1922,7 +6173,7 @@ tags within the timeout.
   }
 
   // End-of-stream has been reached
-  if (debug > 4)
+  if (fcio_stream_debug(reader->stream) > 4)
     fprintf(stderr, "FCIOGetState: End-of-stream reached with %i events outstanding.\n", offset);
   return NULL;
 }
@@ -1942,6 +6193,58 @@ Calls FCIOGetState with offset == 1.
 
 /*=== Function ===================================================*/
 
+int FCIOSeekState(FCIOStateReader *reader, int mode, int value, int ticks)
+
+/*--- Description ------------------------------------------------//
+
+Positions the stream of the reader like FCIOSeek, so that the next
+FCIOGetNextState returns the record selected by mode, value and
+ticks. The governing FCIOConfig and the latest FCIOStatus are read
+again, states buffered before the seek are no longer available
+with negative offsets in FCIOGetState. A prefetch thread is stopped
+and restarted at the target, the states it decoded ahead are dropped.
+If no record matches, the reader continues where it was, including
+the states decoded ahead.
+
+Returns the record number of the target (>=0) or <0 on error or if
+no record matches.
+
+//----------------------------------------------------------------*/
+{
+  fcio_stream *xio = reader ? (fcio_stream *)reader->stream : NULL;
+  if (!xio)
+    return -1;
+
+  // the thread reads the stream, it is stopped for the lookup but keeps its states if no record matches
+  fcio_prefetch_stop(reader, 0);
+
+  FCIOIndexEntry found[3];
+  int target = fcio_index_find(xio, mode, value, ticks, found);
+  if (target < 0) {
+    if (fcio_stream_debug(reader->stream) > 1) fprintf(stderr, "FCIOSeekState/WARNING: no record for mode %d value %d ticks %d\n", mode, value, ticks);
+    return -1;
+  }
+
+  // the states decoded ahead are dropped
+  int rc = 0;
+  if (found[1].tag && (fcio_index_seek(xio, &found[1]) < 0 || get_next_record(reader, 0) != FCIOConfig))
+    rc = -1;
+  else if (found[2].tag && (fcio_index_seek(xio, &found[2]) < 0 || get_next_record(reader, 0) != FCIOStatus))
+    rc = -1;
+  else if (fcio_index_seek(xio, &found[0]) < 0)
+    rc = -1;
+
+  reader->nrecords = 0;
+  if (reader->prefetch) {
+    fcio_prefetch *p = (fcio_prefetch *) reader->prefetch;
+    p->first = reader->cur_state;
+    p->produced = p->consumed = 0;
+  }
+  return rc < 0 ? rc : target;
+}
+
+/*=== Function ===================================================*/
+
 int FCIOPutState(FCIOStream output, FCIOState* state, int tag)
 
 /*--- Description ------------------------------------------------//
@@ -1980,6 +6283,836 @@ Returns 0 on success or <0 on error.
 }
 
 
+/*--- Parallel reading -------------------------------------------//
+
+FCIOCreateParallelReader partitions a mapped file into chunks of
+records and decodes them with one FCIOStateReader per thread. The
+chunks are cut at the entries of the index (the trailer or an index
+built by scanning) or at FCIOSync records. Each chunk keeps the
+offsets of the FCIOConfig governing its first record and of the
+latest FCIOStatus before it, which a thread reads again before
+decoding the chunk, as FCIOSeekState does. The mapping of a thread is narrowed to the end of
+its chunk while reading it.
+
+The states of a thread are numbered by the records read by its
+reader, including the FCIOConfig and FCIOStatus read for a chunk.
+A thread decodes at most FCIOParallelDepth states ahead of the state
+released last by FCIOGetParallelState, so that the ring of its reader
+never overwrites a state or a record referenced by one that is still
+in use.
+
+//----------------------------------------------------------------*/
+
+#define FCIOParallelDepth 8                 // states a thread decodes ahead of the consumer
+#define FCIOParallelChunkSize (64ULL << 20)  // default chunk size in bytes
+#define FCIOParallelSyncScan (16ULL << 20)   // bytes scanned behind the first cut for an FCIOSync record
+
+typedef void* FCIOParallelReader;
+
+typedef struct {
+  size_t start;           // byte offset of the first record
+  size_t end;             // byte offset behind the last record
+  FCIOIndexEntry config;  // governing FCIOConfig and latest FCIOStatus before start, tag 0 if none
+  FCIOIndexEntry status;
+  int configs;            // number of FCIOConfig records before start
+  int worker;             // thread decoding the chunk, -1 before it is claimed
+  int done;               // all states of the chunk have been queued
+} fcio_parallel_chunk;
+
+typedef struct {
+  FCIOState *state;
+  long long serial;  // number of the state in the reader of the thread
+  int chunk;
+} fcio_parallel_item;
+
+struct fcio_parallel;
+
+typedef struct {
+  struct fcio_parallel *parallel;
+  FCIOStateReader *reader;
+  pthread_t thread;
+  int running;
+  pthread_cond_t released_cond;  // the consumer released a state of this thread or asks to stop
+  long long released;            // states below this serial are no longer used by the consumer
+  long long pushed;              // states queued in items
+  long long popped;              // states returned by FCIOGetParallelState
+  fcio_parallel_item items[FCIOParallelDepth];
+} fcio_parallel_worker;
+
+typedef struct fcio_parallel {
+  pthread_mutex_t lock;
+  pthread_cond_t queued_cond;  // a state was queued, a chunk is done or a thread has ended
+  int ordered;
+  int stop;
+  int error;
+  int waiting;                 // the consumer waits on queued_cond
+  fcio_parallel_chunk *chunks;
+  int nchunks;
+  int claimed;                 // chunks claimed by the threads
+  int current;                 // chunk delivered next with ordered delivery
+  int next_worker;             // thread checked first with unordered delivery
+  int finished;                // threads that have ended
+  int nworkers;
+  fcio_parallel_worker *workers;
+  fcio_parallel_worker *held;  // thread of the state returned last
+  long long held_serial;
+} fcio_parallel;
+
+static int fcio_parallel_append(fcio_parallel *p, size_t start, const FCIOIndexEntry *config, const FCIOIndexEntry *status, int configs)
+{
+  if (!(p->nchunks & (p->nchunks - 1))) {
+    int max_chunks = p->nchunks ? 2 * p->nchunks : 1;
+    fcio_parallel_chunk *chunks = (fcio_parallel_chunk *) realloc(p->chunks, max_chunks * sizeof(fcio_parallel_chunk));
+    if (!chunks)
+      return -1;
+    p->chunks = chunks;
+  }
+  fcio_parallel_chunk *chunk = &p->chunks[p->nchunks++];
+  memset(chunk, 0, sizeof(fcio_parallel_chunk));
+  chunk->start = start;
+  chunk->end = start;
+  if (config)
+    chunk->config = *config;
+  if (status)
+    chunk->status = *status;
+  chunk->configs = configs;
+  chunk->worker = -1;
+  return 0;
+}
+
+// cuts the chunks at FCIOSync records, returns -1 if the file has none near the first cut
+static int fcio_parallel_sync_chunks(fcio_parallel *p, const fcio_stream *x, size_t chunk_size)
+{
+  size_t pos = FCIOMapProtocolSize;
+  FCIOSyncMarker marker;
+  if (fcio_map_find_sync(x, pos + chunk_size, pos + chunk_size + FCIOParallelSyncScan, &pos, &marker) < 0)
+    return -1;
+  if (fcio_parallel_append(p, FCIOMapProtocolSize, NULL, NULL, 0) < 0)
+    return -2;
+
+  do {
+    FCIOIndexEntry config = { marker.config_offset, marker.config_offset < 0 ? 0 : FCIOConfig, marker.config_generation, -1, -1, -1, 0 };
+    FCIOIndexEntry status = { marker.status_offset, marker.status_offset < 0 ? 0 : FCIOStatus, marker.config_generation, -1, -1, -1, 0 };
+    if (fcio_parallel_append(p, pos, &config, &status, marker.config_generation) < 0)
+      return -2;
+  } while (fcio_map_find_sync(x, pos + chunk_size, x->map_size, &pos, &marker) == 0);
+  return 0;
+}
+
+// cuts the chunks at the entries of the index of x
+static int fcio_parallel_index_chunks(fcio_parallel *p, fcio_stream *x, size_t chunk_size)
+{
+  if (FCIOLoadIndex((FCIOStream)x, NULL) < 0)
+    return -1;
+
+  FCIOIndexEntry config = { 0 }, status = { 0 };
+  size_t start = 0;
+  for (int i = 0; i < x->nentries; i++) {
+    const FCIOIndexEntry *entry = &x->entries[i];
+    if (!p->nchunks || (size_t)entry->offset - start >= chunk_size) {
+      start = p->nchunks ? (size_t)entry->offset : FCIOMapProtocolSize;
+      if (fcio_parallel_append(p, start, &config, &status, entry->config_generation - (entry->tag == FCIOConfig)) < 0)
+        return -1;
+    }
+    if (entry->tag == FCIOConfig) {
+      config = *entry;
+      status.tag = 0;  // as for FCIOSync records and FCIOSeek
+    } else if (entry->tag == FCIOStatus) {
+      status = *entry;
+    }
+  }
+  return 0;
+}
+
+static int fcio_parallel_partition(fcio_parallel *p, const char *peer, size_t chunk_size)
+{
+  fcio_stream *x = (fcio_stream *) FCIOConnect(peer, 'r', 0, 0);
+  if (!x)
+    return -1;
+
+  int rc = -1;
+  if (x->tmio || x->fd >= 0) {
+    if (fcio_stream_debug(x)) fprintf(stderr, "FCIOCreateParallelReader/ERROR: %s is not connected with mmap://\n", peer);
+  } else {
+    size_t summary, entries;
+    int nentries;
+    if (x->map_size <= FCIOMapProtocolSize + chunk_size)
+      rc = 0;  // a single chunk
+    else if (!fcio_map_trailer(x, &summary, &entries, &nentries))
+      rc = fcio_parallel_sync_chunks(p, x, chunk_size);
+    if (rc == -1)
+      rc = fcio_parallel_index_chunks(p, x, chunk_size);
+    if (rc == 0 && !p->nchunks)
+      rc = fcio_parallel_append(p, FCIOMapProtocolSize, NULL, NULL, 0);
+    for (int i = 0; rc == 0 && i < p->nchunks; i++)
+      p->chunks[i].end = i + 1 < p->nchunks ? p->chunks[i + 1].start : x->map_size;
+  }
+  FCIODisconnect((FCIOStream)x);
+  return rc < 0 ? -1 : 0;
+}
+
+// reads the next record with the reader of w once a slot of its ring is free, returns -3 to stop
+static int fcio_parallel_next(fcio_parallel_worker *w)
+{
+  fcio_parallel *p = w->parallel;
+  pthread_mutex_lock(&p->lock);
+  while (!p->stop && w->reader->nrecords - w->released >= FCIOParallelDepth)
+    pthread_cond_wait(&w->released_cond, &p->lock);
+  int stop = p->stop;
+  pthread_mutex_unlock(&p->lock);
+
+  return stop ? -3 : get_next_record(w->reader, 0);
+}
+
+static int fcio_parallel_decode(fcio_parallel_worker *w, int k)
+{
+  fcio_parallel *p = w->parallel;
+  fcio_parallel_chunk *chunk = &p->chunks[k];
+  fcio_stream *xio = (fcio_stream *) w->reader->stream;
+
+  // as after FCIOSeekState, records of the previous chunk are not referenced
+  w->reader->nconfigs = w->reader->nevents = w->reader->nstatuses = w->reader->nrecevents = 0;
+  if (chunk->config.tag && (fcio_index_seek(xio, &chunk->config) < 0 || fcio_parallel_next(w) != FCIOConfig))
+    return -1;
+  if (chunk->status.tag && (fcio_index_seek(xio, &chunk->status) < 0 || fcio_parallel_next(w) != FCIOStatus))
+    return -1;
+  if (FCIOSeekOffset((FCIOStream)xio, chunk->start) < 0)
+    return -1;
+  xio->configs = chunk->configs;
+
+  // the records of the chunk end with the narrowed mapping
+  size_t map_size = xio->map_size;
+  xio->map_size = chunk->end;
+  int tag = 0;
+  while (FCIOWaitMessage((FCIOStream)xio, 0) == 1 && (tag = fcio_parallel_next(w)) > 0) {
+    pthread_mutex_lock(&p->lock);
+    fcio_parallel_item *item = &w->items[w->pushed++ % FCIOParallelDepth];
+    item->state = get_last_state(w->reader);
+    item->serial = w->reader->nrecords - 1;
+    item->chunk = k;
+    if (p->waiting)
+      pthread_cond_signal(&p->queued_cond);
+    pthread_mutex_unlock(&p->lock);
+  }
+  int error = tag < 0 && tag != -3;
+  xio->map_size = map_size;
+
+  if (error && fcio_stream_debug(xio))
+    fprintf(stderr, "FCIOGetParallelState/ERROR: decoding the chunk [%zu,%zu) failed at offset %zu\n", chunk->start, chunk->end, xio->pos);
+  return error ? -1 : 0;
+}
+
+static void *fcio_parallel_run(void *arg)
+{
+  fcio_parallel_worker *w = (fcio_parallel_worker *) arg;
+  fcio_parallel *p = w->parallel;
+
+  pthread_mutex_lock(&p->lock);
+  while (!p->stop && !p->error && p->claimed < p->nchunks) {
+    int k = p->claimed++;
+    p->chunks[k].worker = (int)(w - p->workers);
+    pthread_mutex_unlock(&p->lock);
+
+    int rc = fcio_parallel_decode(w, k);
+
+    pthread_mutex_lock(&p->lock);
+    p->chunks[k].done = 1;
+    if (rc < 0)
+      p->error = 1;
+    pthread_cond_signal(&p->queued_cond);
+  }
+  p->finished++;
+  pthread_cond_signal(&p->queued_cond);
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+// returns the next queued state or NULL, sets done at the end of all chunks, called with the lock held
+static fcio_parallel_item *fcio_parallel_pop(fcio_parallel *p, int *done)
+{
+  if (p->ordered) {
+    while (p->current < p->nchunks && p->chunks[p->current].worker >= 0) {
+      fcio_parallel_worker *w = &p->workers[p->chunks[p->current].worker];
+      if (w->popped < w->pushed && w->items[w->popped % FCIOParallelDepth].chunk == p->current)
+        return &w->items[w->popped++ % FCIOParallelDepth];
+      if (!p->chunks[p->current].done)
+        return NULL;
+      p->current++;
+    }
+    *done = p->current == p->nchunks;
+    return NULL;
+  }
+
+  for (int i = 0; i < p->nworkers; i++) {
+    fcio_parallel_worker *w = &p->workers[(p->next_worker + i) % p->nworkers];
+    if (w->popped < w->pushed) {
+      p->next_worker = (p->next_worker + i + 1) % p->nworkers;
+      return &w->items[w->popped++ % FCIOParallelDepth];
+    }
+  }
+  *done = p->finished == p->nworkers;
+  return NULL;
+}
+
+int FCIODestroyParallelReader(FCIOParallelReader reader);
+
+
+/*=== Function ===================================================*/
+
+FCIOParallelReader FCIOCreateParallelReader(const char *peer, int nthreads, size_t chunk_size, int ordered)
+
+/*--- Description ------------------------------------------------//
+
+Opens the file peer, which must be given as mmap://, for reading
+with nthreads threads (the number of online processors if <= 0).
+The file is partitioned into chunks of about chunk_size bytes
+(64 MiB if 0) at record boundaries, using the FCIOTrailer, the
+FCIOSync records or an index built by scanning the file, in this
+order. Each thread decodes the chunks it claims with its own
+FCIOStateReader, starting with the FCIOConfig and FCIOStatus
+preceding the chunk.
+
+With ordered != 0 FCIOGetParallelState returns the states in file
+order, otherwise in the order they are decoded, with the records of
+each chunk in file order.
+
+Returns the reader or NULL on error.
+
+//----------------------------------------------------------------*/
+{
+  fcio_parallel *p = (fcio_parallel *) calloc(1, sizeof(fcio_parallel));
+  if (!p) {
+    if (fcio_debug())
+      fprintf(stderr, "FCIOCreateParallelReader/ERROR: failed to allocate structure\n");
+    return NULL;
+  }
+
+  if (fcio_parallel_partition(p, peer, chunk_size ? chunk_size : FCIOParallelChunkSize) < 0) {
+    if (fcio_debug())
+      fprintf(stderr, "FCIOCreateParallelReader/ERROR: failed to partition %s\n", peer ? peer : "(NULL)");
+    free(p->chunks);
+    free(p);
+    return NULL;
+  }
+
+  if (nthreads <= 0)
+    nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > p->nchunks)
+    nthreads = p->nchunks;
+  if (nthreads < 1)
+    nthreads = 1;
+
+  p->ordered = ordered;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->queued_cond, NULL);
+  if (!(p->workers = (fcio_parallel_worker *) calloc(nthreads, sizeof(fcio_parallel_worker)))) {
+    FCIODestroyParallelReader(p);
+    return NULL;
+  }
+
+  for (int i = 0; i < nthreads; i++) {
+    fcio_parallel_worker *w = &p->workers[i];
+    w->parallel = p;
+    pthread_cond_init(&w->released_cond, NULL);
+    p->nworkers++;
+    if (!(w->reader = FCIOCreateStateReader(peer, 0, 0, FCIOParallelDepth))) {
+      FCIODestroyParallelReader(p);
+      return NULL;
+    }
+  }
+
+  // the threads are started when all readers exist
+  for (int i = 0; i < nthreads; i++) {
+    fcio_parallel_worker *w = &p->workers[i];
+    if (pthread_create(&w->thread, NULL, fcio_parallel_run, w)) {
+      if (fcio_debug())
+        fprintf(stderr, "FCIOCreateParallelReader/ERROR: failed to start thread %d\n", i);
+      pthread_mutex_lock(&p->lock);
+      p->finished += nthreads - i;
+      p->error = 1;
+      pthread_mutex_unlock(&p->lock);
+      break;
+    }
+    w->running = 1;
+  }
+
+  if (fcio_debug() > 3)
+    fprintf(stderr, "FCIOCreateParallelReader/DEBUG: %d chunks, %d threads\n", p->nchunks, nthreads);
+  return p;
+}
+
+
+/*=== Function ===================================================*/
+
+FCIOState *FCIOGetParallelState(FCIOParallelReader reader, int *chunk)
+
+/*--- Description ------------------------------------------------//
+
+Returns the next state of the parallel reader, which stays valid
+until the next call. chunk, if not NULL, is set to the number of
+the chunk of the record, chunks are numbered in file order.
+At the start of a chunk, the states refer to the governing
+FCIOConfig and the latest FCIOStatus after it, as after FCIOSeekState.
+The event of states before the first event of a chunk is NULL.
+
+Returns NULL at the end of the file or on error.
+
+//----------------------------------------------------------------*/
+{
+  fcio_parallel *p = (fcio_parallel *) reader;
+  if (!p)
+    return NULL;
+
+  pthread_mutex_lock(&p->lock);
+  if (p->held) {
+    p->held->released = p->held_serial + 1;
+    pthread_cond_signal(&p->held->released_cond);
+    p->held = NULL;
+  }
+
+  fcio_parallel_item *item = NULL;
+  int done = 0;
+  while (!p->error && !(item = fcio_parallel_pop(p, &done)) && !done) {
+    p->waiting = 1;
+    pthread_cond_wait(&p->queued_cond, &p->lock);
+    p->waiting = 0;
+  }
+
+  FCIOState *state = NULL;
+  if (item && !p->error) {
+    p->held = &p->workers[p->chunks[item->chunk].worker];
+    p->held_serial = item->serial;
+    state = item->state;
+    if (chunk)
+      *chunk = item->chunk;
+  }
+  pthread_mutex_unlock(&p->lock);
+  return state;
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIODestroyParallelReader(FCIOParallelReader reader)
+
+/*--- Description ------------------------------------------------//
+
+Stops the threads of the parallel reader and frees it.
+
+Returns 0 on success, <0 on error or if a chunk could not be
+decoded.
+
+//----------------------------------------------------------------*/
+{
+  fcio_parallel *p = (fcio_parallel *) reader;
+  if (!p)
+    return -1;
+
+  pthread_mutex_lock(&p->lock);
+  p->stop = 1;
+  for (int i = 0; i < p->nworkers; i++)
+    pthread_cond_signal(&p->workers[i].released_cond);
+  pthread_mutex_unlock(&p->lock);
+
+  for (int i = 0; i < p->nworkers; i++) {
+    fcio_parallel_worker *w = &p->workers[i];
+    if (w->running)
+      pthread_join(w->thread, NULL);
+    if (w->reader)
+      FCIODestroyStateReader(w->reader);
+    pthread_cond_destroy(&w->released_cond);
+  }
+
+  int error = p->error;
+  pthread_cond_destroy(&p->queued_cond);
+  pthread_mutex_destroy(&p->lock);
+  free(p->workers);
+  free(p->chunks);
+  free(p);
+  return error ? -1 : 0;
+}
+
+
+/*--- Event processing engine ------------------------------------//
+
+FCIORunEngine reads the records of a state reader on the calling
+thread and hands the event records to a pool of worker threads.
+Each worker queues its events in a deque, takes the oldest of its
+own and steals the newest of another worker when its deque is
+empty. The results are committed on the calling thread in record
+order.
+
+A record is in flight from being read until it is committed. At
+most window records are in flight, so that the ring of the reader
+still holds their states while they are processed; the workers
+only read the states.
+
+//----------------------------------------------------------------*/
+
+#define FCIOEngineAlign 64  // alignment of the scratch buffers and results, avoids false sharing
+
+typedef int (*FCIOEngineProcess)(FCIOState *state, void *scratch, void *result, void *arg);
+typedef int (*FCIOEngineCommit)(FCIOState *state, void *result, void *arg);
+
+typedef struct {
+  FCIOEngineProcess process;  // called for each event record on a worker thread
+  FCIOEngineCommit commit;    // called for each record in record order on the calling thread, may be NULL
+  void *arg;                  // passed to process and commit
+  size_t scratch_size;        // bytes of the scratch buffer of each worker, zeroed once
+  size_t result_size;         // bytes of the result of each record, zeroed before process
+  int nthreads;               // worker threads, the number of online processors if <= 0
+  int window;                 // records in flight, at most the state_buffer_depth of the reader if <= 0
+} FCIOEngineConfig;
+
+typedef struct {
+  int nthreads;               // worker threads
+  int window;                 // records in flight
+  long long records;          // records committed
+  long long events;           // event records processed
+  long long steals;           // events processed by another worker than the one they were queued for
+  long long bytes;            // bytes read from the stream
+  double elapsed;             // wall time of the run in seconds
+  double read_time;           // time the calling thread spent reading records
+  double commit_time;         // time the calling thread spent in commit
+  double wait_time;           // time the calling thread waited for results
+  double process_time;        // time spent in process, summed over the workers
+  double idle_time;           // time the workers waited for events, summed over the workers
+  double records_per_second;  // records committed per second of wall time
+  double bytes_per_second;    // bytes read per second of wall time
+} FCIOEngineStats;
+
+typedef struct {
+  FCIOState *state;
+  void *result;
+  int done;  // processed or not an event, accessed with atomics
+  int rc;    // return value of process
+} fcio_engine_slot;
+
+struct fcio_engine;
+
+typedef struct {
+  struct fcio_engine *engine;
+  pthread_t thread;
+  int running;
+  pthread_mutex_t lock;  // protects the deque
+  int *tasks;            // slots of the events queued for this worker
+  int head;              // oldest task of the deque
+  int count;
+  void *scratch;
+  long long events;
+  long long steals;
+  double process_time;
+  double idle_time;
+} fcio_engine_worker;
+
+typedef struct fcio_engine {
+  const FCIOEngineConfig *config;
+  int window;
+  int nworkers;
+  fcio_engine_worker *workers;
+  fcio_engine_slot *slots;
+  char *results;
+  size_t result_stride;
+  pthread_mutex_t lock;      // only for sleeping, the counters below are atomics
+  pthread_cond_t work_cond;  // events were queued or the workers are asked to stop
+  pthread_cond_t done_cond;  // an event was processed while the calling thread waits
+  int pending;               // events queued and not yet taken by a worker
+  int sleepers;              // workers waiting on work_cond
+  int waiting;               // the calling thread waits on done_cond
+  int stop;                  // the workers end once the deques are empty
+} fcio_engine;
+
+static inline int fcio_engine_is_event(int tag)
+{
+  return tag == FCIOEvent || tag == FCIOSparseEvent || tag == FCIOEventHeader || tag == FCIORecEvent;
+}
+
+// takes the oldest event of w or steals the newest of another worker, returns its slot or -1
+static int fcio_engine_take(fcio_engine *e, fcio_engine_worker *w)
+{
+  int slot = -1;
+  pthread_mutex_lock(&w->lock);
+  if (w->count) {
+    slot = w->tasks[w->head];
+    w->head = (w->head + 1) % e->window;
+    w->count--;
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  for (int i = 1; slot < 0 && i < e->nworkers; i++) {
+    fcio_engine_worker *victim = &e->workers[(w - e->workers + i) % e->nworkers];
+    pthread_mutex_lock(&victim->lock);
+    if (victim->count) {
+      victim->count--;
+      slot = victim->tasks[(victim->head + victim->count) % e->window];
+      w->steals++;
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+
+  if (slot >= 0)
+    __atomic_sub_fetch(&e->pending, 1, __ATOMIC_SEQ_CST);
+  return slot;
+}
+
+static void fcio_engine_push(fcio_engine *e, int slot, long long record)
+{
+  fcio_engine_worker *w = &e->workers[record % e->nworkers];
+  pthread_mutex_lock(&w->lock);
+  w->tasks[(w->head + w->count) % e->window] = slot;
+  w->count++;
+  pthread_mutex_unlock(&w->lock);
+
+  __atomic_add_fetch(&e->pending, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&e->sleepers, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&e->lock);
+    pthread_cond_signal(&e->work_cond);
+    pthread_mutex_unlock(&e->lock);
+  }
+}
+
+static void *fcio_engine_run(void *arg)
+{
+  fcio_engine_worker *w = (fcio_engine_worker *) arg;
+  fcio_engine *e = w->engine;
+
+  while (1) {
+    double start = elapsed_time(0.0);
+    int slot;
+    while ((slot = fcio_engine_take(e, w)) < 0) {
+      pthread_mutex_lock(&e->lock);
+      __atomic_add_fetch(&e->sleepers, 1, __ATOMIC_SEQ_CST);
+      while (!e->stop && !__atomic_load_n(&e->pending, __ATOMIC_SEQ_CST))
+        pthread_cond_wait(&e->work_cond, &e->lock);
+      __atomic_sub_fetch(&e->sleepers, 1, __ATOMIC_SEQ_CST);
+      int stop = e->stop && !__atomic_load_n(&e->pending, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&e->lock);
+      if (stop) {
+        w->idle_time += elapsed_time(start);
+        return NULL;
+      }
+    }
+
+    double now = elapsed_time(0.0);
+    w->idle_time += now - start;
+    fcio_engine_slot *s = &e->slots[slot];
+    s->rc = e->config->process(s->state, w->scratch, s->result, e->config->arg);
+    w->process_time += elapsed_time(now);
+    w->events++;
+
+    __atomic_store_n(&s->done, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&e->waiting, __ATOMIC_SEQ_CST)) {
+      pthread_mutex_lock(&e->lock);
+      pthread_cond_signal(&e->done_cond);
+      pthread_mutex_unlock(&e->lock);
+    }
+  }
+}
+
+// waits until the record in slot has been processed
+static void fcio_engine_wait(fcio_engine *e, fcio_engine_slot *s)
+{
+  if (__atomic_load_n(&s->done, __ATOMIC_SEQ_CST))
+    return;
+  pthread_mutex_lock(&e->lock);
+  __atomic_store_n(&e->waiting, 1, __ATOMIC_SEQ_CST);
+  while (!__atomic_load_n(&s->done, __ATOMIC_SEQ_CST))
+    pthread_cond_wait(&e->done_cond, &e->lock);
+  __atomic_store_n(&e->waiting, 0, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&e->lock);
+}
+
+// lets the workers finish the queued events and joins them
+static void fcio_engine_stop(fcio_engine *e)
+{
+  pthread_mutex_lock(&e->lock);
+  e->stop = 1;
+  pthread_cond_broadcast(&e->work_cond);
+  pthread_mutex_unlock(&e->lock);
+
+  for (int i = 0; i < e->nworkers; i++) {
+    if (e->workers[i].running)
+      pthread_join(e->workers[i].thread, NULL);
+    e->workers[i].running = 0;
+  }
+}
+
+static void fcio_engine_close(fcio_engine *e)
+{
+  for (int i = 0; i < e->nworkers; i++) {
+    pthread_mutex_destroy(&e->workers[i].lock);
+    free(e->workers[i].tasks);
+    free(e->workers[i].scratch);
+  }
+  pthread_cond_destroy(&e->done_cond);
+  pthread_cond_destroy(&e->work_cond);
+  pthread_mutex_destroy(&e->lock);
+  free(e->workers);
+  free(e->slots);
+  free(e->results);
+}
+
+static int fcio_engine_open(fcio_engine *e, const FCIOEngineConfig *config, int nthreads, int window)
+{
+  memset(e, 0, sizeof(fcio_engine));
+  e->config = config;
+  e->window = window;
+  pthread_mutex_init(&e->lock, NULL);
+  pthread_cond_init(&e->work_cond, NULL);
+  pthread_cond_init(&e->done_cond, NULL);
+
+  e->result_stride = (config->result_size + FCIOEngineAlign - 1) / FCIOEngineAlign * FCIOEngineAlign;
+  if (!(e->slots = (fcio_engine_slot *) calloc(window, sizeof(fcio_engine_slot))) ||
+      !(e->workers = (fcio_engine_worker *) calloc(nthreads, sizeof(fcio_engine_worker))) ||
+      (e->result_stride && posix_memalign((void **)&e->results, FCIOEngineAlign, window * e->result_stride)))
+    return -1;
+  for (int i = 0; i < window; i++)
+    e->slots[i].result = e->result_stride ? e->results + i * e->result_stride : NULL;
+
+  for (int i = 0; i < nthreads; i++) {
+    fcio_engine_worker *w = &e->workers[i];
+    w->engine = e;
+    pthread_mutex_init(&w->lock, NULL);
+    e->nworkers++;
+    if (!(w->tasks = (int *) malloc(window * sizeof(int))) ||
+        (config->scratch_size && posix_memalign(&w->scratch, FCIOEngineAlign, config->scratch_size)))
+      return -1;
+    if (w->scratch)
+      memset(w->scratch, 0, config->scratch_size);
+  }
+
+  for (int i = 0; i < nthreads; i++) {
+    if (pthread_create(&e->workers[i].thread, NULL, fcio_engine_run, &e->workers[i]))
+      return -1;
+    e->workers[i].running = 1;
+  }
+  return 0;
+}
+
+
+/*=== Function ===================================================*/
+
+int FCIORunEngine(FCIOStateReader *reader, const FCIOEngineConfig *config, FCIOEngineStats *stats)
+
+/*--- Description ------------------------------------------------//
+
+Reads all records of the reader and calls config->process for each
+event record (FCIOEvent, FCIOSparseEvent, FCIOEventHeader and
+FCIORecEvent) on a pool of config->nthreads worker threads. process
+gets the state of the record, the scratch buffer of the worker and
+the result buffer of the record. config->commit is called on the
+calling thread for all records in record order, after process for
+events, with the same result buffer.
+
+Up to config->window records are processed in parallel, limited by
+the state_buffer_depth of the reader, so that the states stay valid
+until they are committed. The reader must not be used by other
+threads during the run. A reader with FCIOSetStatePrefetch decodes
+the records on its own thread.
+
+The run ends at the end of the stream, on a timeout or error of the
+reader, or when process or commit return non-zero. The record of a
+non-zero process is not committed. stats, if not NULL, is filled with
+the throughput and timing of the run.
+
+Returns the number of records committed, or <0 on error or if a
+callback returned <0.
+
+//----------------------------------------------------------------*/
+{
+  if (stats)
+    memset(stats, 0, sizeof(FCIOEngineStats));
+  if (!reader || !config || !config->process)
+    return -1;
+
+  fcio_prefetch *p = (fcio_prefetch *) reader->prefetch;
+  int history = reader->max_states - 1 - (p ? p->depth : 0);
+  int window = config->window > 0 && config->window < history ? config->window : history;
+  int nthreads = config->nthreads > 0 ? config->nthreads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (window < 1 || nthreads < 1) {
+    if (fcio_stream_debug(reader->stream))
+      fprintf(stderr, "FCIORunEngine/ERROR: the reader buffers no states, increase its state_buffer_depth\n");
+    return -1;
+  }
+
+  fcio_engine engine, *e = &engine;
+  if (fcio_engine_open(e, config, nthreads, window) < 0) {
+    if (fcio_stream_debug(reader->stream))
+      fprintf(stderr, "FCIORunEngine/ERROR: failed to start %d workers with %d records in flight\n", nthreads, window);
+    fcio_engine_stop(e);
+    fcio_engine_close(e);
+    return -1;
+  }
+
+  size_t bytes = FCIOByteCount(reader->stream, 'r');
+  double start = elapsed_time(0.0), read_time = 0.0, commit_time = 0.0, wait_time = 0.0;
+  long long nread = 0, committed = 0;
+  int rc = 0, end = 0;
+  while (!rc && (!end || committed < nread)) {
+    fcio_engine_slot *s = &e->slots[committed % window];
+    if (committed < nread && __atomic_load_n(&s->done, __ATOMIC_SEQ_CST)) {
+      if ((rc = s->rc))
+        break;
+      double now = elapsed_time(0.0);
+      rc = config->commit ? config->commit(s->state, s->result, config->arg) : 0;
+      commit_time += elapsed_time(now);
+      committed++;
+    } else if (!end && nread - committed < window) {
+      double now = elapsed_time(0.0);
+      FCIOState *state = FCIOGetNextState(reader, NULL);
+      read_time += elapsed_time(now);
+      if (!state) {
+        end = 1;
+        continue;
+      }
+      s = &e->slots[nread % window];
+      s->state = state;
+      s->rc = 0;
+      if (s->result)
+        memset(s->result, 0, config->result_size);
+      if (fcio_engine_is_event(state->last_tag)) {
+        __atomic_store_n(&s->done, 0, __ATOMIC_SEQ_CST);
+        fcio_engine_push(e, nread % window, nread);
+      } else {
+        __atomic_store_n(&s->done, 1, __ATOMIC_SEQ_CST);
+      }
+      nread++;
+    } else {
+      double now = elapsed_time(0.0);
+      fcio_engine_wait(e, s);
+      wait_time += elapsed_time(now);
+    }
+  }
+
+  fcio_engine_stop(e);
+  if (stats) {
+    stats->nthreads = nthreads;
+    stats->window = window;
+    stats->records = committed;
+    stats->bytes = FCIOByteCount(reader->stream, 'r') - bytes;
+    stats->elapsed = elapsed_time(start);
+    stats->read_time = read_time;
+    stats->commit_time = commit_time;
+    stats->wait_time = wait_time;
+    for (int i = 0; i < nthreads; i++) {
+      stats->events += e->workers[i].events;
+      stats->steals += e->workers[i].steals;
+      stats->process_time += e->workers[i].process_time;
+      stats->idle_time += e->workers[i].idle_time;
+    }
+    if (stats->elapsed > 0) {
+      stats->records_per_second = committed / stats->elapsed;
+      stats->bytes_per_second = stats->bytes / stats->elapsed;
+    }
+  }
+  fcio_engine_close(e);
+
+  if (fcio_stream_debug(reader->stream) > 3)
+    fprintf(stderr, "FCIORunEngine/DEBUG: %lld records committed with %d workers, rc %d\n", committed, nthreads, rc);
+  return rc < 0 ? -1 : (int) committed;
+}
+
+
 /* The following functions need refactoring (lots of duplicate code with FCIOGetState).
 FCIOState *FCIOGetEvent(FCIOStateReader *reader, int offset)
 {
@@ -15,6 +15,8 @@ sources: Libs-fc/fcio/fcio.c
 #ifndef INCLUDED_fcio_h
 #define INCLUDED_fcio_h
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -42,6 +44,7 @@ int FCIODebug(int level)
                                                            // Reduces the channel limit to 12 * 8 * 6 adc channels + 12 * 6 trigger channels
                                                            // This means, the maximum needed buffer size is either 2400 * 8192 = 19660800 samples or 672 * 32768 = 22020096.
 #define FCIOMaxDWords FCIOTraceBufferLength     // For backwards compatibility
+#define FCIOTraceAlignment 64                   // alignment in bytes of the trace storage and of each trace with FCIOAllocAligned
 
 typedef struct {                 // Readout configuration (typically once at start of run)
 
@@ -107,11 +110,15 @@ typedef struct {                  // Raw event
   unsigned short trace_list[FCIOMaxChannels];  // list of updated trace indices while writing/reading in sparse mode (FCIOSparseEvent)
                                                // this index list contains the valid trace[] fields which are allowed to access.
                                                // adc channels / traces which are not listed here contain the traces from the previous FCIOSparseEvent while reading!
+                                               // Use FCIOTraceValid / FCIONextValidTrace to check or iterate traces holding samples of the current record.
 
   unsigned short *trace[FCIOMaxChannels];        // Accessors for trace samples
   unsigned short *theader[FCIOMaxChannels];      // Accessors for traces incl. header bytes
                                                  // (FPGA baseline, FPGA integrator)
-  unsigned short traces[FCIOTraceBufferLength];  // internal trace storage
+  unsigned short *traces;                        // internal trace storage, allocated by FCIOAllocBuffers
+
+  unsigned int generation;                       // incremented with every event record read into this structure
+  unsigned int trace_generation[FCIOMaxChannels]; // generation of the record which last filled trace[i] with samples
 
 } fcio_event;
 
@@ -158,9 +165,9 @@ typedef struct {                  // Reconstructed event
 
   int totalpulses;
   int channel_pulses[FCIOMaxChannels];
-  int flags[FCIOMaxPulses];
-  float times[FCIOMaxPulses];
-  float amplitudes[FCIOMaxPulses];
+  int *flags;                     // pulse storage of totalpulses entries each, allocated by FCIOAllocBuffers
+  float *times;
+  float *amplitudes;
 
 } fcio_recevent;
 
@@ -203,6 +210,18 @@ typedef struct {        // Readout status (~1 Hz, programmable)
 
   card_status data[256];
 
+  struct {              // Status data of data[0..cards-1] in structure-of-arrays layout,
+                        // filled while reading for fast aggregation across cards.
+                        // linkstates are only available in data[].
+
+    unsigned int reqid[256], status[256], eventno[256], pps[256], ticks[256], maxticks[256], numenv[256],
+                  numctilinks[256], numlinks[256];
+    unsigned int totalerrors[256], enverrors[256], ctierrors[256], linkerrors[256], othererrors[5][256];
+    int          environment[16][256];
+    unsigned int ctilinks[4][256];
+
+  } fields;
+
 } fcio_status;
 
 typedef struct {                   // FlashCam envelope structure
@@ -215,8 +234,26 @@ typedef struct {                   // FlashCam envelope structure
   fcio_status status;
   fcio_recevent recevent;
 
+  int alloc_flags;                 // FCIOAllocFlags used for event.traces and recevent pulse storage
+  unsigned short *view_traces;     // internal trace payload storage of FCIOGetRecordView
+  int decode_flags;                // FCIODecodeFlags used for FCIOEvent and FCIOSparseEvent records
+  int channel_masked;              // only traces set in channel_mask are read, see FCIOSetChannelMask
+  unsigned int channel_mask[(FCIOMaxChannels + 31) / 32];
+
 } FCIOData;
 
+typedef struct {                   // Trace payload of the last record read by FCIOGetRecordView
+
+  int tag;                         // tag of the record
+  int num_traces;                  // number of traces in the payload, 0 for records without traces
+  int trace_length;                // words per trace: 2 header words (see theader) followed by eventsamples samples
+  const unsigned short *trace_list; // trace_list[i] is the trace index of the i-th trace in the payload
+  int trace_stride;                // words between the starts of consecutive traces in traces, >= trace_length
+  const unsigned short *traces;    // payload, trace i starts at traces[i * trace_stride],
+                                   // valid until the next read from the FCIOData
+
+} FCIORecordView;
+
 
 /*
   List of records tags to identify known records.
@@ -229,6 +266,12 @@ typedef struct {                   // FlashCam envelope structure
   FCIOOpen / FCIOCreateStateReader.
   libfsp provides the corresponding corresponding read functions.
 
+  FCIOTrailer and FCIOSync records only carry the bookkeeping of the
+  library and are skipped by FCIOReadMessage, so no reader returns
+  them. FCIOTrailer is the last record of files written with
+  FCIOSetTrailer, see FCIOGetSummary. FCIOSync records are written
+  with FCIOSetSyncInterval, see FCIOSetRecovery.
+
 */
 
 typedef enum {
@@ -241,15 +284,180 @@ typedef enum {
   FCIOEventHeader = 7,
   FCIOFSPConfig = 8, // reserved for libfsp
   FCIOFSPEvent = 9, // reserved for libfsp
-  FCIOFSPStatus = 10 // reserved for libfsp
+  FCIOFSPStatus = 10, // reserved for libfsp
+  FCIOTrailer = 11,
+  FCIOSync = 12
 } FCIOTag;
 
-typedef void* FCIOStream;
+/*
+  Allocation flags for the trace and pulse storage of FCIOData,
+  see FCIOAllocBuffers.
+
+  FCIOAllocStatic sizes event.traces and the recevent pulse arrays
+  for the compile-time maxima (FCIOTraceBufferLength, FCIOMaxPulses).
+  FCIOAllocDynamic sizes event.traces from the current FCIOConfig
+  and grows the pulse arrays with recevent.totalpulses.
+  FCIOAllocAligned places each trace[i] at a FCIOTraceAlignment boundary,
+  directly preceded by its two theader[i] words, with the stride between
+  traces padded to a multiple of FCIOTraceAlignment bytes. Records are
+  still sent and read in the packed layout. The padding content is undefined.
+  Always use trace[] and theader[] to access traces in this layout.
+  FCIOAllocHugePages backs storage of at least one huge page (2 MB) with
+  explicit huge pages if the system provides them, otherwise with
+  transparent huge pages, and falls back to regular pages if neither is
+  available. Smaller storage always uses regular pages.
+
+*/
+
+typedef enum {
+  FCIOAllocStatic = 0,
+  FCIOAllocDynamic = 1,
+  FCIOAllocAligned = 2,
+  FCIOAllocHugePages = 4
+} FCIOAllocFlags;
+
+/*
+  Flags for FCIOReservePool.
+
+  FCIOPoolPrefault touches all pages of the reserved buffers.
+  FCIOPoolLock additionally locks them into memory with mlock.
+  FCIOPoolHugePages reserves buffers for storage with FCIOAllocHugePages.
+
+*/
+
+typedef enum {
+  FCIOPoolPrefault = 1,
+  FCIOPoolLock = 2,
+  FCIOPoolHugePages = 4
+} FCIOPoolFlags;
+
+/*
+  Targets of FCIOSeek and FCIOSeekState.
+
+  FCIOSeekRecord positions at the n-th record of the stream (from 0).
+  FCIOSeekEvent positions at the first event record with event number
+  (timestamp[0]) >= n.
+  FCIOSeekTime positions at the first event record with a PPS/ticks
+  timestamp not before the given time.
+
+*/
+
+typedef enum {
+  FCIOSeekRecord = 0,
+  FCIOSeekEvent = 1,
+  FCIOSeekTime = 2
+} FCIOSeekMode;
+
+/*
+  Decode flags of FCIOSetDecodeFlags and FCIOSetStateDecodeFlags.
+
+  FCIODecodeFull reads all data of a record.
+  FCIODecodeHeaders reads FCIOEvent and FCIOSparseEvent records like
+  FCIOEventHeader records: only the event metadata and the two header
+  words theader[i][0..1] of each trace are filled, the samples are
+  skipped and the traces are not reported by FCIOTraceValid.
+
+*/
+
+typedef enum {
+  FCIODecodeFull = 0,
+  FCIODecodeHeaders = 1
+} FCIODecodeFlags;
+
+/*
+  Policies of FCIOSetAsyncWriter when the queue is full.
+
+  FCIOAsyncBlock waits for the writer thread.
+  FCIOAsyncDrop drops the record and counts it in FCIOAsyncStats.
+
+*/
+
+typedef enum {
+  FCIOAsyncBlock = 0,
+  FCIOAsyncDrop = 1
+} FCIOAsyncPolicy;
+
+/*
+  FCIOStream is an opaque handle of the library since 2.0.0, it no
+  longer points to a tmio_stream. Use FCIOTmioHandle for the tmio
+  stream of streams connected with tmio.
+*/
+
+typedef struct fcio_stream *FCIOStream;
+
+typedef struct {
+  const void *data;  // payload of the frame, only referenced while writing
+  int size;          // size of the payload in bytes
+} FCIOFrame;
+
+typedef struct {
+  long long offset;       // byte offset of the record tag in the stream
+  int tag;                // record tag
+  int config_generation;  // number of FCIOConfig records up to and including this record
+  int eventnumber;        // timestamp[0] of event records, -1 otherwise
+  int pps;                // timestamp[1] of event records, pps of the first card of FCIOStatus, -1 otherwise
+  int ticks;              // timestamp[2] of event records, ticks of the first card of FCIOStatus, -1 otherwise
+  int reserved;
+} FCIOIndexEntry;
+
+typedef struct {
+  long long data_size;  // byte offset of the trailer, the size of all records before it
+  int records;          // number of records before the trailer
+  int tags[16];         // number of records per tag, records with tags >= 16 are counted in tags[0]
+  int first_event;      // event number of the first event record, -1 if none
+  int last_event;       // event number of the last event record, -1 if none
+  int first_pps;        // PPS/ticks of the first and last event record, -1 if none
+  int first_ticks;
+  int last_pps;
+  int last_ticks;
+  int reserved;
+} FCIOSummary;
+
+typedef struct {
+  char magic[8];            // "FCIOSYNC"
+  long long offset;         // byte offset of the FCIOSync tag in the stream
+  long long config_offset;  // byte offset of the latest FCIOConfig, -1 if none
+  long long status_offset;  // byte offset of the latest FCIOStatus after it, -1 if none
+  int records;              // number of records before the marker, FCIOSync records are not counted
+  int config_generation;    // number of FCIOConfig records before the marker
+  int eventnumber;          // event number and PPS/ticks of the latest event record, -1 if none
+  int pps;
+  int ticks;
+  int reserved;
+} FCIOSyncMarker;
+
+typedef struct {
+  int depth;            // records the queue holds
+  int queued;           // records waiting in the queue
+  int max_queued;       // maximum of queued seen after a record was queued
+  int error;            // a write of the thread failed, later records are discarded
+  long long written;    // records written by the thread
+  long long discarded;  // records not written as a write failed, see error
+  long long dropped;    // records dropped with FCIOAsyncDrop or as a queue slot could not grow
+  long long stalls;     // records the caller waited for a free slot with FCIOAsyncBlock
+  double stall_time;    // seconds the caller waited
+} FCIOAsyncStats;
 
 FCIOData *FCIOOpen(const char *name, int timeout, int buffer)
 ;
 int FCIOClose(FCIOData *x)
 ;
+int FCIOAllocBuffers(FCIOData *x)
+;
+void FCIOFreeBuffers(FCIOData *x)
+;
+int FCIOSetAllocFlags(FCIOData *x, int alloc_flags)
+;
+int FCIOSetDecodeFlags(FCIOData *x, int decode_flags)
+;
+int FCIOSetChannelMask(FCIOData *x, int nchannels, const int *channels)
+;
+size_t FCIOSetPoolLimit(size_t max_bytes)
+;
+int FCIOReservePool(size_t size, int count, int pool_flags)
+;
+void FCIOReleasePool(void)
+;
 int FCIOPutConfig(FCIOStream output, FCIOData *input)
 ;
 int FCIOPutStatus(FCIOStream output, FCIOData *input)
@@ -266,16 +474,58 @@ int FCIOPutRecord(FCIOStream output, FCIOData* input, int tag)
 ;
 int FCIOGetRecord(FCIOData* x)
 ;
+int FCIOGetRecordView(FCIOData *x, FCIORecordView *view)
+;
+int FCIOTraceValid(const fcio_event *event, int trace_idx)
+;
+int FCIONextValidTrace(const fcio_event *event, int *cursor)
+;
 FCIOStream FCIOConnect(const char *name, int direction, int timeout, int buffer)
 ;
 int FCIODisconnect(FCIOStream x)
 ;
 int FCIOTimeout(FCIOStream x, int timeout_ms)
 ;
+size_t FCIOTell(FCIOStream x)
+;
+int FCIOSeekOffset(FCIOStream x, size_t offset)
+;
+size_t FCIOByteCount(FCIOStream x, int direction)
+;
+size_t FCIOByteCountDelta(FCIOStream x, int direction)
+;
+int FCIOSetStreamDebug(FCIOStream x, int level)
+;
+void *FCIOTmioHandle(FCIOStream x)
+;
+int FCIOSetReadahead(FCIOStream x, int readahead, int drop_behind)
+;
+int FCIOSetIndexFile(FCIOStream x, const char *name)
+;
+int FCIOReadIndexEntry(FCIOStream x, FCIOIndexEntry *entry)
+;
+int FCIOLoadIndex(FCIOStream x, const char *name)
+;
+int FCIOSetTrailer(FCIOStream x, int enable)
+;
+int FCIOGetSummary(FCIOStream x, FCIOSummary *summary)
+;
+int FCIOSetSyncInterval(FCIOStream x, int records)
+;
+int FCIOSetRecovery(FCIOStream x, int enable)
+;
+int FCIOSetAsyncWriter(FCIOStream x, int depth, int policy)
+;
+int FCIOGetAsyncStats(FCIOStream x, FCIOAsyncStats *stats)
+;
+int FCIOSeek(FCIOData *x, int mode, int value, int ticks)
+;
 int FCIOWriteMessage(FCIOStream x, int tag)
 ;
 int FCIOWrite(FCIOStream x, int size, void *data)
 ;
+int FCIOWriteFrames(FCIOStream x, int nframes, const FCIOFrame *frames)
+;
 int FCIOFlush(FCIOStream x)
 ;
 int FCIOReadMessage(FCIOStream x)
@@ -312,10 +562,15 @@ typedef struct {
   int cur_event;
   int cur_status;
   int cur_recevent;
-  fcio_config *configs;
-  fcio_event *events;
-  fcio_status *statuses;
-  fcio_recevent *recevents;
+  fcio_config **configs;
+  fcio_event **events;
+  fcio_status **statuses;
+  fcio_recevent **recevents;
+  int alloc_flags;
+  int decode_flags;
+  int channel_masked;
+  unsigned int channel_mask[(FCIOMaxChannels + 31) / 32];
+  void *prefetch;  // background decoding, see FCIOSetStatePrefetch
 
 } FCIOStateReader;
 
@@ -331,12 +586,66 @@ int FCIOSelectStateTag(FCIOStateReader *reader, int tag)
 ;
 int FCIODeselectStateTag(FCIOStateReader *reader, int tag)
 ;
+int FCIOSetStateAllocFlags(FCIOStateReader *reader, int alloc_flags)
+;
+int FCIOSetStateDecodeFlags(FCIOStateReader *reader, int decode_flags)
+;
+int FCIOSetStateChannelMask(FCIOStateReader *reader, int nchannels, const int *channels)
+;
+int FCIOSetStatePrefetch(FCIOStateReader *reader, int enable)
+;
 FCIOState *FCIOGetState(FCIOStateReader *reader, int offset, int *timedout)
 ;
 FCIOState *FCIOGetNextState(FCIOStateReader *reader, int *timedout)
 ;
+int FCIOSeekState(FCIOStateReader *reader, int mode, int value, int ticks)
+;
 int FCIOPutState(FCIOStream output, FCIOState* state, int tag)
 ;
+
+typedef void* FCIOParallelReader;
+
+FCIOParallelReader FCIOCreateParallelReader(const char *peer, int nthreads, size_t chunk_size, int ordered)
+;
+FCIOState *FCIOGetParallelState(FCIOParallelReader reader, int *chunk)
+;
+int FCIODestroyParallelReader(FCIOParallelReader reader)
+;
+
+typedef int (*FCIOEngineProcess)(FCIOState *state, void *scratch, void *result, void *arg);
+typedef int (*FCIOEngineCommit)(FCIOState *state, void *result, void *arg);
+
+typedef struct {
+  FCIOEngineProcess process;  // called for each event record on a worker thread
+  FCIOEngineCommit commit;    // called for each record in record order on the calling thread, may be NULL
+  void *arg;                  // passed to process and commit
+  size_t scratch_size;        // bytes of the scratch buffer of each worker, zeroed once
+  size_t result_size;         // bytes of the result of each record, zeroed before process
+  int nthreads;               // worker threads, the number of online processors if <= 0
+  int window;                 // records in flight, at most the state_buffer_depth of the reader if <= 0
+
+} FCIOEngineConfig;
+
+typedef struct {
+  int nthreads;               // worker threads
+  int window;                 // records in flight
+  long long records;          // records committed
+  long long events;           // event records processed
+  long long steals;           // events processed by another worker than the one they were queued for
+  long long bytes;            // bytes read from the stream
+  double elapsed;             // wall time of the run in seconds
+  double read_time;           // time the calling thread spent reading records
+  double commit_time;         // time the calling thread spent in commit
+  double wait_time;           // time the calling thread waited for results
+  double process_time;        // time spent in process, summed over the workers
+  double idle_time;           // time the workers waited for events, summed over the workers
+  double records_per_second;  // records committed per second of wall time
+  double bytes_per_second;    // bytes read per second of wall time
+
+} FCIOEngineStats;
+
+int FCIORunEngine(FCIOStateReader *reader, const FCIOEngineConfig *config, FCIOEngineStats *stats)
+;
 #ifdef __cplusplus
 }
 #endif
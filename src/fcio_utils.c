@@ -9,32 +9,28 @@ int FCIOSetMemField(FCIOStream stream, void *mem_addr, size_t mem_size) {
     return -1;
   // bufio_set_mem_field check if the stream was opened using mem://
   // returns 0 on success, 1 on error.
-  return bufio_set_mem_field((bufio_stream*)tmio_stream_handle((tmio_stream*)stream), (char*)mem_addr, mem_size);
+  tmio_stream* tmio = (tmio_stream*)FCIOTmioHandle(stream);
+  if (!tmio)
+    return 1;
+  return bufio_set_mem_field((bufio_stream*)tmio_stream_handle(tmio), (char*)mem_addr, mem_size);
 }
 
 size_t FCIOStreamBytes(FCIOStream stream, int direction, size_t offset)
 {
   if (!stream)
       return 0;
-  tmio_stream* tmio = (tmio_stream*)stream;
   switch(direction) {
-      case 'w': return tmio->byteswritten - offset;
-      case 'r': return tmio->bytesread - offset;
-      case 's': return tmio->bytesskipped - offset;
+      case 'w':
+      case 'r':
+      case 's': return FCIOByteCount(stream, direction) - offset;
       default: return 0;
   }
 }
 
+// bytes written to stream since the previous call for the same stream, counted per stream
 size_t FCIOWrittenBytes(FCIOStream stream)
 {
-  static size_t written = 0;
-  if (!stream)
-    return written = 0;
-  tmio_stream* tmio = (tmio_stream*)stream;
-
-  size_t new_bytes = tmio->byteswritten - written;
-  written = tmio->byteswritten;
-  return new_bytes;
+  return FCIOByteCountDelta(stream, 'w');
 }
 
 void FCIOMeasureRecordSizes(FCIOData* data, FCIORecordSizes* sizes)
@@ -43,7 +39,6 @@ void FCIOMeasureRecordSizes(FCIOData* data, FCIORecordSizes* sizes)
     return;
   const char* null_device = "file:///dev/null";
 
-  FCIOWrittenBytes(NULL);
   FCIOStream stream = FCIOConnect(null_device, 'w', 0, 0);
   sizes->protocol = FCIOWrittenBytes(stream);
 
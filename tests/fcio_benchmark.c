@@ -20,12 +20,24 @@ int main_writer(const char *peer,
                 int connect_timeout,
                 int nadcs,
                 int ntriggers,
-                int eventsamples
+                int eventsamples,
+                int alloc_flags,
+                int use_sparse,
+                int async_depth
                 )
 {
   FCIOData* payload = calloc(1, sizeof(FCIOData));
+  FCIOSetAllocFlags(payload, alloc_flags);
   fill_default_config(payload, 12, nadcs, ntriggers, eventsamples);
+  FCIOAllocBuffers(payload);
   fill_default_event(payload);
+  int tag = FCIOEvent;
+  if (use_sparse) {
+    tag = FCIOSparseEvent;
+    payload->event.num_traces = nadcs + ntriggers;
+    for (int i = 0; i < payload->event.num_traces; i++)
+      payload->event.trace_list[i] = i;
+  }
   int msgcounter = 0;
   FCIORecordSizes sizes = {0};
   FCIOCalculateRecordSizes(payload, &sizes);
@@ -34,19 +46,27 @@ int main_writer(const char *peer,
 
 
   FCIOStream stream = FCIOConnect(peer, 'w', connect_timeout, bufsize);
+  if (async_depth && FCIOSetAsyncWriter(stream, async_depth, FCIOAsyncBlock) < 0)
+    return msgcounter;
   if ( FCIOPutConfig(stream, payload) )
     return msgcounter;
 
   msgcounter++;
   for (int i = 0; i < events; i++) {
-    if( FCIOPutRecord(stream, payload, FCIOEvent) ) {
+    if( FCIOPutRecord(stream, payload, tag) ) {
       break;
     }
     msgcounter++;
   }
+  FCIOAsyncStats stats;
+  if (async_depth && FCIOGetAsyncStats(stream, &stats) == 0)
+    fprintf(stderr, "writer, %lld stalls waiting %.3f s, max %d of %d records queued\n", stats.stalls, stats.stall_time, stats.max_queued, stats.depth);
   FCIODisconnect(stream);
+  FCIOFreeBuffers(payload);
+  free(payload);
 
-  print_benchmark_statistics("writer", msgcounter, sizes.event, events * sizes.event);
+  size_t record_size = use_sparse ? sizes.sparseevent : sizes.event;
+  print_benchmark_statistics("writer", msgcounter, record_size, events * record_size);
 
   return msgcounter;
 }
@@ -54,16 +74,22 @@ int main_writer(const char *peer,
 
 int main_reader(const char *peer,
                 int bufsize,
-                int connect_timeout
+                int connect_timeout,
+                int alloc_flags,
+                int use_view,
+                int decode_flags
                 )
 {
   int tag;
+  FCIORecordView view;
   int msgcounter = 0;
 
   init_benchmark_statistics();
 
   FCIOData* io = FCIOOpen(peer, connect_timeout, bufsize);
-  while ( (tag = FCIOGetRecord(io)) && tag > 0)
+  FCIOSetAllocFlags(io, alloc_flags);
+  FCIOSetDecodeFlags(io, decode_flags);
+  while ( (tag = use_view ? FCIOGetRecordView(io, &view) : FCIOGetRecord(io)) && tag > 0)
     msgcounter++;
 
   FCIORecordSizes sizes = {0};
@@ -76,16 +102,44 @@ int main_reader(const char *peer,
 }
 
 
+int main_parallel_reader(const char *peer, int nthreads)
+{
+  FCIOState *state;
+  FCIORecordSizes sizes = {0};
+  int msgcounter = 0;
+
+  init_benchmark_statistics();
+
+  FCIOParallelReader reader = FCIOCreateParallelReader(peer, nthreads, 0, 0);
+  while ((state = FCIOGetParallelState(reader, NULL))) {
+    if (!sizes.event && (state->last_tag == FCIOEvent || state->last_tag == FCIOSparseEvent))
+      FCIOStateCalculateRecordSizes(state, &sizes);
+    msgcounter++;
+  }
+  FCIODestroyParallelReader(reader);
+
+  print_benchmark_statistics("parallel reader", msgcounter, sizes.event, msgcounter * sizes.event);
+
+  return msgcounter;
+}
+
+
 void usage(void)
 {
-  fprintf(stderr, "usage: fcio_benchmark [-n events] [-c nchannels] [-s eventsamples] [-v verbositylevel] [-w write_peer] [-r read_peer]\n"
+  fprintf(stderr, "usage: fcio_benchmark [-n events] [-c nchannels] [-s eventsamples] [-v verbositylevel] [-a alloc_flags] [-w write_peer] [-r read_peer]\n"
                   "  -n events: number of events to write; an event consists of a header and a payload (default: 10000)\n"
                   "  -c nchannels: number of channels\n"
                   "  -s eventsamples: number of samples per channel\n"
                   "  -b: tmio buffer size in kiB (default: 256 kiB)\n"
                   "  -t: timeout for I/O and poll operations in ms (default: 3000 ms)\n"
                   "  -v: set verbosity level\n"
+                  "  -a: FCIOAllocFlags of the writer and reader buffers, 1: dynamic, 2: aligned, 4: huge pages (default: 0)\n"
                   "  -r: set reader peer\n"
+                  "  --view: read trace payloads with FCIOGetRecordView\n"
+                  "  --sparse: write all traces as FCIOSparseEvent records\n"
+                  "  --headers: read events with FCIODecodeHeaders\n"
+                  "  --async depth: write from a writer thread with a queue of depth records\n"
+                  "  --parallel nthreads: read a mmap:// peer with FCIOCreateParallelReader\n"
                   "  -w: set writer peer\n"
                   );
 }
@@ -102,6 +156,12 @@ int main(int argc, char **argv)
   int ntriggers = 0;
   int nadcs = 1;
   int no_fork = 0;
+  int alloc_flags = 0;
+  int use_view = 0;
+  int use_sparse = 0;
+  int decode_flags = FCIODecodeFull;
+  int async_depth = 0;
+  int parallel = 0;
 
   const char* write_peer = NULL;
   const char* read_peer = NULL;
@@ -125,12 +185,24 @@ int main(int argc, char **argv)
       sscanf(argv[++i], "%d", &verbosity);
     else if (strcmp(opt, "-c") == 0)
       sscanf(argv[++i], "%d", &nadcs);
+    else if (strcmp(opt, "-a") == 0)
+      sscanf(argv[++i], "%d", &alloc_flags);
     else if (strcmp(opt, "-w") == 0)
       write_peer = argv[++i];
     else if (strcmp(opt, "-r") == 0)
       read_peer = argv[++i];
     else if (strcmp(opt, "--no-fork") == 0)
       no_fork = 1;
+    else if (strcmp(opt, "--view") == 0)
+      use_view = 1;
+    else if (strcmp(opt, "--sparse") == 0)
+      use_sparse = 1;
+    else if (strcmp(opt, "--headers") == 0)
+      decode_flags = FCIODecodeHeaders;
+    else if (strcmp(opt, "--async") == 0)
+      sscanf(argv[++i], "%d", &async_depth);
+    else if (strcmp(opt, "--parallel") == 0)
+      sscanf(argv[++i], "%d", &parallel);
     else if (strcmp(opt, "--delay") == 0) {
       switch (*argv[++i]) {
         case 'w': write_delay = atoi(argv[i]+2); break;
@@ -170,20 +242,24 @@ int main(int argc, char **argv)
   if (no_fork) {
     if (write_peer) {
       usleep(write_delay);
-      assert(main_writer(write_peer, events, bufsize, timeout, nadcs, ntriggers, eventsamples) == n_expected_records);
+      assert(main_writer(write_peer, events, bufsize, timeout, nadcs, ntriggers, eventsamples, alloc_flags, use_sparse, async_depth) == n_expected_records);
     }
     if (read_peer) {
       usleep(read_delay);
-      assert(main_reader(read_peer, bufsize, timeout) == n_expected_records);
+      if (parallel) {
+        assert(main_parallel_reader(read_peer, parallel) == n_expected_records);
+      } else {
+        assert(main_reader(read_peer, bufsize, timeout, alloc_flags, use_view, decode_flags) == n_expected_records);
+      }
     }
 
   } else {
     FORK_CHILD
     usleep(write_delay);
-    assert(main_writer(write_peer, events, bufsize, timeout, nadcs, ntriggers, eventsamples) == n_expected_records);
+    assert(main_writer(write_peer, events, bufsize, timeout, nadcs, ntriggers, eventsamples, alloc_flags, use_sparse, async_depth) == n_expected_records);
     FORK_PARENT
     usleep(read_delay);
-    assert(main_reader(read_peer, bufsize, timeout) == n_expected_records);
+    assert(main_reader(read_peer, bufsize, timeout, alloc_flags, use_view, decode_flags) == n_expected_records);
     FORK_JOIN
   }
   return 0;
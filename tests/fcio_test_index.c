@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fcio.h>
+
+#include "fcio_test_utils.h"
+#include "test.h"
+
+#define FCIODEBUG 0
+#define NEVENTS 4
+#define INDEX_HEADER 24  // magic, entry size, file size and time
+
+/*
+  Writes a file with a sidecar index and checks that indexing the
+  file afterwards, either mapped or read with tmio, gives the same
+  index and that the offsets point to the records.
+  Seeks by record, event number and time with FCIOData and the
+  state reader, using the sidecar and a freshly built index.
+  Files with a trailer provide the same index and a summary.
+  Files with sync markers are sought by time without an index and
+  are read after damaged frames in recovery mode.
+  The parallel reader, with chunks cut at the index entries or at
+  the sync markers, gives the states of the sequential state reader.
+*/
+
+static void index_file(const char* peer, const char* index_name)
+{
+  FCIOStream stream = FCIOConnect(peer, 'r', 0, 0);
+  assert(stream);
+  assert(FCIOSetIndexFile(stream, index_name) == 0);
+  FCIOIndexEntry entry;
+  while (FCIOReadIndexEntry(stream, &entry) > 0)
+    ;
+  FCIODisconnect(stream);
+}
+
+static void write_records(FCIOStream stream, FCIOData* output)
+{
+  for (int generation = 0; generation < 2; generation++) {
+    output->config.eventsamples = 64 * (generation + 1);
+    FCIOPutRecord(stream, output, FCIOConfig);
+    fill_default_event(output);
+    for (int i = 0; i < NEVENTS; i++) {
+      if (i == NEVENTS / 2) {
+        fill_default_status(output);
+        output->status.data[0].pps = 42 + generation;
+        output->status.data[0].ticks = 4242;
+        FCIOPutRecord(stream, output, FCIOStatus);
+      }
+      output->event.timestamp[0] = 100 * generation + i;
+      output->event.timestamp[1] = 10 + i;
+      output->event.timestamp[2] = 1000 * i;
+      FCIOPutRecord(stream, output, i % 2 ? FCIOSparseEvent : FCIOEvent);
+    }
+  }
+}
+
+/* reads peer with the state reader and the ordered parallel reader, returns the number of states */
+static int compare_parallel(const char* peer, int nthreads, size_t chunk_size)
+{
+  FCIOStateReader* reader = FCIOCreateStateReader(peer, 0, 0, 0);
+  FCIOParallelReader parallel = FCIOCreateParallelReader(peer, nthreads, chunk_size, 1);
+  assert(reader && parallel);
+  FCIOState *expected, *state;
+  int nstates = 0, chunk, last_chunk = 0;
+  while ((expected = FCIOGetNextState(reader, NULL))) {
+    state = FCIOGetParallelState(parallel, &chunk);
+    assert(state && state->last_tag == expected->last_tag);
+    assert(chunk >= last_chunk);
+    last_chunk = chunk;
+    assert(!expected->config || is_same_config(expected->config, state->config));
+    switch (state->last_tag) {
+      case FCIOEvent:
+        assert(is_same_event(state->config, expected->event, state->event));
+        break;
+      case FCIOSparseEvent:
+        /* the ring buffers keep stale traces of earlier events */
+        assert(state->event->num_traces == expected->event->num_traces);
+        assert(0 == memcmp(state->event->timestamp, expected->event->timestamp, sizeof(int) * 10));
+        for (int i = 0; i < state->event->num_traces; i++) {
+          int trace = state->event->trace_list[i];
+          assert(trace == expected->event->trace_list[i]);
+          assert(0 == memcmp(state->event->theader[trace], expected->event->theader[trace], sizeof(unsigned short) * (state->config->eventsamples + 2)));
+        }
+        break;
+      case FCIOStatus:
+        assert(is_same_status(expected->status, state->status));
+        break;
+    }
+    nstates++;
+  }
+  assert(FCIOGetParallelState(parallel, NULL) == NULL);
+  assert(FCIODestroyParallelReader(parallel) == 0);
+  FCIODestroyStateReader(reader);
+  return nstates;
+}
+
+/* records are numbered by their event number and time, configs at 0, n/2 and 3n/4 */
+static void write_timed_records(FCIOStream stream, FCIOData* output, int nrecords)
+{
+  for (int i = 0; i < nrecords; i++) {
+    if (i == 0 || i == nrecords / 2 || i == 3 * nrecords / 4) {
+      output->config.eventsamples = i == nrecords / 2 ? 128 : 64;
+      FCIOPutRecord(stream, output, FCIOConfig);
+      fill_default_event(output);
+    } else if (i % 7 == 0) {
+      fill_default_status(output);
+      output->status.data[0].pps = i;
+      FCIOPutRecord(stream, output, FCIOStatus);
+    } else {
+      output->event.timestamp[0] = i;
+      output->event.timestamp[1] = i;
+      output->event.timestamp[2] = 0;
+      FCIOPutRecord(stream, output, FCIOEvent);
+    }
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  assert(argc == 2);
+  char index_name[1024], reindex_name[1024], peer[1024 + 16];
+  snprintf(index_name, sizeof(index_name), "%s.fcidx", argv[1]);
+  snprintf(reindex_name, sizeof(reindex_name), "%s.re.fcidx", argv[1]);
+
+  FCIODebug(FCIODEBUG);
+
+  FCIOData* output = calloc(1, sizeof(FCIOData));
+  fill_default_config(output, 12, 24, 0, 64);
+  assert(FCIOAllocBuffers(output) == 0);
+  FCIOStream stream = FCIOConnect(argv[1], 'w', 0, 0);
+  assert(stream);
+  assert(FCIOSetIndexFile(stream, index_name) == 0);
+  write_records(stream, output);
+  FCIODisconnect(stream);
+
+  size_t size;
+  char* index_data = read_file(index_name, &size);
+  assert(index_data);
+  FCIOIndexEntry* index = (FCIOIndexEntry*)(index_data + INDEX_HEADER);
+  int nentries = (size - INDEX_HEADER) / sizeof(FCIOIndexEntry);
+  assert(nentries == 2 * (NEVENTS + 2));
+  for (int i = 0; i < nentries; i++) {
+    int generation = i / (NEVENTS + 2), k = i % (NEVENTS + 2);
+    int n = k > NEVENTS / 2 + 1 ? k - 2 : k - 1;  // event in the generation
+    assert(index[i].config_generation == 1 + generation);
+    if (k == 0) {
+      assert(index[i].tag == FCIOConfig && index[i].eventnumber == -1);
+    } else if (k == NEVENTS / 2 + 1) {
+      assert(index[i].tag == FCIOStatus && index[i].eventnumber == -1);
+      assert(index[i].pps == 42 + generation && index[i].ticks == 4242);
+    } else {
+      assert(index[i].tag == (n % 2 ? FCIOSparseEvent : FCIOEvent));
+      assert(index[i].eventnumber == 100 * generation + n);
+      assert(index[i].pps == 10 + n && index[i].ticks == 1000 * n);
+    }
+  }
+
+  /* the offsets point at the record tags */
+  snprintf(peer, sizeof(peer), "mmap://%s", argv[1]);
+  FCIOStream mapped = FCIOConnect(peer, 'r', 0, 0);
+  for (int i = nentries - 1; i >= 0; i--) {
+    assert(FCIOSeekOffset(mapped, index[i].offset) == 0);
+    assert(FCIOReadMessage(mapped) == index[i].tag);
+  }
+  FCIODisconnect(mapped);
+
+  /* indexing an existing file gives the same index */
+  size_t reindex_size;
+  index_file(peer, reindex_name);
+  char* reindex = read_file(reindex_name, &reindex_size);
+  assert(reindex_size == size && 0 == memcmp(reindex, index_data, size));
+  free(reindex);
+
+  snprintf(peer, sizeof(peer), "file://%s", argv[1]);
+  index_file(peer, reindex_name);
+  reindex = read_file(reindex_name, &reindex_size);
+  assert(reindex_size == size && 0 == memcmp(reindex, index_data, size));
+  free(reindex);
+
+  /* seek with the sidecar index, the config of the second generation is restored */
+  snprintf(peer, sizeof(peer), "mmap://%s", argv[1]);
+  FCIOData* input = FCIOOpen(peer, 0, 0);
+  assert(FCIOLoadIndex(FCIOStreamHandle(input), index_name) == nentries);
+  assert(FCIOSeek(input, FCIOSeekEvent, 102, 0) == NEVENTS + 2 + 4);
+  assert(input->config.eventsamples == 128);
+  assert(input->status.data[0].pps == 43);
+  assert(FCIOGetRecord(input) == FCIOEvent);
+  assert(input->event.timestamp[0] == 102);
+  assert(FCIOSeek(input, FCIOSeekRecord, 1, 0) == 1);
+  assert(input->config.eventsamples == 64);
+  assert(FCIOGetRecord(input) == FCIOEvent && input->event.timestamp[0] == 0);
+  assert(FCIOSeek(input, FCIOSeekTime, 11, 1001) == 4);
+  assert(input->config.eventsamples == 64 && input->status.data[0].pps == 42);
+  assert(FCIOGetRecord(input) == FCIOEvent && input->event.timestamp[0] == 2);
+  assert(FCIOSeek(input, FCIOSeekRecord, nentries, 0) < 0);
+  assert(FCIOSeek(input, FCIOSeekEvent, 1000, 0) < 0);
+  assert(FCIOSeek(input, FCIOSeekTime, 10 + NEVENTS, 0) < 0);
+  assert(FCIOSeek(input, FCIOSeekEvent, -5, 0) == 1);
+  FCIOClose(input);
+
+  /* an index not matching its file is rebuilt for mapped files and rejected otherwise */
+  char stale_name[1024], stale_index[1024];
+  snprintf(stale_name, sizeof(stale_name), "%s.stale", argv[1]);
+  snprintf(stale_index, sizeof(stale_index), "%s.stale.fcidx", argv[1]);
+  stream = FCIOConnect(stale_name, 'w', 0, 0);
+  assert(FCIOSetIndexFile(stream, stale_index) == 0);
+  write_records(stream, output);
+  FCIODisconnect(stream);
+  stream = FCIOConnect(stale_name, 'w', 0, 0);
+  FCIOPutRecord(stream, output, FCIOConfig);
+  FCIOPutRecord(stream, output, FCIOEvent);
+  FCIODisconnect(stream);
+  snprintf(peer, sizeof(peer), "file://%s", stale_name);
+  stream = FCIOConnect(peer, 'r', 0, 0);
+  assert(FCIOLoadIndex(stream, stale_index) < 0);
+  FCIODisconnect(stream);
+  snprintf(peer, sizeof(peer), "mmap://%s", stale_name);
+  stream = FCIOConnect(peer, 'r', 0, 0);
+  assert(FCIOLoadIndex(stream, stale_index) == 2);
+  FCIODisconnect(stream);
+  free(read_file(stale_index, &reindex_size));
+  assert(reindex_size == INDEX_HEADER + 2 * sizeof(FCIOIndexEntry));
+  snprintf(peer, sizeof(peer), "file://%s", stale_name);
+  stream = FCIOConnect(peer, 'r', 0, 0);
+  assert(FCIOLoadIndex(stream, stale_index) == 2);
+  FCIODisconnect(stream);
+  unlink(stale_name);
+  unlink(stale_index);
+  snprintf(peer, sizeof(peer), "mmap://%s", argv[1]);
+
+  /* the state reader builds the index itself */
+  FCIOStateReader* reader = FCIOCreateStateReader(peer, 0, 0, 4);
+  assert(reader);
+  assert(FCIOSeekState(reader, FCIOSeekEvent, 103, 0) == NEVENTS + 2 + 5);
+  FCIOState* state = FCIOGetNextState(reader, NULL);
+  assert(state && state->last_tag == FCIOSparseEvent);
+  assert(state->event->timestamp[0] == 103 && state->config->eventsamples == 128);
+  assert(state->status && state->status->data[0].pps == 43);
+  assert(FCIOGetState(reader, -1, NULL) == NULL);
+  assert(FCIOSeekState(reader, FCIOSeekRecord, 0, 0) == 0);
+  state = FCIOGetNextState(reader, NULL);
+  assert(state && state->last_tag == FCIOConfig && state->config->eventsamples == 64);
+  FCIODestroyStateReader(reader);
+
+  /* seeking drops the states decoded ahead by the prefetch thread */
+  reader = FCIOCreateStateReader(peer, 0, 0, 4);
+  assert(FCIOSetStatePrefetch(reader, 1) == 0);
+  assert(FCIOGetState(reader, 3, NULL)->last_tag == FCIOSparseEvent);
+  assert(FCIOSeekState(reader, FCIOSeekEvent, 103, 0) == NEVENTS + 2 + 5);
+  assert(FCIOGetState(reader, -1, NULL) == NULL);
+  state = FCIOGetNextState(reader, NULL);
+  assert(state && state->last_tag == FCIOSparseEvent);
+  assert(state->event->timestamp[0] == 103 && state->config->eventsamples == 128);
+  assert(state->status && state->status->data[0].pps == 43);
+  FCIODestroyStateReader(reader);
+
+  /* a seek without a matching record keeps the states decoded ahead, also without an index */
+  for (int backend = 0; backend < 2; backend++) {
+    char failed_peer[1024 + 16];
+    snprintf(failed_peer, sizeof(failed_peer), "%s%s", backend ? "mmap://" : "file://", argv[1]);
+    reader = FCIOCreateStateReader(failed_peer, 0, 0, 4);
+    assert(FCIOSetStatePrefetch(reader, 1) == 0);
+    assert(FCIOGetState(reader, 2, NULL)->last_tag == FCIOEvent);
+    assert(FCIOSeekState(reader, FCIOSeekEvent, 1000, 0) < 0);
+    state = FCIOGetNextState(reader, NULL);
+    assert(state && state->last_tag == FCIOSparseEvent && state->event->timestamp[0] == 1);
+    assert(FCIOGetState(reader, -1, NULL)->event->timestamp[0] == 0);
+    assert(FCIOGetState(reader, -2, NULL)->last_tag == FCIOConfig);
+    FCIODestroyStateReader(reader);
+  }
+
+  /* chunks of the parallel reader are cut at the records of the index built by scanning */
+  assert(compare_parallel(peer, 3, 1) == nentries);
+  assert(compare_parallel(peer, 0, 0) == nentries);
+  assert(FCIOCreateParallelReader(argv[1], 2, 1, 1) == NULL);
+
+  /* building an index needs a mapped file */
+  snprintf(peer, sizeof(peer), "file://%s", argv[1]);
+  input = FCIOOpen(peer, 0, 0);
+  assert(FCIOSeek(input, FCIOSeekRecord, 0, 0) < 0);
+  FCIOClose(input);
+
+  /* the trailer holds the same index, written with tmio, writev and from a writer thread */
+  char trailer_name[1024];
+  snprintf(trailer_name, sizeof(trailer_name), "%s.trailer", argv[1]);
+  for (int backend = 0; backend < 3; backend++) {
+    snprintf(peer, sizeof(peer), "%s%s", backend ? "writev://" : "file://", trailer_name);
+    stream = FCIOConnect(peer, 'w', 0, 0);
+    assert(FCIOSetTrailer(stream, 1) == 0);
+    if (backend == 2)
+      assert(FCIOSetAsyncWriter(stream, 4, FCIOAsyncBlock) == 0);
+    write_records(stream, output);
+    size_t data_size = FCIOByteCount(stream, 'w');
+    FCIODisconnect(stream);
+
+    snprintf(peer, sizeof(peer), "mmap://%s", trailer_name);
+    FCIOSummary summary;
+    stream = FCIOConnect(peer, 'r', 0, 0);
+    assert(FCIOGetSummary(stream, &summary) == 0);
+    assert(summary.data_size == (long long)data_size && summary.records == nentries);
+    assert(summary.tags[FCIOConfig] == 2 && summary.tags[FCIOStatus] == 2);
+    assert(summary.tags[FCIOEvent] == NEVENTS && summary.tags[FCIOSparseEvent] == NEVENTS);
+    assert(summary.first_event == 0 && summary.last_event == 100 + NEVENTS - 1);
+    assert(summary.first_pps == 10 && summary.last_ticks == 1000 * (NEVENTS - 1));
+    assert(FCIOLoadIndex(stream, NULL) == nentries);
+    assert(FCIOTell(stream) == (size_t)index[0].offset);
+    FCIODisconnect(stream);
+
+    FCIOData* input = FCIOOpen(peer, 0, 0);
+    assert(FCIOSeek(input, FCIOSeekEvent, 103, 0) == NEVENTS + 2 + 5);
+    assert(FCIOGetRecord(input) == FCIOSparseEvent && input->event.timestamp[0] == 103);
+    /* the trailer is skipped like sync markers */
+    assert(FCIOGetRecord(input) == 0);
+    FCIOClose(input);
+    assert(compare_parallel(peer, 2, 64) == nentries);
+
+    /* the summary without a trailer is calculated from the index */
+    FCIOSummary scanned;
+    snprintf(peer, sizeof(peer), "mmap://%s", argv[1]);
+    stream = FCIOConnect(peer, 'r', 0, 0);
+    assert(FCIOGetSummary(stream, &scanned) == 0);
+    FCIODisconnect(stream);
+    assert(0 == memcmp(&scanned, &summary, sizeof(summary)));
+  }
+  unlink(trailer_name);
+
+  /* sync markers every 4 records are skipped by the readers */
+  const int nrecords = 40;
+  char sync_name[1024], damaged_name[1024];
+  snprintf(sync_name, sizeof(sync_name), "%s.sync", argv[1]);
+  snprintf(damaged_name, sizeof(damaged_name), "%s.damaged", argv[1]);
+  stream = FCIOConnect(sync_name, 'w', 0, 0);
+  assert(FCIOSetIndexFile(stream, reindex_name) == 0);
+  assert(FCIOSetSyncInterval(stream, 4) == 0);
+  write_timed_records(stream, output, nrecords);
+  FCIODisconnect(stream);
+  char* sync_index_data = read_file(reindex_name, &size);
+  assert(sync_index_data);
+  FCIOIndexEntry* sync_index = (FCIOIndexEntry*)(sync_index_data + INDEX_HEADER);
+  assert((size - INDEX_HEADER) / sizeof(FCIOIndexEntry) == (size_t)nrecords);
+
+  for (int backend = 0; backend < 2; backend++) {
+    snprintf(peer, sizeof(peer), "%s%s", backend ? "mmap://" : "file://", sync_name);
+    input = FCIOOpen(peer, 0, 0);
+    assert((FCIOSetRecovery(FCIOStreamHandle(input), 1) == 0) == backend);
+    for (int i = 0; i < nrecords; i++)
+      assert(FCIOGetRecord(input) == sync_index[i].tag);
+    assert(FCIOGetRecord(input) <= 0);
+    FCIOClose(input);
+  }
+
+  /* time seeks bisect the markers, the config and status are restored */
+  input = FCIOOpen(peer, 0, 0);
+  for (int i = nrecords - 1; i > 0; i--) {
+    if (sync_index[i].tag != FCIOEvent)
+      continue;
+    assert(FCIOSeek(input, FCIOSeekTime, i, 0) == i);
+    assert(input->config.eventsamples == (i > nrecords / 2 && i < 3 * nrecords / 4 ? 128 : 64));
+    if (i > 7 && i < nrecords / 2)
+      assert((int)input->status.data[0].pps == i / 7 * 7);
+    assert(FCIOGetRecord(input) == FCIOEvent && input->event.timestamp[0] == i);
+  }
+  assert(FCIOSeek(input, FCIOSeekTime, nrecords, 0) < 0);
+  FCIOClose(input);
+  reader = FCIOCreateStateReader(peer, 0, 0, 4);
+  assert(FCIOSeekState(reader, FCIOSeekTime, 33, 0) == 33);
+  state = FCIOGetNextState(reader, NULL);
+  assert(state && state->event->timestamp[0] == 33 && state->config->eventsamples == 64);
+  FCIODestroyStateReader(reader);
+
+  /* chunks cut at the sync markers, unordered chunks keep their records in order */
+  assert(compare_parallel(peer, 4, 1) == nrecords);
+  FCIOParallelReader parallel = FCIOCreateParallelReader(peer, 4, 1, 0);
+  int last[nrecords], nstates = 0, chunk;
+  memset(last, -1, sizeof(last));
+  while ((state = FCIOGetParallelState(parallel, &chunk))) {
+    if (state->last_tag == FCIOEvent) {
+      int i = state->event->timestamp[0];
+      assert(i > last[chunk]);
+      last[chunk] = i;
+      assert(state->config->eventsamples == (i > nrecords / 2 && i < 3 * nrecords / 4 ? 128 : 64));
+    }
+    nstates++;
+  }
+  assert(nstates == nrecords);
+  assert(FCIODestroyParallelReader(parallel) == 0);
+
+  /* damage a trace frame header of record 9 and the tag of the config at record 20 */
+  char* damaged = read_file(sync_name, &size);
+  assert(damaged);
+  int damage = 0x7fffffff;
+  memcpy(damaged + sync_index[9].offset + sizeof(int), &damage, sizeof(int));
+  damage = -1000;
+  memcpy(damaged + sync_index[nrecords / 2].offset, &damage, sizeof(int));
+  FILE* f = fopen(damaged_name, "wb");
+  assert(fwrite(damaged, 1, size, f) == size);
+  fclose(f);
+  free(damaged);
+
+  /* recovery continues at the markers before records 12 and 24, and skips up to the config at record 30 */
+  snprintf(peer, sizeof(peer), "mmap://%s", damaged_name);
+  for (int recover = 0; recover < 2; recover++) {
+    input = FCIOOpen(peer, 0, 0);
+    FCIOSetRecovery(FCIOStreamHandle(input), recover);
+    int tag, nconfigs = 0, last = 0;
+    while ((tag = FCIOGetRecord(input)) > 0) {
+      if (tag == FCIOConfig)
+        nconfigs++;
+      if (tag != FCIOEvent || input->event.timestamp[0] <= last)
+        continue;
+      last = input->event.timestamp[0];
+      assert(last < 9 || (last >= 12 && last < nrecords / 2) || last > 3 * nrecords / 4);
+    }
+    assert(nconfigs == (recover ? 2 : 1));
+    assert(last == (recover ? nrecords - 1 : 8));
+    assert(!recover || FCIOByteCount(FCIOStreamHandle(input), 's') > 0);
+    FCIOClose(input);
+  }
+  unlink(damaged_name);
+  unlink(sync_name);
+  free(sync_index_data);
+
+  free(index_data);
+  unlink(index_name);
+  unlink(reindex_name);
+  FCIOFreeBuffers(output);
+  free(output);
+
+  return 0;
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fcio.h>
+
+#include "fcio_test_utils.h"
+#include "test.h"
+
+#define FCIODEBUG 0
+#define NEVENTS 5
+
+/*
+  Writes a file and reads it back from a mapping (mmap://),
+  sequentially, as views into the mapping and after seeking.
+  The same records written with writev://, uring:// and direct://,
+  or queued for a writer thread, must give an identical file.
+*/
+
+static void write_records(FCIOStream stream, FCIOData* output)
+{
+  FCIOPutRecord(stream, output, FCIOConfig);
+  fill_default_event(output);
+  for (int i = 0; i < NEVENTS; i++) {
+    output->event.timestamp[0] = i;
+    FCIOPutRecord(stream, output, FCIOEvent);
+  }
+  fill_default_sparseevent(output);
+  output->event.num_traces = 2;
+  output->event.trace_list[0] = 3;
+  output->event.trace_list[1] = 17;
+  FCIOPutRecord(stream, output, FCIOSparseEvent);
+  FCIOPutRecord(stream, output, FCIOEventHeader);
+  fill_default_status(output);
+  FCIOPutRecord(stream, output, FCIOStatus);
+}
+
+int main(int argc, char* argv[])
+{
+  assert(argc == 2);
+  char mapped_peer[1024];
+  snprintf(mapped_peer, sizeof(mapped_peer), "mmap://%s", argv[1]);
+
+  FCIODebug(FCIODEBUG);
+
+  FCIOData* output = calloc(1, sizeof(FCIOData));
+  FCIOStream stream = FCIOConnect(argv[1], 'w', 0, 0);
+  fill_default_config(output, 12, 24, 0, 128);
+  assert(FCIOAllocBuffers(output) == 0);
+  write_records(stream, output);
+  FCIODisconnect(stream);
+
+  /* mapped files are read-only, vectored files are write-only */
+  assert(FCIOConnect(mapped_peer, 'w', 0, 0) == NULL);
+  char writev_name[1024], writev_peer[1024 + 16];
+  snprintf(writev_name, sizeof(writev_name), "%s.writev", argv[1]);
+  snprintf(writev_peer, sizeof(writev_peer), "writev://%s", writev_name);
+  assert(FCIOConnect(writev_peer, 'r', 0, 0) == NULL);
+
+  /* small write buffer to exercise the flushes between records,
+     debug levels and byte count deltas are kept per stream */
+  stream = FCIOConnect(writev_peer, 'w', 0, 1);
+  assert(stream);
+  FCIOStream other = FCIOConnect(argv[1], 'r', 0, 0);
+  assert(FCIOSetStreamDebug(stream, FCIODEBUG + 1) == FCIODEBUG);
+  assert(FCIOSetStreamDebug(other, FCIODEBUG) == FCIODEBUG);
+  size_t protocol = FCIOByteCountDelta(stream, 'w');
+  assert(protocol > 0 && FCIOByteCountDelta(stream, 'w') == 0);
+  write_records(stream, output);
+  assert(FCIOReadMessage(other) == FCIOConfig && FCIOByteCountDelta(other, 'w') == 0);
+  size_t written = FCIOByteCount(stream, 'w');
+  assert(FCIOByteCountDelta(stream, 'w') == written - protocol);
+  assert(FCIOSetStreamDebug(stream, FCIODEBUG) == FCIODEBUG + 1);
+  FCIODisconnect(other);
+  FCIODisconnect(stream);
+
+  size_t size, writev_size;
+  char* data = read_file(argv[1], &size);
+  char* writev_data = read_file(writev_name, &writev_size);
+  assert(data && writev_data);
+  assert(size == writev_size && written == size);
+  assert(0 == memcmp(data, writev_data, size));
+  free(writev_data);
+
+  /* small buffers so that records span several asynchronous, and aligned direct writes */
+  const char* async_peers[] = { "uring://%s?depth=3", "direct://%s" };
+  for (int i = 0; i < 2; i++) {
+    snprintf(writev_peer, sizeof(writev_peer), async_peers[i], writev_name);
+    assert(FCIOConnect(writev_peer, 'r', 0, 0) == NULL);
+    stream = FCIOConnect(writev_peer, 'w', 0, 1);
+    assert(stream);
+    write_records(stream, output);
+    assert(FCIOFlush(stream) == 0);
+    FCIOPutRecord(stream, output, FCIOStatus);
+    written = FCIOByteCount(stream, 'w');
+    FCIODisconnect(stream);
+    writev_data = read_file(writev_name, &writev_size);
+    assert(written == writev_size && writev_size > size);
+    assert(0 == memcmp(data, writev_data, size));
+    free(writev_data);
+  }
+
+  /* records queued for a writer thread, a full queue blocks or drops records,
+     streams opened for reading have no writer thread */
+  stream = FCIOConnect(argv[1], 'r', 0, 0);
+  assert(FCIOSetAsyncWriter(stream, 2, FCIOAsyncBlock) < 0);
+  FCIODisconnect(stream);
+  for (int policy = FCIOAsyncBlock; policy <= FCIOAsyncDrop; policy++) {
+    stream = FCIOConnect(writev_name, 'w', 0, 0);
+    assert(FCIOSetAsyncWriter(stream, 2, policy) == 0);
+    write_records(stream, output);
+    FCIOAsyncStats stats;
+    assert(FCIOGetAsyncStats(stream, &stats) == 0);
+    assert(stats.depth == 2 && stats.error == 0 && stats.max_queued <= 2);
+    assert(stats.written + stats.queued + stats.discarded + stats.dropped == NEVENTS + 4);
+    assert(stats.discarded == 0);
+    assert(policy == FCIOAsyncDrop || stats.dropped == 0);
+    written = FCIOByteCount(stream, 'w');
+    assert(FCIOSetAsyncWriter(stream, 0, policy) == 2);
+    assert(FCIOGetAsyncStats(stream, &stats) < 0);
+    assert(FCIOByteCount(stream, 'w') == written);
+    assert(FCIODisconnect(stream) == 0);
+    writev_data = read_file(writev_name, &writev_size);
+    assert(written == writev_size);
+    assert(stats.dropped || (writev_size == size && 0 == memcmp(data, writev_data, size)));
+    free(writev_data);
+  }
+
+  /* failed final writes of queued or buffered records are reported by FCIODisconnect */
+  const char* full_peers[] = { "/dev/full", "writev:///dev/full", "uring:///dev/full", "uring:///dev/full" };
+  for (int i = 0; i < 4; i++) {
+    stream = FCIOConnect(full_peers[i], 'w', 0, 0);
+    assert(stream);
+    assert((i && i < 3) || FCIOSetAsyncWriter(stream, 4, FCIOAsyncBlock) == 0);
+    assert(FCIOWriteMessage(stream, FCIOStatus) == 0);  // not flushed
+    assert(FCIODisconnect(stream) < 0);
+  }
+  free(data);
+  unlink(writev_name);
+
+  /* sequential read, remembering the offsets of all records */
+  size_t offsets[NEVENTS + 5];  // records and end of file
+  int nrecords = 0;
+  FCIOData* input = FCIOOpen(mapped_peer, 0, 0);
+  assert(input);
+  int tag;
+  while ((offsets[nrecords] = FCIOTell(FCIOStreamHandle(input))), (tag = FCIOGetRecord(input)) > 0) {
+    if (tag == FCIOEvent) {
+      assert(input->event.timestamp[0] == nrecords - 1);
+      assert(0 == memcmp(input->event.trace[5], output->event.trace[5], 128 * sizeof(unsigned short)));
+    }
+    nrecords++;
+  }
+  assert(nrecords == NEVENTS + 4);
+  assert(is_same_status(&output->status, &input->status));
+  assert(FCIOByteCount(FCIOStreamHandle(input), 'r') == offsets[nrecords]);
+
+  /* seek back to the third event */
+  assert(FCIOSeekOffset(FCIOStreamHandle(input), offsets[3]) == 0);
+  assert(FCIOGetRecord(input) == FCIOEvent);
+  assert(input->event.timestamp[0] == 2);
+  assert(FCIOSeekOffset(FCIOStreamHandle(input), offsets[nrecords] + 1) < 0);
+
+  /* views point into the mapping, sparse traces are spaced by the frame headers */
+  FCIORecordView view;
+  assert(FCIOSeekOffset(FCIOStreamHandle(input), offsets[NEVENTS]) == 0);
+  assert(FCIOGetRecordView(input, &view) == FCIOEvent);
+  assert(view.num_traces == 24 && view.trace_stride == view.trace_length);
+  assert(0 == memcmp(&view.traces[5 * view.trace_stride], output->event.theader[5], view.trace_length * sizeof(unsigned short)));
+  assert(FCIOGetRecordView(input, &view) == FCIOSparseEvent);
+  assert(view.num_traces == 2 && view.trace_stride == view.trace_length + 2);
+  for (int i = 0; i < view.num_traces; i++)
+    assert(0 == memcmp(&view.traces[i * view.trace_stride], output->event.theader[view.trace_list[i]], view.trace_length * sizeof(unsigned short)));
+  assert(FCIOGetRecordView(input, &view) == FCIOEventHeader);
+
+  /* header-only decode takes the trace headers from the mapping */
+  FCIOSetDecodeFlags(input, FCIODecodeHeaders);
+  memset(input->event.traces, 0, 24 * 130 * sizeof(unsigned short));
+  assert(FCIOSeekOffset(FCIOStreamHandle(input), offsets[1]) == 0);
+  assert(FCIOGetRecord(input) == FCIOEvent && input->event.timestamp[0] == 0);
+  for (int i = 0; i < 24; i++) {
+    assert(0 == memcmp(input->event.theader[i], output->event.theader[i], 2 * sizeof(unsigned short)));
+    assert(input->event.trace[i][0] == 0 && input->event.trace[i][127] == 0);
+  }
+  FCIOSetDecodeFlags(input, FCIODecodeFull);
+
+  /* a channel mask copies the selected traces from the mapping only */
+  const int channels[] = { 23, 5 };
+  FCIOSetChannelMask(input, 2, channels);
+  memset(input->event.traces, 0, 24 * 130 * sizeof(unsigned short));
+  assert(FCIOSeekOffset(FCIOStreamHandle(input), offsets[2]) == 0);
+  assert(FCIOGetRecord(input) == FCIOEvent && input->event.timestamp[0] == 1);
+  for (int i = 0; i < 24; i++) {
+    int selected = i == 5 || i == 23;
+    assert(FCIOTraceValid(&input->event, i) == selected);
+    if (selected) {
+      assert(0 == memcmp(input->event.theader[i], output->event.theader[i], 130 * sizeof(unsigned short)));
+    } else {
+      assert(input->event.theader[i][0] == 0 && input->event.trace[i][127] == 0);
+    }
+  }
+  assert(FCIOGetRecord(input) == FCIOEvent && input->event.timestamp[0] == 2);
+  FCIOSetChannelMask(input, -1, NULL);
+  assert(FCIOSeekOffset(FCIOStreamHandle(input), offsets[NEVENTS + 3]) == 0);
+  assert(FCIOGetRecordView(input, &view) == FCIOStatus);
+  assert(view.num_traces == 0 && view.traces == NULL);
+  assert(FCIOGetRecordView(input, &view) == 0);
+  FCIOClose(input);
+
+  /* page cache advice of file readers does not change the records read */
+  char file_peer[1024 + 16];
+  snprintf(file_peer, sizeof(file_peer), "file://%s", argv[1]);
+  const char* readers[] = { mapped_peer, file_peer };
+  for (int i = 0; i < 2; i++) {
+    input = FCIOOpen(readers[i], 0, 0);
+    assert(FCIOSetReadahead(FCIOStreamHandle(input), 4096, 1) == 0);
+    for (int k = 0; k < nrecords; k++)
+      assert(FCIOGetRecord(input) > 0);
+    assert(FCIOGetRecord(input) <= 0);
+    assert(is_same_status(&output->status, &input->status));
+    assert(FCIOSetReadahead(FCIOStreamHandle(input), 0, 0) == 0);
+    FCIOClose(input);
+  }
+  stream = FCIOConnect(writev_peer, 'w', 0, 0);
+  assert(FCIOSetReadahead(stream, 4096, 1) < 0);
+  FCIODisconnect(stream);
+  unlink(writev_name);
+
+  FCIOFreeBuffers(output);
+  free(output);
+
+  return 0;
+}
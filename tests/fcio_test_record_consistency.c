@@ -4,59 +4,163 @@
 #include <unistd.h>
 
 #include <string.h>
+#include <stdint.h>
 #include <fcio.h>
 
 #include "fcio_test_utils.h"
 #include "test.h"
 
 #define FCIODEBUG 0
-int main(int argc, char* argv[])
+int check_consistency(const char* peer, int alloc_flags)
 {
-  assert(argc == 2);
-
-  const char* peer = argv[1];
-
-  FCIODebug(FCIODEBUG);
   int tag = 0;
 
   /* write test file*/
   FCIOStream stream = FCIOConnect(peer, 'w', 0, 0);
   FCIOData* input = FCIOOpen(peer, 0, 0);
+  FCIOSetAllocFlags(input, alloc_flags);
   FCIOData* output = calloc(1, sizeof(FCIOData));
+  FCIOSetAllocFlags(output, alloc_flags & FCIOAllocAligned);
   memcpy(&output->config, &input->config, sizeof(fcio_config));
   memcpy(&output->event, &input->event, sizeof(fcio_event));
   memcpy(&output->status, &input->status, sizeof(fcio_status));
   memcpy(&output->recevent, &input->recevent, sizeof(fcio_recevent));
 
   fill_default_config(output, 12, 2304, 96, 8192);
+  assert(FCIOAllocBuffers(output) == 0);
   FCIOPutRecord(stream,output, FCIOConfig);
   tag = FCIOGetRecord(input);
   assert(tag == FCIOConfig);
   assert(is_same_config(&output->config, &input->config));
+  if (alloc_flags & FCIOAllocAligned) {
+    for (int i = 0; i < input->config.adcs + input->config.triggers; i++)
+      assert((uintptr_t)input->event.trace[i] % FCIOTraceAlignment == 0);
+  }
 
   fill_default_event(output);
+  /* writing packs padded traces into a copy, the padding of the written event stays as it is */
+  const int ntraces = output->config.adcs + output->config.triggers;
+  const int length = output->config.eventsamples + 2;
+  const ptrdiff_t stride = output->event.trace[1] - output->event.trace[0];
+  for (int i = 0; i < ntraces; i++)
+    for (int k = length; k < stride; k++)
+      output->event.trace[i][k - 2] = 0xdead;
   FCIOPutRecord(stream,output, FCIOEvent);
+  for (int i = 0; i < ntraces; i++)
+    for (int k = length; k < stride; k++)
+      assert(output->event.trace[i][k - 2] == 0xdead);
   tag = FCIOGetRecord(input);
   assert(tag == FCIOEvent);
-  assert(is_same_event(&output->event, &input->event));
+  assert(is_same_event(&output->config, &output->event, &input->event));
+  for (int i = 0; i < input->config.adcs + input->config.triggers; i++)
+    assert(FCIOTraceValid(&input->event, i));
 
   fill_default_sparseevent(output);
   FCIOPutRecord(stream,output, FCIOSparseEvent);
   tag = FCIOGetRecord(input);
   assert(tag == FCIOSparseEvent);
-  assert(is_same_sparseevent(&output->event, &input->event));
+  assert(is_same_sparseevent(&output->config, &output->event, &input->event));
 
   fill_default_eventheader(output);
   FCIOPutRecord(stream,output, FCIOEventHeader);
   tag = FCIOGetRecord(input);
   assert(tag == FCIOEventHeader);
-  assert(is_same_eventheader(&output->event, &input->event));
+  assert(is_same_eventheader(&output->config, &output->event, &input->event));
+  int cursor = 0;
+  assert(FCIONextValidTrace(&input->event, &cursor) == -1);
+
+  /* traces not listed in a sparse event keep stale samples and must not be reported valid */
+  output->event.num_traces = output->config.adcs / 2;
+  for (int i = 0; i < output->event.num_traces; i++)
+    output->event.trace_list[i] = 2 * i;
+  FCIOPutRecord(stream,output, FCIOSparseEvent);
+  tag = FCIOGetRecord(input);
+  assert(tag == FCIOSparseEvent);
+  for (int i = 0; i < input->config.adcs; i++)
+    assert(FCIOTraceValid(&input->event, i) == (i % 2 == 0));
+  int trace_idx, nvalid = 0;
+  cursor = 0;
+  while ((trace_idx = FCIONextValidTrace(&input->event, &cursor)) >= 0)
+    assert(trace_idx == 2 * nvalid++);
+  assert(nvalid == output->event.num_traces);
+
+  /* trace payload read as a view, the traces of input are not touched */
+  FCIORecordView view;
+  fill_default_event(output);
+  FCIOPutRecord(stream,output, FCIOEvent);
+  assert(FCIOGetRecordView(input, &view) == FCIOEvent);
+  assert(view.num_traces == output->config.adcs + output->config.triggers);
+  assert(view.trace_length == output->config.eventsamples + 2);
+  for (int i = 0; i < view.num_traces; i++)
+    assert(0 == memcmp(&view.traces[i * view.trace_stride], output->event.theader[view.trace_list[i]], view.trace_length * sizeof(unsigned short)));
+  assert(0 == memcmp(input->event.timestamp, output->event.timestamp, sizeof(int) * 10));
+  cursor = 0;
+  assert(FCIONextValidTrace(&input->event, &cursor) == -1);
+
+  output->event.num_traces = 3;
+  output->event.trace_list[0] = 5;
+  output->event.trace_list[1] = 1;
+  output->event.trace_list[2] = 7;
+  FCIOPutRecord(stream,output, FCIOSparseEvent);
+  assert(FCIOGetRecordView(input, &view) == FCIOSparseEvent);
+  assert(view.num_traces == 3 && view.trace_list[0] == 5);
+  for (int i = 0; i < view.num_traces; i++)
+    assert(0 == memcmp(&view.traces[i * view.trace_stride], output->event.theader[view.trace_list[i]], view.trace_length * sizeof(unsigned short)));
+
+  /* header-only decode fills the metadata and the trace headers only */
+  assert(FCIOSetDecodeFlags(input, FCIODecodeHeaders) == FCIODecodeFull);
+  fill_default_event(output);
+  output->event.timestamp[0] = 17;
+  for (int i = 0; i < output->config.adcs + output->config.triggers; i++)
+    output->event.theader[i][0] = i;
+  FCIOPutRecord(stream,output, FCIOEvent);
+  assert(FCIOGetRecord(input) == FCIOEvent);
+  assert(input->event.timestamp[0] == 17 && input->event.num_traces == output->config.adcs + output->config.triggers);
+  for (int i = 0; i < input->event.num_traces; i++) {
+    assert(input->event.theader[i][0] == i && input->event.theader[i][1] == output->event.theader[i][1]);
+    assert(!FCIOTraceValid(&input->event, i));
+  }
+  output->event.num_traces = 3;
+  output->event.trace_list[0] = 5;
+  output->event.trace_list[1] = 1;
+  output->event.trace_list[2] = 7;
+  FCIOPutRecord(stream,output, FCIOSparseEvent);
+  assert(FCIOGetRecord(input) == FCIOSparseEvent);
+  assert(input->event.num_traces == 3 && input->event.trace_list[2] == 7);
+  for (int i = 0; i < input->event.num_traces; i++) {
+    int j = input->event.trace_list[i];
+    assert(input->event.theader[j][0] == j && !FCIOTraceValid(&input->event, j));
+  }
+  assert(FCIOSetDecodeFlags(input, FCIODecodeFull) == FCIODecodeHeaders);
+
+  /* a channel mask reads the selected traces only, the others are skipped */
+  const int channels[] = { 9, 2, 4 };
+  assert(FCIOSetChannelMask(input, 3, channels) == 3);
+  fill_default_event(output);
+  FCIOPutRecord(stream,output, FCIOEvent);
+  assert(FCIOGetRecord(input) == FCIOEvent);
+  assert(input->event.num_traces == output->config.adcs + output->config.triggers);
+  for (int i = 0; i < input->event.num_traces; i++)
+    assert(FCIOTraceValid(&input->event, i) == (i == 2 || i == 4 || i == 9));
+  for (int i = 0; i < 3; i++)
+    assert(0 == memcmp(input->event.theader[channels[i]], output->event.theader[channels[i]], (output->config.eventsamples + 2) * sizeof(unsigned short)));
+  output->event.num_traces = 3;
+  output->event.trace_list[0] = 5;
+  output->event.trace_list[1] = 4;
+  output->event.trace_list[2] = 7;
+  FCIOPutRecord(stream,output, FCIOSparseEvent);
+  assert(FCIOGetRecord(input) == FCIOSparseEvent);
+  assert(input->event.num_traces == 3);
+  assert(FCIOTraceValid(&input->event, 4) && !FCIOTraceValid(&input->event, 5) && !FCIOTraceValid(&input->event, 7));
+  assert(0 == memcmp(input->event.theader[4], output->event.theader[4], (output->config.eventsamples + 2) * sizeof(unsigned short)));
+  assert(FCIOSetChannelMask(input, -1, NULL) == FCIOMaxChannels);
 
   fill_default_status(output);
   FCIOPutRecord(stream,output, FCIOStatus);
   tag = FCIOGetRecord(input);
   assert(tag == FCIOStatus);
   assert(is_same_status(&output->status, &input->status));
+  assert(is_same_status_fields(&input->status));
 
   fill_default_recevent(output);
   FCIOPutRecord(stream,output, FCIORecEvent);
@@ -68,7 +172,23 @@ int main(int argc, char* argv[])
 
 
   FCIOClose(input);
+  FCIOFreeBuffers(output);
+  free(output);
 
   return 0;
 
 }
+
+int main(int argc, char* argv[])
+{
+  assert(argc == 2);
+
+  FCIODebug(FCIODEBUG);
+
+  check_consistency(argv[1], FCIOAllocStatic);
+  check_consistency(argv[1], FCIOAllocDynamic);
+  check_consistency(argv[1], FCIOAllocDynamic | FCIOAllocAligned);
+  check_consistency(argv[1], FCIOAllocStatic | FCIOAllocAligned);
+
+  return 0;
+}
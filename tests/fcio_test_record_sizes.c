@@ -84,6 +84,7 @@ int main(int argc, char* argv[])
     verbose = atoi(argv[1]);
 
   FCIOData* data = calloc(1, sizeof(FCIOData));
+  assert(FCIOAllocBuffers(data) == 0);
 
   check(data, 1, 2, verbose); // min
 
@@ -96,6 +97,7 @@ int main(int argc, char* argv[])
   check(data, 181, 32768, verbose); // lgnd fft
   check(data, 576, FCIOMaxSamples, verbose); // max 16-bit
 
+  FCIOFreeBuffers(data);
   free(data);
 
   return 0;
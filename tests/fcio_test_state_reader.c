@@ -0,0 +1,264 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fcio.h>
+
+#include "fcio_test_utils.h"
+#include "test.h"
+
+#define FCIODEBUG 0
+#define NEVENTS 5
+
+/*
+  This test checks that the state reader buffers return the records written,
+  also after the buffers have been re-sized by a config change, that
+  deselected tags do not update the buffered states and are skipped,
+  and that a prefetching reader returns the same states.
+  The engine processes events on worker threads and commits the
+  results in record order.
+*/
+
+#define NENGINE 200
+
+typedef struct {
+  int eventnumber;
+  long long sum;
+} event_result;
+
+typedef struct {
+  int nrecords;
+  int nevents;
+  int stop_after;  // records committed before commit stops the run, 0 to run to the end
+  int fail_at;     // event number at which process fails, -1 to never fail
+} engine_check;
+
+static long long trace_sum(const FCIOState* state)
+{
+  long long sum = 0;
+  for (int i = 0; i < state->config->adcs * (state->config->eventsamples + 2); i++)
+    sum += state->event->traces[i];
+  return sum;
+}
+
+static int process_event(FCIOState* state, void* scratch, void* result, void* arg)
+{
+  engine_check* check = (engine_check*)arg;
+  event_result* r = (event_result*)result;
+  if (state->event->timestamp[0] == check->fail_at)
+    return -1;
+  if (state->event->timestamp[0] % 7 == 0)
+    usleep(100);  // let later events overtake this one
+  (*(int*)scratch)++;
+  r->eventnumber = state->event->timestamp[0];
+  r->sum = trace_sum(state);
+  return 0;
+}
+
+static int commit_record(FCIOState* state, void* result, void* arg)
+{
+  engine_check* check = (engine_check*)arg;
+  event_result* r = (event_result*)result;
+  if (state->last_tag == FCIOEvent) {
+    assert(r->eventnumber == check->nevents && state->event->timestamp[0] == check->nevents);
+    assert(r->sum == trace_sum(state));
+    check->nevents++;
+  } else {
+    assert(r->eventnumber == 0 && r->sum == 0);
+  }
+  check->nrecords++;
+  return check->nrecords == check->stop_after;
+}
+
+int main(int argc, char* argv[])
+{
+  assert(argc == 2);
+
+  const char* peer = argv[1];
+
+  FCIODebug(FCIODEBUG);
+
+  /* write test file*/
+  FCIOStream stream = FCIOConnect(peer, 'w', 0, 0);
+  FCIOData* output = calloc(1, sizeof(FCIOData));
+
+  fill_default_config(output, 12, 24, 0, 128);
+  assert(FCIOAllocBuffers(output) == 0);
+  FCIOPutRecord(stream, output, FCIOConfig);
+  fill_default_event(output);
+  for (int i = 0; i < NEVENTS; i++) {
+    output->event.timestamp[0] = i;
+    FCIOPutRecord(stream, output, FCIOEvent);
+  }
+  fill_default_status(output);
+  FCIOPutRecord(stream, output, FCIOStatus);
+
+  fill_default_config(output, 12, 48, 0, 256);
+  assert(FCIOAllocBuffers(output) == 0);
+  FCIOPutRecord(stream, output, FCIOConfig);
+  fill_default_event(output);
+  output->event.timestamp[0] = NEVENTS;
+  FCIOPutRecord(stream, output, FCIOEvent);
+  FCIODisconnect(stream);
+
+  /* read all tags */
+  FCIOStateReader* reader = FCIOCreateStateReader(peer, 0, 0, 3);
+  FCIOState* state = NULL;
+  int nevents = 0;
+  while ((state = FCIOGetNextState(reader, NULL))) {
+    if (state->last_tag == FCIOEvent) {
+      assert(state->event->timestamp[0] == nevents);
+      assert(state->event->theader[0] == state->event->traces);
+      assert(state->event->trace[1] == &state->event->traces[1 * (state->config->eventsamples + 2) + 2]);
+      nevents++;
+    }
+  }
+  assert(nevents == NEVENTS + 1);
+
+  /* the last event is read with the second config, the previous states still refer to the first */
+  state = FCIOGetState(reader, 0, NULL);
+  assert(state->last_tag == FCIOEvent && state->config->adcs == 48);
+  assert(state->event->timestamp[0] == NEVENTS);
+  assert(0 == memcmp(output->event.traces, state->event->traces, sizeof(unsigned short) * 48 * 258));
+  state = FCIOGetState(reader, -2, NULL);
+  assert(state->last_tag == FCIOStatus && state->config->adcs == 24);
+  assert(state->event->timestamp[0] == NEVENTS - 1);
+  assert(FCIOGetState(reader, -4, NULL) == NULL);
+  FCIODestroyStateReader(reader);
+
+  /* read with deselected events */
+  reader = FCIOCreateStateReader(peer, 0, 0, 3);
+  FCIODeselectStateTag(reader, FCIOEvent);
+  state = FCIOGetNextState(reader, NULL);
+  assert(state->last_tag == FCIOConfig);
+  state = FCIOGetNextState(reader, NULL);
+  assert(state->last_tag == FCIOStatus);
+  assert(state->event == NULL);
+  state = FCIOGetNextState(reader, NULL);
+  assert(state->last_tag == FCIOConfig && state->config->adcs == 48);
+  assert(FCIOGetNextState(reader, NULL) == NULL);
+  /* the traces of deselected events are skipped, not read */
+  assert(FCIOByteCount(reader->stream, 's') > NEVENTS * 24 * 130 * sizeof(unsigned short));
+  FCIODestroyStateReader(reader);
+
+  /* states decoded ahead by the prefetch thread do not overwrite the buffered ones */
+  FCIOStateReader* sync_reader = FCIOCreateStateReader(peer, 0, 0, 2);
+  reader = FCIOCreateStateReader(peer, 0, 0, 2);
+  assert(FCIOSetStatePrefetch(reader, 1) == 0);
+  assert(FCIOSetStatePrefetch(reader, 1) == 1);
+  int nstates = 0;
+  while ((state = FCIOGetNextState(reader, NULL))) {
+    FCIOState* expected = FCIOGetNextState(sync_reader, NULL);
+    assert(expected && expected->last_tag == state->last_tag);
+    assert(state->config->adcs == expected->config->adcs);
+    if (state->last_tag == FCIOEvent) {
+      assert(state->event->timestamp[0] == expected->event->timestamp[0]);
+      assert(0 == memcmp(state->event->traces, expected->event->traces, sizeof(unsigned short) * state->config->adcs * (state->config->eventsamples + 2)));
+    }
+    for (int i = -1; i >= -2 && i > -nstates - 1; i--) {
+      assert(FCIOGetState(reader, i, NULL)->last_tag == FCIOGetState(sync_reader, i, NULL)->last_tag);
+      if (FCIOGetState(reader, i, NULL)->last_tag == FCIOEvent)
+        assert(FCIOGetState(reader, i, NULL)->event->timestamp[0] == FCIOGetState(sync_reader, i, NULL)->event->timestamp[0]);
+    }
+    assert(FCIOGetState(reader, -3, NULL) == NULL);
+    nstates++;
+  }
+  assert(nstates == NEVENTS + 4);
+  assert(FCIOGetNextState(sync_reader, NULL) == NULL);
+  assert(FCIOSetStatePrefetch(reader, 0) < 0);
+  FCIODestroyStateReader(reader);
+
+  /* positive offsets skip states, the skipped ones become the buffered states */
+  reader = FCIOCreateStateReader(peer, 0, 0, 2);
+  assert(FCIOSetStatePrefetch(reader, 1) == 0);
+  state = FCIOGetState(reader, 4, NULL);
+  assert(state->last_tag == FCIOEvent && state->event->timestamp[0] == 2);
+  assert(FCIOGetState(reader, -2, NULL)->event->timestamp[0] == 0);
+  assert(FCIOGetState(reader, 0, NULL) == state);
+  assert(FCIOGetState(reader, NEVENTS + 4, NULL) == NULL);
+  assert(FCIOGetState(reader, 0, NULL)->last_tag == FCIOEvent);
+  assert(FCIOGetState(reader, 0, NULL)->event->timestamp[0] == NEVENTS);
+  FCIODestroyStateReader(reader);
+  FCIODestroyStateReader(sync_reader);
+
+  /* a second reader reuses the pooled trace storage of the first one */
+  assert(FCIOSetPoolLimit((size_t)1 << 30) == 0);
+  reader = FCIOCreateStateReader(peer, 0, 0, 3);
+  FCIOGetNextState(reader, NULL);
+  state = FCIOGetNextState(reader, NULL);
+  assert(state->last_tag == FCIOEvent);
+  unsigned short *traces = state->event->traces;
+  FCIODestroyStateReader(reader);
+  reader = FCIOCreateStateReader(peer, 0, 0, 3);
+  FCIOGetNextState(reader, NULL);
+  state = FCIOGetNextState(reader, NULL);
+  assert(state->last_tag == FCIOEvent && state->event->traces == traces);
+  assert(state->event->timestamp[0] == 0);
+  FCIODestroyStateReader(reader);
+  FCIOReleasePool();
+  assert(FCIOSetPoolLimit(0) == (size_t)1 << 30);
+
+  /* events with a config change and statuses in between for the engine */
+  char engine_peer[1024];
+  snprintf(engine_peer, sizeof(engine_peer), "%s.engine", peer);
+  stream = FCIOConnect(engine_peer, 'w', 0, 0);
+  for (int i = 0; i < NENGINE; i++) {
+    if (i == 0 || i == NENGINE / 2) {
+      fill_default_config(output, 12, i ? 48 : 24, 0, i ? 64 : 128);
+      assert(FCIOAllocBuffers(output) == 0);
+      FCIOPutRecord(stream, output, FCIOConfig);
+      fill_default_event(output);
+    }
+    if (i % 50 == 25) {
+      fill_default_status(output);
+      FCIOPutRecord(stream, output, FCIOStatus);
+    }
+    output->event.timestamp[0] = i;
+    output->event.traces[i % 64] = i;
+    FCIOPutRecord(stream, output, FCIOEvent);
+  }
+  FCIODisconnect(stream);
+  const int nrecords = NENGINE + 2 + NENGINE / 50;
+
+  for (int prefetch = 0; prefetch < 2; prefetch++) {
+    engine_check check = { 0, 0, 0, -1 };
+    FCIOEngineConfig config = { process_event, commit_record, &check, sizeof(int), sizeof(event_result), 4, 0 };
+    FCIOEngineStats stats;
+    reader = FCIOCreateStateReader(engine_peer, 0, 0, 16);
+    assert(FCIOSetStatePrefetch(reader, prefetch) == 0);
+    assert(FCIORunEngine(reader, &config, &stats) == nrecords);
+    assert(check.nrecords == nrecords && check.nevents == NENGINE);
+    assert(stats.records == nrecords && stats.events == NENGINE);
+    assert(stats.nthreads == 4 && stats.window == 16);
+    assert(stats.bytes > 0 && stats.elapsed > 0 && stats.records_per_second > 0);
+    FCIODestroyStateReader(reader);
+  }
+
+  /* commit stops the run, a failing process ends it before its record */
+  reader = FCIOCreateStateReader(engine_peer, 0, 0, 8);
+  engine_check check = { 0, 0, 10, -1 };
+  FCIOEngineConfig config = { process_event, commit_record, &check, sizeof(int), sizeof(event_result), 3, 4 };
+  assert(FCIORunEngine(reader, &config, NULL) == 10);
+  FCIODestroyStateReader(reader);
+
+  reader = FCIOCreateStateReader(engine_peer, 0, 0, 8);
+  check = (engine_check){ 0, 0, 0, 42 };
+  FCIOEngineStats stats;
+  assert(FCIORunEngine(reader, &config, &stats) < 0);
+  assert(check.nevents == 42 && stats.records == 42 + 2);
+  assert(stats.window == 4 && stats.events >= 42);
+  config.window = 0;
+  FCIODestroyStateReader(reader);
+  reader = FCIOCreateStateReader(engine_peer, 0, 0, 0);
+  assert(FCIORunEngine(reader, &config, NULL) < 0);
+  FCIODestroyStateReader(reader);
+  unlink(engine_peer);
+
+  FCIOFreeBuffers(output);
+  free(output);
+
+  return 0;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <fcio.h>
@@ -55,7 +57,7 @@ void fill_default_event(FCIOData* io)
   int counter = 0;
   for (int trace_idx = 0; trace_idx < io->config.adcs; trace_idx++) {
     for (int sample_idx = 0; sample_idx < io->config.eventsamples; sample_idx++) {
-      io->event.traces[trace_idx * (io->config.eventsamples + 2) + sample_idx] = counter++;
+      io->event.theader[trace_idx][sample_idx] = counter++;
     }
   }
 }
@@ -76,7 +78,7 @@ void fill_default_sparseevent(FCIOData* io)
   int counter = 0;
   for (int trace_idx = 0; trace_idx < io->config.adcs; trace_idx++) {
     for (int sample_idx = 0; sample_idx < io->config.eventsamples; sample_idx++) {
-      io->event.traces[trace_idx * (io->config.eventsamples + 2) + sample_idx] = counter++;
+      io->event.theader[trace_idx][sample_idx] = counter++;
     }
   }
 }
@@ -97,19 +99,50 @@ void fill_default_eventheader(FCIOData* io)
   int counter = 0;
   for (int trace_idx = 0; trace_idx < io->config.adcs; trace_idx++) {
     for (int sample_idx = 0; sample_idx < io->config.eventsamples; sample_idx++) {
-      io->event.traces[trace_idx * (io->config.eventsamples + 2) + sample_idx] = counter++;
+      io->event.theader[trace_idx][sample_idx] = counter++;
     }
   }
 }
 
-void fill_default_status(__attribute__((unused))FCIOData* io)
+void fill_default_status(FCIOData* io)
 {
-  return;
+  io->status.status = 1;
+  for (int i = 0; i < 10; i++)
+    io->status.statustime[i] = i;
+  io->status.cards = 1 + io->config.adcs / 24;
+  io->status.size = sizeof(card_status);
+  for (int i = 0; i < io->status.cards; i++) {
+    card_status *card = &io->status.data[i];
+    memset(card, 0, sizeof(card_status));
+    card->reqid = i;
+    card->status = 1;
+    card->eventno = 100 + i;
+    card->totalerrors = i % 3;
+    card->othererrors[4] = i;
+    card->numenv = 16;
+    for (int k = 0; k < 16; k++)
+      card->environment[k] = 1000 * k - i;
+    card->ctilinks[3] = 7 * i;
+    card->linkstates[255] = i;
+  }
 }
 
-void fill_default_recevent(__attribute__((unused))FCIOData* io)
+void fill_default_recevent(FCIOData* io)
 {
-  return;
+  io->recevent.type = 1;
+  io->recevent.timestamp_size = 5;
+  io->recevent.timeoffset_size = 5;
+  io->recevent.deadregion_size = 5;
+
+  io->recevent.totalpulses = 0;
+  for (int i = 0; i < io->config.adcs; i++) {
+    io->recevent.channel_pulses[i] = i % 4;
+    for (int k = 0; k < io->recevent.channel_pulses[i]; k++, io->recevent.totalpulses++) {
+      io->recevent.flags[io->recevent.totalpulses] = k;
+      io->recevent.times[io->recevent.totalpulses] = 8.0 * i + k;
+      io->recevent.amplitudes[io->recevent.totalpulses] = 1.0 + k;
+    }
+  }
 }
 
 int is_same_config(fcio_config *left, fcio_config *right)
@@ -117,7 +150,16 @@ int is_same_config(fcio_config *left, fcio_config *right)
   return 0 == memcmp(left, right, sizeof(fcio_config));
 }
 
-int is_same_event(fcio_event *left, fcio_event *right)
+int is_same_traces(fcio_config *config, fcio_event *left, fcio_event *right)
+{
+  for (int i = 0; i < config->adcs + config->triggers; i++) {
+    if (memcmp(left->theader[i], right->theader[i], sizeof(unsigned short) * (config->eventsamples + 2)))
+      return 0;
+  }
+  return 1;
+}
+
+int is_same_event(fcio_config *config, fcio_event *left, fcio_event *right)
 {
   return left->type == right->type
   && left->pulser == right->pulser
@@ -129,11 +171,11 @@ int is_same_event(fcio_event *left, fcio_event *right)
   && 0 == memcmp(left->timestamp, right->timestamp, sizeof(int) * 10 )
   && 0 == memcmp(left->deadregion, right->deadregion, sizeof(int) * 10 )
   && 0 == memcmp(left->trace_list, right->trace_list, sizeof(unsigned short) * FCIOMaxChannels )
-  && 0 == memcmp(left->traces, right->traces, sizeof(unsigned short) * FCIOTraceBufferLength )
+  && is_same_traces(config, left, right)
   ;
 }
 
-int is_same_sparseevent(fcio_event *left, fcio_event *right)
+int is_same_sparseevent(fcio_config *config, fcio_event *left, fcio_event *right)
 {
   return left->type == right->type
   && left->pulser == right->pulser
@@ -145,11 +187,11 @@ int is_same_sparseevent(fcio_event *left, fcio_event *right)
   && 0 == memcmp(left->timestamp, right->timestamp, sizeof(int) * 10 )
   && 0 == memcmp(left->deadregion, right->deadregion, sizeof(int) * 10 )
   && 0 == memcmp(left->trace_list, right->trace_list, sizeof(unsigned short) * FCIOMaxChannels )
-  && 0 == memcmp(left->traces, right->traces, sizeof(unsigned short) * FCIOTraceBufferLength )
+  && is_same_traces(config, left, right)
   ;
 }
 
-int is_same_eventheader(fcio_event *left, fcio_event *right)
+int is_same_eventheader(fcio_config *config, fcio_event *left, fcio_event *right)
 {
   return left->type == right->type
   && left->pulser == right->pulser
@@ -161,16 +203,78 @@ int is_same_eventheader(fcio_event *left, fcio_event *right)
   && 0 == memcmp(left->timestamp, right->timestamp, sizeof(int) * 10 )
   && 0 == memcmp(left->deadregion, right->deadregion, sizeof(int) * 10 )
   && 0 == memcmp(left->trace_list, right->trace_list, sizeof(unsigned short) * FCIOMaxChannels )
-  && 0 == memcmp(left->traces, right->traces, sizeof(unsigned short) * FCIOTraceBufferLength )
+  && is_same_traces(config, left, right)
   ;
 }
 
 int is_same_status(fcio_status *left, fcio_status *right)
 {
-  return 0 == memcmp(left, right, sizeof(fcio_status));
+  return left->status == right->status
+  && left->cards == right->cards
+  && left->size == right->size
+  && 0 == memcmp(left->statustime, right->statustime, sizeof(int) * 10)
+  && 0 == memcmp(left->data, right->data, sizeof(card_status) * left->cards)
+  ;
+}
+
+int is_same_status_fields(fcio_status *status)
+{
+  for (int i = 0; i < status->cards; i++) {
+    card_status *card = &status->data[i];
+    if (status->fields.reqid[i] != card->reqid
+      || status->fields.status[i] != card->status
+      || status->fields.eventno[i] != card->eventno
+      || status->fields.numenv[i] != card->numenv
+      || status->fields.totalerrors[i] != card->totalerrors)
+      return 0;
+    for (int k = 0; k < 5; k++)
+      if (status->fields.othererrors[k][i] != card->othererrors[k])
+        return 0;
+    for (int k = 0; k < 16; k++)
+      if (status->fields.environment[k][i] != card->environment[k])
+        return 0;
+    for (int k = 0; k < 4; k++)
+      if (status->fields.ctilinks[k][i] != card->ctilinks[k])
+        return 0;
+  }
+  return 1;
 }
 
 int is_same_recevent(fcio_recevent *left, fcio_recevent *right)
 {
-  return 0 == memcmp(left, right, sizeof(fcio_recevent));
+  return left->type == right->type
+  && left->pulser == right->pulser
+  && left->timestamp_size == right->timestamp_size
+  && left->deadregion_size == right->deadregion_size
+  && left->timeoffset_size == right->timeoffset_size
+  && left->totalpulses == right->totalpulses
+  && 0 == memcmp(left->timeoffset, right->timeoffset, sizeof(int) * 10 )
+  && 0 == memcmp(left->timestamp, right->timestamp, sizeof(int) * 10 )
+  && 0 == memcmp(left->deadregion, right->deadregion, sizeof(int) * 10 )
+  && 0 == memcmp(left->channel_pulses, right->channel_pulses, sizeof(int) * FCIOMaxChannels )
+  && 0 == memcmp(left->flags, right->flags, sizeof(int) * left->totalpulses )
+  && 0 == memcmp(left->times, right->times, sizeof(float) * left->totalpulses )
+  && 0 == memcmp(left->amplitudes, right->amplitudes, sizeof(float) * left->totalpulses )
+  ;
+}
+
+// reads a whole file into a malloc'd buffer, returns NULL and size 0 if it can not be read
+char* read_file(const char* name, size_t* size)
+{
+  *size = 0;
+  FILE* f = fopen(name, "rb");
+  if (!f)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  rewind(f);
+  char* data = malloc(*size + 1);
+  if (data && fread(data, 1, *size, f) != *size) {
+    free(data);
+    data = NULL;
+  }
+  if (!data)
+    *size = 0;
+  fclose(f);
+  return data;
 }